@@ -0,0 +1,199 @@
+#include "atomic_file.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "downscaler.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    std::atomic<unsigned int> nextTempFileId = 0;
+
+
+    // Hidden and with an extension the directory scanner ignores, in case a crash leaves one behind
+    string getTempPath(const fs::path& filePath) {
+#ifdef _WIN32
+        int processId = _getpid();
+#else
+        int processId = getpid();
+#endif
+        string tempName = "." + filePath.filename().string() + ".tmp-" + std::to_string(processId) + "-" + std::to_string(nextTempFileId++);
+        return (filePath.parent_path() / tempName).string();
+    }
+
+
+#ifdef _WIN32
+    bool writeAll(int fd, const unsigned char* data, size_t size) {
+        while (size > 0) {
+            unsigned int chunk = (unsigned int) std::min<size_t>(size, 1u << 30);
+            int written = _write(fd, data, chunk);
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+
+    bool writeTempFile(const string& tempPath, const void* data, size_t size, const AtomicWriteOptions& options) {
+        int fd = _open(tempPath.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+        if (fd < 0) {
+            return false;
+        }
+        bool success = writeAll(fd, static_cast<const unsigned char*>(data), size);
+        if (success && options.fsyncPolicy != FsyncPolicy::None) {
+            success = _commit(fd) == 0;
+        }
+        success = _close(fd) == 0 && success;
+
+        std::error_code error;
+        if (success && !options.attributesFrom.empty() && fs::exists(options.attributesFrom, error)) {
+            fs::permissions(tempPath, fs::status(options.attributesFrom, error).permissions(), error);
+            if (options.preserveTimes) {
+                fs::last_write_time(tempPath, fs::last_write_time(options.attributesFrom, error), error);
+            }
+        }
+        return success;
+    }
+
+
+    void syncDirectory(const fs::path&) {
+        // Windows has no directory fsync, the rename is journaled by NTFS
+    }
+#else
+    bool writeAll(int fd, const unsigned char* data, size_t size) {
+        // One call writes the whole buffer for regular files, the loop only handles signals and odd file systems
+        while (size > 0) {
+            ssize_t written = write(fd, data, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+
+    bool writeTempFile(const string& tempPath, const void* data, size_t size, const AtomicWriteOptions& options) {
+        int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool success = writeAll(fd, static_cast<const unsigned char*>(data), size);
+
+        struct stat sourceInfo;
+        if (success && !options.attributesFrom.empty() && stat(options.attributesFrom.c_str(), &sourceInfo) == 0) {
+            fchmod(fd, sourceInfo.st_mode & 07777);
+            // Only works as root (or for a group the user is in), a file owned by someone else becomes ours otherwise
+            if (fchown(fd, sourceInfo.st_uid, sourceInfo.st_gid) != 0) {
+                errno = 0;
+            }
+            if (options.preserveTimes) {
+#ifdef __APPLE__
+                struct timespec times[2] = {sourceInfo.st_atimespec, sourceInfo.st_mtimespec};
+#else
+                struct timespec times[2] = {sourceInfo.st_atim, sourceInfo.st_mtim};
+#endif
+                futimens(fd, times);
+            }
+        }
+
+        if (success && options.fsyncPolicy != FsyncPolicy::None) {
+            success = fsync(fd) == 0;
+        }
+        success = close(fd) == 0 && success;
+        return success;
+    }
+
+
+    void syncDirectory(const fs::path& directoryPath) {
+        int fd = open(directoryPath.empty() ? "." : directoryPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+#endif
+}
+
+
+bool writeFileAtomically(const string& filePath, const void* data, size_t size, const AtomicWriteOptions& options) {
+    fs::path path(filePath);
+    // Renaming over a symlink would replace the link with a regular file and leave the image it points to as it was,
+    // so the file it points to is replaced instead (with the temp file next to it, on the same file system)
+    std::error_code linkError;
+    if (fs::is_symlink(path, linkError)) {
+        fs::path target = fs::weakly_canonical(path, linkError);
+        if (!linkError) {
+            path = target;
+        }
+    }
+    string tempPath = getTempPath(path);
+
+    if (!writeTempFile(tempPath, data, size, options)) {
+        string reason = std::strerror(errno);
+        std::error_code error;
+        fs::remove(tempPath, error);
+        cerrPlus("Failed to write the temporary file: " + tempPath + " (" + reason + ")");
+        return false;
+    }
+
+    std::error_code error;
+    fs::rename(tempPath, path, error);
+    if (error) {
+        fs::remove(tempPath, error);
+        cerrPlus("Failed to replace the file: " + filePath + " (" + error.message() + ")");
+        return false;
+    }
+
+    if (options.fsyncPolicy == FsyncPolicy::Full) {
+        // The rename itself is only durable once the directory entry is on disk
+        syncDirectory(path.parent_path());
+    }
+    return true;
+}
+
+
+std::optional<FsyncPolicy> parseFsyncPolicy(const string& name) {
+    if (name == "none") {
+        return FsyncPolicy::None;
+    }
+    if (name == "file") {
+        return FsyncPolicy::File;
+    }
+    if (name == "full") {
+        return FsyncPolicy::Full;
+    }
+    return std::nullopt;
+}
+
+
+string getFsyncPolicyName(FsyncPolicy policy) {
+    switch (policy) {
+        case FsyncPolicy::None:
+            return "none";
+        case FsyncPolicy::Full:
+            return "full";
+        default:
+            return "file";
+    }
+}
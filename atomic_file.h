@@ -0,0 +1,31 @@
+#ifndef IMAGE_DOWNSCALER_ATOMIC_FILE_H
+#define IMAGE_DOWNSCALER_ATOMIC_FILE_H
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+
+enum class FsyncPolicy {
+    None,  // leave it to the OS, a power loss shortly after the run can still lose the new files
+    File,  // flush the file before it replaces the original
+    Full  // also flush the directory after the rename (POSIX only, Windows flushes the file only)
+};
+
+
+struct AtomicWriteOptions {
+    FsyncPolicy fsyncPolicy = FsyncPolicy::File;
+    std::string attributesFrom;  // copy the permissions (and the timestamps if preserveTimes) from this file, if it exists
+    bool preserveTimes = false;
+};
+
+
+// Writes the data with a single write call into a temporary file next to filePath and renames it over filePath, so
+// filePath always holds either the old or the complete new content, even if the process is killed halfway through.
+// If filePath is a symlink, the file it points to gets the new content and the link stays.
+bool writeFileAtomically(const std::string& filePath, const void* data, size_t size, const AtomicWriteOptions& options);
+std::optional<FsyncPolicy> parseFsyncPolicy(const std::string& name);
+std::string getFsyncPolicyName(FsyncPolicy policy);
+
+
+#endif //IMAGE_DOWNSCALER_ATOMIC_FILE_H
@@ -0,0 +1,251 @@
+// Benchmarks for the read -> resize -> encode hot path over a corpus made by bench-corpus.
+//
+// Usage: bench --corpus <directory> [--max-length N] [--benchmark_format=json] [other Google Benchmark flags]
+//
+// Every benchmark uses manual timing, so only the measured call is timed (copying inputs and setting up temporary
+// files is not), and reports:
+//   items_per_second - images/s
+//   MB/s             - input megabytes/s (compressed file size for read/process, raw pixels for resize/encode)
+//   p50_ms, p99_ms   - per-image latency percentiles
+//   peak_rss_MB      - peak resident set size of the process so far
+//   output_KB        - encoded size (encoder/* only, one per backend, to compare speed and size of the backends)
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "downscaler.h"
+#include "mat_pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+
+namespace {
+    const vector<string> corpusExtensions = {".jpg", ".jpeg", ".png", ".webp"};
+    fs::path benchTempDir;
+
+
+    double getPeakRssMB() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return 0;
+        }
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes on macOS
+#else
+        return usage.ru_maxrss / 1024.0;  // kilobytes on Linux
+#endif
+#endif
+    }
+
+
+    double getPercentile(vector<double> values, double percentile) {
+        if (values.empty()) {
+            return 0;
+        }
+        size_t index = std::min(values.size() - 1, (size_t)(percentile * (values.size() - 1) + 0.5));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+
+    // Runs `measure` once per iteration; it returns how long the measured part took.
+    template <typename Measure>
+    void runTimed(benchmark::State& state, int64_t bytesPerIteration, Measure measure) {
+        vector<double> latenciesMs;
+        for (auto _ : state) {
+            double seconds = measure();
+            state.SetIterationTime(seconds);
+            latenciesMs.push_back(seconds * 1000.0);
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.counters["MB/s"] = benchmark::Counter((double)bytesPerIteration * state.iterations() / 1e6, benchmark::Counter::kIsRate);
+        state.counters["p50_ms"] = getPercentile(latenciesMs, 0.50);
+        state.counters["p99_ms"] = getPercentile(latenciesMs, 0.99);
+        state.counters["peak_rss_MB"] = getPeakRssMB();
+    }
+
+
+    template <typename Function>
+    double timeCall(Function function) {
+        auto start = Clock::now();
+        function();
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+
+    int64_t getPixelBytes(const Mat& image) {
+        return (int64_t)image.total() * image.elemSize();
+    }
+
+
+    void benchReadImage(benchmark::State& state, const string& imagePath) {
+        runTimed(state, getFileSize(imagePath), [&] {
+            return timeCall([&] { benchmark::DoNotOptimize(readImage(imagePath)); });
+        });
+    }
+
+
+    void benchResizeImage(benchmark::State& state, const string& imagePath) {
+        std::optional<LoadedImage> loadedImage = readImage(imagePath);
+        if (!loadedImage) {
+            state.SkipWithError("failed to read image");
+            return;
+        }
+        runTimed(state, getPixelBytes(loadedImage->image), [&] {
+            return timeCall([&] { benchmark::DoNotOptimize(resizeImage(*loadedImage)); });
+        });
+    }
+
+
+    void benchEncodeImage(benchmark::State& state, const string& imagePath) {
+        std::optional<LoadedImage> loadedImage = readImage(imagePath);
+        if (!loadedImage) {
+            state.SkipWithError("failed to read image");
+            return;
+        }
+        std::optional<Mat> resizedImage = std::get<0>(resizeImage(*loadedImage));
+        const Mat& image = resizedImage ? *resizedImage : loadedImage->image;
+        string outputPath = (benchTempDir / ("encode" + getFileExtension(imagePath))).string();
+
+        runTimed(state, getPixelBytes(image), [&] {
+            return timeCall([&] {
+                saveImage(outputPath, image, getCompressionParamsForImage(getFileExtension(imagePath)));
+            });
+        });
+    }
+
+
+    // Encodes with one backend only, without writing, so backends can be compared on the same images
+    void benchEncoder(benchmark::State& state, const string& imagePath, const ImageEncoder* encoder) {
+        std::optional<LoadedImage> loadedImage = readImage(imagePath);
+        if (!loadedImage) {
+            state.SkipWithError("failed to read image");
+            return;
+        }
+        std::optional<Mat> resizedImage = std::get<0>(resizeImage(*loadedImage));
+        const Mat& image = resizedImage ? *resizedImage : loadedImage->image;
+        string fileExtension = toLowerCase(getFileExtension(imagePath));
+        vector<int> compressionParams = getCompressionParamsForImage(fileExtension);
+
+        vector<uchar> encodedImage;
+        runTimed(state, getPixelBytes(image), [&] {
+            return timeCall([&] { encoder->encode(fileExtension, image, compressionParams, encodedImage); });
+        });
+        state.counters["output_KB"] = encodedImage.size() / 1024.0;
+    }
+
+
+    void benchProcessTask(benchmark::State& state, const string& imagePath) {
+        string workPath = (benchTempDir / fs::path(imagePath).filename()).string();
+        runTimed(state, getFileSize(imagePath), [&] {
+            // processTask overwrites its input, so every iteration gets a fresh copy
+            fs::copy_file(imagePath, workPath, fs::copy_options::overwrite_existing);
+            return timeCall([&] { processTask(workPath, 0); });
+        });
+    }
+
+
+    vector<string> findCorpusImages(const fs::path& corpusDir) {
+        vector<string> imagePaths;
+        for (const auto& entry : fs::directory_iterator(corpusDir)) {
+            if (entry.is_regular_file() && isStringInList(toLowerCase(entry.path().extension().string()), corpusExtensions)) {
+                imagePaths.push_back(entry.path().string());
+            }
+        }
+        std::sort(imagePaths.begin(), imagePaths.end());
+        return imagePaths;
+    }
+
+
+    void registerBenchmarks(const vector<string>& imagePaths) {
+        using BenchFunction = void (*)(benchmark::State&, const string&);
+        const std::pair<const char*, BenchFunction> benchmarks[] = {
+                {"readImage", benchReadImage},
+                {"resizeImage", benchResizeImage},
+                {"encodeImage", benchEncodeImage},
+                {"processTask", benchProcessTask}
+        };
+        for (const auto& [name, function] : benchmarks) {
+            for (const string& imagePath : imagePaths) {
+                string benchName = string(name) + "/" + fs::path(imagePath).filename().string();
+                benchmark::RegisterBenchmark(benchName.c_str(), function, imagePath)
+                        ->UseManualTime()
+                        ->Unit(benchmark::kMillisecond);
+            }
+        }
+
+        for (const ImageEncoder* encoder : getImageEncoders()) {
+            for (const string& imagePath : imagePaths) {
+                string fileExtension = toLowerCase(getFileExtension(imagePath));
+                // canEncode only looks at the format and the pixel type, the corpus is all 8-bit BGR
+                if (!encoder->canEncode(fileExtension, Mat(1, 1, CV_8UC3))) {
+                    continue;
+                }
+                string benchName = "encoder/" + encoder->getName() + "/" + fs::path(imagePath).filename().string();
+                benchmark::RegisterBenchmark(benchName.c_str(), benchEncoder, imagePath, encoder)
+                        ->UseManualTime()
+                        ->Unit(benchmark::kMillisecond);
+            }
+        }
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    benchmark::Initialize(&argc, argv);
+
+    fs::path corpusDir;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--corpus" && i + 1 < argc) {
+            corpusDir = argv[++i];
+        } else if (arg == "--max-length" && i + 1 < argc) {
+            maxImageLength = std::stoi(argv[++i]);
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (corpusDir.empty() || !fs::is_directory(corpusDir)) {
+        std::cerr << "Usage: bench --corpus <directory> [--max-length N] [benchmark flags]" << std::endl;
+        std::cerr << "Generate a corpus with: bench-corpus <directory>" << std::endl;
+        return 1;
+    }
+
+    vector<string> imagePaths = findCorpusImages(corpusDir);
+    if (imagePaths.empty()) {
+        std::cerr << "No images found in " << corpusDir.string() << std::endl;
+        return 1;
+    }
+
+    quietOutput = true;
+    // Same buffer reuse as the program (its default --pool-mb)
+    installMatPool((size_t) 256 * 1024 * 1024);
+    benchTempDir = fs::temp_directory_path() / "image-downscaler-bench";
+    fs::create_directories(benchTempDir);
+
+    registerBenchmarks(imagePaths);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    fs::remove_all(benchTempDir);
+    return 0;
+}
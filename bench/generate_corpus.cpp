@@ -0,0 +1,106 @@
+// Generates the synthetic benchmark corpus: the same kinds of images at several resolutions, formats and compression
+// levels. The content is deterministic, so corpora generated on different machines are identical.
+//
+// Usage: bench-corpus <output directory>
+
+#include <iostream>
+#include <filesystem>
+#include <format>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using cv::Mat;
+
+
+struct CorpusFormat {
+    string extension;
+    string label;
+    vector<int> params;
+};
+
+
+// Smooth gradients and blurred noise with some sharp shapes and a bit of sensor-like noise on top, compresses roughly
+// like a camera photo.
+Mat generatePhoto(int width, int height, cv::RNG& rng) {
+    Mat lowFrequency(height / 16 + 1, width / 16 + 1, CV_8UC3);
+    rng.fill(lowFrequency, cv::RNG::UNIFORM, 0, 256);
+    Mat image;
+    cv::resize(lowFrequency, image, cv::Size(width, height), 0, 0, cv::INTER_CUBIC);
+    cv::GaussianBlur(image, image, cv::Size(0, 0), std::max(width, height) / 200.0 + 1);
+
+    for (int i = 0; i < 40; ++i) {
+        cv::Point center(rng.uniform(0, width), rng.uniform(0, height));
+        int radius = rng.uniform(width / 100 + 1, width / 8 + 2);
+        cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        cv::circle(image, center, radius, color, rng.uniform(1, 6), cv::LINE_AA);
+    }
+
+    Mat noise(height, width, CV_8UC3);
+    rng.fill(noise, cv::RNG::NORMAL, 0, 6);
+    cv::add(image, noise, image);
+    return image;
+}
+
+
+// Flat colors, lines and text, like a screenshot or a diagram.
+Mat generateGraphic(int width, int height, cv::RNG& rng) {
+    Mat image(height, width, CV_8UC3, cv::Scalar(245, 245, 245));
+    for (int i = 0; i < 30; ++i) {
+        cv::Point topLeft(rng.uniform(0, width), rng.uniform(0, height));
+        cv::Point bottomRight(rng.uniform(0, width), rng.uniform(0, height));
+        cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        cv::rectangle(image, topLeft, bottomRight, color, cv::FILLED);
+    }
+    for (int y = 40; y < height; y += 40) {
+        cv::putText(image, "image-downscaler benchmark corpus", cv::Point(20, y), cv::FONT_HERSHEY_SIMPLEX, 0.8, cv::Scalar(30, 30, 30), 2);
+    }
+    return image;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: bench-corpus <output directory>" << std::endl;
+        return 1;
+    }
+    fs::path outputDir = argv[1];
+    fs::create_directories(outputDir);
+
+    const vector<cv::Size> photoSizes = {{640, 480}, {1920, 1080}, {4032, 3024}, {6000, 4000}};
+    const vector<cv::Size> graphicSizes = {{1280, 720}, {2560, 1440}};
+    const vector<CorpusFormat> formats = {
+            {".jpg", "q50", {cv::IMWRITE_JPEG_QUALITY, 50}},
+            {".jpg", "q85", {cv::IMWRITE_JPEG_QUALITY, 85}},
+            {".jpg", "q95", {cv::IMWRITE_JPEG_QUALITY, 95}},
+            {".png", "l1", {cv::IMWRITE_PNG_COMPRESSION, 1}},
+            {".png", "l9", {cv::IMWRITE_PNG_COMPRESSION, 9}},
+            {".webp", "q75", {cv::IMWRITE_WEBP_QUALITY, 75}},
+            {".webp", "q95", {cv::IMWRITE_WEBP_QUALITY, 95}}
+    };
+
+    cv::RNG rng(0x5eed);
+    auto writeImages = [&](const string& content, const Mat& image) {
+        for (const CorpusFormat& format : formats) {
+            string fileName = std::format("{}_{}x{}_{}{}", content, image.cols, image.rows, format.label, format.extension);
+            fs::path filePath = outputDir / fileName;
+            if (!cv::imwrite(filePath.string(), image, format.params)) {
+                std::cerr << "Failed to write " << filePath.string() << std::endl;
+                continue;
+            }
+            std::cout << filePath.string() << " (" << fs::file_size(filePath) / 1024 << " kB)" << std::endl;
+        }
+    };
+
+    for (const cv::Size& size : photoSizes) {
+        writeImages("photo", generatePhoto(size.width, size.height, rng));
+    }
+    for (const cv::Size& size : graphicSizes) {
+        writeImages("graphic", generateGraphic(size.width, size.height, rng));
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef IMAGE_DOWNSCALER_BOUNDED_QUEUE_H
+#define IMAGE_DOWNSCALER_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+
+// Multi-producer/multi-consumer FIFO whose capacity is a total weight (e.g. bytes of decoded pixels) instead of an
+// item count. push() blocks while the queue is full, pop() blocks while it's empty. A single item heavier than the
+// whole capacity is still let through once the queue is empty, otherwise it would block forever.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // Returns false if the queue was closed and the item was dropped.
+    bool push(T item, size_t weight) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotFull.wait(lock, [&] { return closed || usedWeight == 0 || usedWeight + weight <= capacity; });
+        if (closed) {
+            return false;
+        }
+        items.emplace_back(std::move(item), weight);
+        usedWeight += weight;
+        lock.unlock();
+        cvNotEmpty.notify_one();
+        return true;
+    }
+
+    // Returns std::nullopt once the queue is closed and drained.
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvNotEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        auto [item, weight] = std::move(items.front());
+        items.pop_front();
+        usedWeight -= weight;
+        lock.unlock();
+        cvNotFull.notify_all();
+        return std::move(item);
+    }
+
+    // No more items will be pushed; consumers drain what's left and then get std::nullopt.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        cvNotEmpty.notify_all();
+        cvNotFull.notify_all();
+    }
+
+    size_t weight() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return usedWeight;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return items.size();
+    }
+
+private:
+    std::deque<std::pair<T, size_t>> items;
+    size_t capacity;
+    size_t usedWeight = 0;
+    bool closed = false;
+    std::mutex mtx;
+    std::condition_variable cvNotEmpty;
+    std::condition_variable cvNotFull;
+};
+
+
+#endif //IMAGE_DOWNSCALER_BOUNDED_QUEUE_H
@@ -0,0 +1,103 @@
+// Row by row JPEG decoder on libjpeg's scanline API, built with IMAGE_DOWNSCALER_WITH_LIBJPEG.
+#include <csetjmp>
+#include <cstdio>
+#include <utility>
+#include <jpeglib.h>
+#include "image_codec.h"
+
+
+namespace {
+    struct ErrorManager {
+        jpeg_error_mgr manager;  // has to come first, libjpeg only knows about this part
+        std::jmp_buf jumpBuffer;
+    };
+
+
+    void jumpOnError(j_common_ptr info) {
+        std::longjmp(reinterpret_cast<ErrorManager*>(info->err)->jumpBuffer, 1);
+    }
+
+
+    void ignoreMessage(j_common_ptr) {}
+
+
+    class JpegRowDecoder : public RowDecoder {
+    public:
+        ~JpegRowDecoder() override {
+            if (isCreated) {
+                jpeg_destroy_decompress(&info);
+            }
+        }
+
+        bool open(const unsigned char* data, size_t size, int reduction) {
+            info.err = jpeg_std_error(&errorManager.manager);
+            errorManager.manager.error_exit = jumpOnError;
+            // Warnings about recoverable corruption, OpenCV doesn't print them either
+            errorManager.manager.output_message = ignoreMessage;
+            // libjpeg reports errors by jumping back here, nothing below may need a destructor
+            if (setjmp(errorManager.jumpBuffer)) {
+                return false;
+            }
+            jpeg_create_decompress(&info);
+            isCreated = true;
+            jpeg_mem_src(&info, const_cast<unsigned char*>(data), (unsigned long) size);
+            if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK) {
+                return false;
+            }
+            // A progressive JPEG keeps the coefficients of the whole image until the last scan, so streaming it
+            // wouldn't save anything, and libjpeg can't convert CMYK to BGR
+            if (jpeg_has_multiple_scans(&info) || info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK) {
+                return false;
+            }
+
+            info.scale_num = 1;
+            info.scale_denom = reduction;
+#ifdef JCS_EXTENSIONS
+            info.out_color_space = JCS_EXT_BGR;
+#else
+            info.out_color_space = JCS_RGB;
+#endif
+            jpeg_start_decompress(&info);
+            return info.output_components == 3;
+        }
+
+        int getWidth() const override {
+            return (int) info.output_width;
+        }
+
+        int getHeight() const override {
+            return (int) info.output_height;
+        }
+
+        bool readRow(uchar* row) override {
+            if (setjmp(errorManager.jumpBuffer)) {
+                return false;
+            }
+            JSAMPROW rowPointer = row;
+            if (jpeg_read_scanlines(&info, &rowPointer, 1) != 1) {
+                return false;
+            }
+#ifndef JCS_EXTENSIONS
+            // Plain libjpeg only decodes to RGB
+            for (JDIMENSION x = 0; x < info.output_width; ++x) {
+                std::swap(row[x * 3], row[x * 3 + 2]);
+            }
+#endif
+            return true;
+        }
+
+    private:
+        ErrorManager errorManager{};
+        jpeg_decompress_struct info{};
+        bool isCreated = false;
+    };
+}
+
+
+std::unique_ptr<RowDecoder> openJpegRowDecoder(const unsigned char* data, size_t size, int reduction) {
+    auto decoder = std::make_unique<JpegRowDecoder>();
+    if (!decoder->open(data, size, reduction)) {
+        return nullptr;
+    }
+    return decoder;
+}
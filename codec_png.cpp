@@ -0,0 +1,269 @@
+// PNG encoder and row by row PNG decoder on libpng, built with IMAGE_DOWNSCALER_WITH_LIBPNG.
+#include <algorithm>
+#include <cstring>
+#include <png.h>
+#include "image_analysis.h"
+#include "image_codec.h"
+
+
+using std::string;
+using std::vector;
+
+
+namespace {
+    void appendToBuffer(png_structp png, png_bytep data, png_size_t size) {
+        auto* encodedImage = static_cast<vector<uchar>*>(png_get_io_ptr(png));
+        encodedImage->insert(encodedImage->end(), data, data + size);
+    }
+
+
+    struct MemoryReader {
+        const unsigned char* data;
+        size_t size;
+        size_t offset;
+    };
+
+
+    void readFromMemory(png_structp png, png_bytep data, png_size_t size) {
+        auto* reader = static_cast<MemoryReader*>(png_get_io_ptr(png));
+        if (size > reader->size - reader->offset) {
+            png_error(png, "Truncated PNG");
+        }
+        std::memcpy(data, reader->data + reader->offset, size);
+        reader->offset += size;
+    }
+
+
+    // decodeImage reports the failure with the file name, libpng's own message isn't needed
+    void jumpOnError(png_structp png, png_const_charp) {
+        png_longjmp(png, 1);
+    }
+
+
+    void ignoreWarning(png_structp, png_const_charp) {}
+
+
+    bool isLittleEndian() {
+        const uint16_t value = 1;
+        return *reinterpret_cast<const uint8_t*>(&value) == 1;
+    }
+
+
+    // Fewest bits per pixel that can index every colour, libpng packs the one byte per pixel indices to that
+    int getPaletteBitDepth(size_t numColors) {
+        if (numColors <= 2) {
+            return 1;
+        }
+        if (numColors <= 4) {
+            return 2;
+        }
+        return numColors <= 16 ? 4 : 8;
+    }
+
+
+    class PngEncoder : public ImageEncoder {
+    public:
+        string getName() const override {
+            return "libpng";
+        }
+
+        bool canEncode(const string& fileExtension, const cv::Mat& image) const override {
+            return fileExtension == ".png" && (image.depth() == CV_8U || image.depth() == CV_16U) &&
+                   (image.channels() == 1 || image.channels() == 3 || image.channels() == 4);
+        }
+
+        bool encode(const string&, const cv::Mat& image, const vector<int>& compressionParams,
+                    vector<uchar>& encodedImage) const override {
+            int channels = image.channels();
+            // Colour images with few colours are written with a palette, one byte or less per pixel instead of 3 or 4.
+            // Transparent entries go first, the tRNS chunk only has to list the alpha of those; newIndices maps the
+            // order findPalette found the colours in to that one.
+            std::optional<vector<uint32_t>> palette;
+            cv::Mat paletteIndices;
+            vector<uchar> indexRow;
+            if (image.depth() == CV_8U && channels >= 3) {
+                palette = findPalette(image, maxPaletteColors, &paletteIndices);
+            }
+            int numTransparent = 0;
+            uchar newIndices[maxPaletteColors];
+            if (palette.has_value()) {
+                vector<uint32_t> sortedPalette;
+                sortedPalette.reserve(palette->size());
+                for (bool isTransparentPass : {true, false}) {
+                    for (size_t i = 0; i < palette->size(); ++i) {
+                        if (((*palette)[i] >> 24 != 255) == isTransparentPass) {
+                            newIndices[i] = (uchar) sortedPalette.size();
+                            sortedPalette.push_back((*palette)[i]);
+                        }
+                    }
+                    if (isTransparentPass) {
+                        numTransparent = (int) sortedPalette.size();
+                    }
+                }
+                palette = std::move(sortedPalette);
+                indexRow.resize(image.cols);
+            }
+
+            png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+            if (png == nullptr) {
+                return false;
+            }
+            png_infop info = png_create_info_struct(png);
+            if (info == nullptr) {
+                png_destroy_write_struct(&png, nullptr);
+                return false;
+            }
+            // libpng reports errors by jumping back here, nothing below may need a destructor
+            if (setjmp(png_jmpbuf(png))) {
+                png_destroy_write_struct(&png, &info);
+                return false;
+            }
+
+            encodedImage.clear();
+            png_set_write_fn(png, &encodedImage, appendToBuffer, nullptr);
+            // Same defaults as OpenCV's encoder: the fastest level with RLE unless a level is given, which switches
+            // to the default strategy. OpenCV's strategy values are zlib's.
+            int compressionLevel = getCompressionParam(compressionParams, cv::IMWRITE_PNG_COMPRESSION, -1);
+            int defaultStrategy = compressionLevel >= 0 ? cv::IMWRITE_PNG_STRATEGY_DEFAULT : cv::IMWRITE_PNG_STRATEGY_RLE;
+            png_set_compression_level(png, compressionLevel >= 0 ? std::min(compressionLevel, 9) : 1);
+            png_set_compression_strategy(png, getCompressionParam(compressionParams, cv::IMWRITE_PNG_STRATEGY, defaultStrategy));
+            if (compressionLevel < 0 && !palette.has_value()) {
+                png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+            }
+
+            int bitDepth = image.depth() == CV_16U ? 16 : 8;
+            if (palette.has_value()) {
+                png_set_IHDR(png, info, image.cols, image.rows, getPaletteBitDepth(palette->size()), PNG_COLOR_TYPE_PALETTE,
+                             PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+                png_color colors[maxPaletteColors];
+                png_byte alphas[maxPaletteColors];
+                for (size_t i = 0; i < palette->size(); ++i) {
+                    uint32_t color = (*palette)[i];
+                    colors[i] = {(png_byte) (color >> 16), (png_byte) (color >> 8), (png_byte) color};
+                    alphas[i] = (png_byte) (color >> 24);
+                }
+                png_set_PLTE(png, info, colors, (int) palette->size());
+                if (numTransparent > 0) {
+                    png_set_tRNS(png, info, alphas, numTransparent, nullptr);
+                }
+                png_write_info(png, info);
+                png_set_packing(png);
+            } else {
+                int colorType = channels == 1 ? PNG_COLOR_TYPE_GRAY : (channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA);
+                png_set_IHDR(png, info, image.cols, image.rows, bitDepth, colorType, PNG_INTERLACE_NONE,
+                             PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+                png_write_info(png, info);
+                if (channels > 1) {
+                    png_set_bgr(png);
+                }
+                if (bitDepth == 16 && isLittleEndian()) {
+                    png_set_swap(png);
+                }
+            }
+
+            for (int y = 0; y < image.rows; ++y) {
+                if (palette.has_value()) {
+                    const uchar* indices = paletteIndices.ptr<uchar>(y);
+                    for (int x = 0; x < image.cols; ++x) {
+                        indexRow[x] = newIndices[indices[x]];
+                    }
+                    png_write_row(png, indexRow.data());
+                } else {
+                    png_write_row(png, image.ptr(y));
+                }
+            }
+            png_write_end(png, nullptr);
+            png_destroy_write_struct(&png, &info);
+            return true;
+        }
+    };
+
+
+    class PngRowDecoder : public RowDecoder {
+    public:
+        ~PngRowDecoder() override {
+            if (png != nullptr) {
+                png_destroy_read_struct(&png, info != nullptr ? &info : nullptr, nullptr);
+            }
+        }
+
+        bool open(const unsigned char* data, size_t size) {
+            // Warnings are about ancillary chunks (mostly sRGB profiles libpng knows to be wrong), OpenCV ignores them too
+            png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, jumpOnError, ignoreWarning);
+            if (png == nullptr) {
+                return false;
+            }
+            info = png_create_info_struct(png);
+            if (info == nullptr) {
+                return false;
+            }
+            // libpng reports errors by jumping back here, nothing below may need a destructor
+            if (setjmp(png_jmpbuf(png))) {
+                return false;
+            }
+
+            reader = {data, size, 0};
+            png_set_read_fn(png, &reader, readFromMemory);
+            png_read_info(png, info);
+            // Every Adam7 pass covers the whole image, no row is complete before the last one
+            if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+                return false;
+            }
+
+            // The same pixels cv::imdecode gives with IMREAD_UNCHANGED plus the conversion to 8 bits in decodeImage:
+            // gray stays gray (without its tRNS), everything else becomes BGR, with the alpha channel (or the tRNS
+            // chunk expanded to one) if the image has it, and 16 bits are rounded, not cut off
+            if (png_get_color_type(png, info) == PNG_COLOR_TYPE_GRAY) {
+                png_set_expand_gray_1_2_4_to_8(png);
+            } else {
+                png_set_expand(png);
+                png_set_gray_to_rgb(png);
+                png_set_bgr(png);
+            }
+            png_set_scale_16(png);
+            png_read_update_info(png, info);
+            int channels = png_get_channels(png, info);
+            return (channels == 1 || channels == 3 || channels == 4) && png_get_bit_depth(png, info) == 8;
+        }
+
+        int getWidth() const override {
+            return (int) png_get_image_width(png, info);
+        }
+
+        int getHeight() const override {
+            return (int) png_get_image_height(png, info);
+        }
+
+        int getChannels() const override {
+            return png_get_channels(png, info);
+        }
+
+        bool readRow(uchar* row) override {
+            if (setjmp(png_jmpbuf(png))) {
+                return false;
+            }
+            png_read_row(png, row, nullptr);
+            return true;
+        }
+
+    private:
+        png_structp png = nullptr;
+        png_infop info = nullptr;
+        MemoryReader reader{};
+    };
+}
+
+
+const ImageEncoder* getPngEncoder() {
+    static const PngEncoder encoder;
+    return &encoder;
+}
+
+
+std::unique_ptr<RowDecoder> openPngRowDecoder(const unsigned char* data, size_t size) {
+    auto decoder = std::make_unique<PngRowDecoder>();
+    if (!decoder->open(data, size)) {
+        return nullptr;
+    }
+    return decoder;
+}
@@ -0,0 +1,95 @@
+// JPEG encoder on libjpeg-turbo's TurboJPEG 3 API, built with IMAGE_DOWNSCALER_WITH_TURBOJPEG.
+#include <algorithm>
+#include <turbojpeg.h>
+#include "image_codec.h"
+
+
+using std::string;
+using std::vector;
+
+
+namespace {
+    // A compressor keeps its buffers between images, one per thread since a handle can't be shared
+    struct TurboJpegCompressor {
+        tjhandle handle = tj3Init(TJINIT_COMPRESS);
+        unsigned char* buffer = nullptr;  // allocated and grown by TurboJPEG
+        size_t bufferSize = 0;
+
+        ~TurboJpegCompressor() {
+            tj3Free(buffer);
+            if (handle != nullptr) {
+                tj3Destroy(handle);
+            }
+        }
+    };
+
+
+    int getSubsampling(int samplingFactor) {
+        switch (samplingFactor) {
+            case cv::IMWRITE_JPEG_SAMPLING_FACTOR_444:
+                return TJSAMP_444;
+            case cv::IMWRITE_JPEG_SAMPLING_FACTOR_422:
+                return TJSAMP_422;
+            case cv::IMWRITE_JPEG_SAMPLING_FACTOR_440:
+                return TJSAMP_440;
+            case cv::IMWRITE_JPEG_SAMPLING_FACTOR_411:
+                return TJSAMP_411;
+            default:
+                return TJSAMP_420;
+        }
+    }
+
+
+    class TurboJpegEncoder : public ImageEncoder {
+    public:
+        string getName() const override {
+            return "turbojpeg";
+        }
+
+        bool canEncode(const string& fileExtension, const cv::Mat& image) const override {
+            return (fileExtension == ".jpg" || fileExtension == ".jpeg") && image.depth() == CV_8U &&
+                   (image.channels() == 1 || image.channels() == 3 || image.channels() == 4);
+        }
+
+        bool encode(const string&, const cv::Mat& image, const vector<int>& compressionParams,
+                    vector<uchar>& encodedImage) const override {
+            thread_local TurboJpegCompressor compressor;
+            tjhandle handle = compressor.handle;
+            if (handle == nullptr) {
+                return false;
+            }
+
+            int channels = image.channels();
+            int subsampling = channels == 1 ? TJSAMP_GRAY : getSubsampling(getCompressionParam(compressionParams, cv::IMWRITE_JPEG_SAMPLING_FACTOR, cv::IMWRITE_JPEG_SAMPLING_FACTOR_420));
+            int quality = std::clamp(getCompressionParam(compressionParams, cv::IMWRITE_JPEG_QUALITY, 95), 1, 100);
+            tj3Set(handle, TJPARAM_QUALITY, quality);
+            tj3Set(handle, TJPARAM_SUBSAMP, subsampling);
+            tj3Set(handle, TJPARAM_OPTIMIZE, getCompressionParam(compressionParams, cv::IMWRITE_JPEG_OPTIMIZE, 0) != 0);
+            tj3Set(handle, TJPARAM_PROGRESSIVE, getCompressionParam(compressionParams, cv::IMWRITE_JPEG_PROGRESSIVE, 0) != 0);
+            // TurboJPEG grows its own buffer as needed and it's kept for the next image, so only the actual JPEG is
+            // copied out. Compressing straight into encodedImage would mean resizing it to the worst case first,
+            // and the vector zero-fills all of that on every image.
+            tj3Set(handle, TJPARAM_NOREALLOC, 0);
+            size_t jpegSize = compressor.bufferSize;
+
+            // The alpha channel is dropped, JPEG has none
+            int pixelFormat = channels == 1 ? TJPF_GRAY : (channels == 3 ? TJPF_BGR : TJPF_BGRX);
+            int result = tj3Compress8(handle, image.ptr(), image.cols, (int) image.step, image.rows, pixelFormat,
+                                      &compressor.buffer, &jpegSize);
+            if (compressor.buffer != nullptr) {
+                compressor.bufferSize = std::max(compressor.bufferSize, jpegSize);
+            }
+            if (result != 0) {
+                return false;
+            }
+            encodedImage.assign(compressor.buffer, compressor.buffer + jpegSize);
+            return true;
+        }
+    };
+}
+
+
+const ImageEncoder* getTurboJpegEncoder() {
+    static const TurboJpegEncoder encoder;
+    return &encoder;
+}
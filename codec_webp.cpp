@@ -0,0 +1,79 @@
+// WebP encoder on libwebp's advanced API, built with IMAGE_DOWNSCALER_WITH_LIBWEBP.
+#include <algorithm>
+#include <webp/encode.h>
+#include "image_codec.h"
+
+
+using std::string;
+using std::vector;
+
+
+namespace {
+    int appendToBuffer(const uint8_t* data, size_t size, const WebPPicture* picture) {
+        auto* encodedImage = static_cast<vector<uchar>*>(picture->custom_ptr);
+        encodedImage->insert(encodedImage->end(), data, data + size);
+        return 1;
+    }
+
+
+    class WebpEncoder : public ImageEncoder {
+    public:
+        string getName() const override {
+            return "libwebp";
+        }
+
+        bool canEncode(const string& fileExtension, const cv::Mat& image) const override {
+            return fileExtension == ".webp" && image.depth() == CV_8U &&
+                   (image.channels() == 1 || image.channels() == 3 || image.channels() == 4);
+        }
+
+        bool encode(const string&, const cv::Mat& image, const vector<int>& compressionParams,
+                    vector<uchar>& encodedImage) const override {
+            WebPConfig config;
+            if (!WebPConfigInit(&config)) {
+                return false;
+            }
+            // Same meaning as in OpenCV: above 100 is lossless
+            int quality = getCompressionParam(compressionParams, cv::IMWRITE_WEBP_QUALITY, 100);
+            if (quality > 100) {
+                config.lossless = 1;
+            } else {
+                config.quality = (float) std::max(quality, 1);
+            }
+
+            cv::Mat bgrImage = image;
+            if (image.channels() == 1) {
+                cv::cvtColor(image, bgrImage, cv::COLOR_GRAY2BGR);
+            }
+
+            WebPPicture picture;
+            if (!WebPPictureInit(&picture)) {
+                return false;
+            }
+            picture.width = bgrImage.cols;
+            picture.height = bgrImage.rows;
+            picture.use_argb = config.lossless;
+            bool imported = bgrImage.channels() == 4
+                    ? WebPPictureImportBGRA(&picture, bgrImage.ptr(), (int) bgrImage.step)
+                    : WebPPictureImportBGR(&picture, bgrImage.ptr(), (int) bgrImage.step);
+            if (!imported) {
+                WebPPictureFree(&picture);
+                return false;
+            }
+
+            // The writer appends to the caller's buffer, libwebp's memory writer would need a copy afterwards
+            encodedImage.clear();
+            picture.writer = appendToBuffer;
+            picture.custom_ptr = &encodedImage;
+            bool success = WebPEncode(&config, &picture);
+            WebPPictureFree(&picture);
+            return success;
+        }
+    };
+}
+
+
+const ImageEncoder* getWebpEncoder() {
+    static const WebpEncoder encoder;
+    return &encoder;
+}
@@ -0,0 +1,64 @@
+#include "cpu_features.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+
+namespace {
+    SimdLevel detectSimdLevelUncached() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return SimdLevel::Avx2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return SimdLevel::Sse41;
+        }
+        return SimdLevel::Scalar;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int info[4];
+        __cpuid(info, 1);
+        bool hasSse41 = (info[2] & (1 << 19)) != 0;
+        bool hasFma = (info[2] & (1 << 12)) != 0;
+        bool osSavesAvxState = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+
+        __cpuidex(info, 7, 0);
+        bool hasAvx2 = (info[1] & (1 << 5)) != 0;
+
+        if (hasAvx2 && hasFma && osSavesAvxState) {
+            return SimdLevel::Avx2;
+        }
+        if (hasSse41) {
+            return SimdLevel::Sse41;
+        }
+        return SimdLevel::Scalar;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+        // NEON is mandatory on AArch64
+        return SimdLevel::Neon;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }
+}
+
+
+SimdLevel detectSimdLevel() {
+    static const SimdLevel simdLevel = detectSimdLevelUncached();
+    return simdLevel;
+}
+
+
+std::string getSimdLevelName(SimdLevel simdLevel) {
+    switch (simdLevel) {
+        case SimdLevel::Sse41:
+            return "SSE4.1";
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Neon:
+            return "NEON";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef IMAGE_DOWNSCALER_CPU_FEATURES_H
+#define IMAGE_DOWNSCALER_CPU_FEATURES_H
+
+#include <string>
+
+
+enum class SimdLevel {
+    Scalar,
+    Sse41,
+    Avx2,  // AVX2 + FMA
+    Neon
+};
+
+
+// Best instruction set supported by both the CPU and the OS, detected once on first use.
+SimdLevel detectSimdLevel();
+std::string getSimdLevelName(SimdLevel simdLevel);
+
+
+#endif //IMAGE_DOWNSCALER_CPU_FEATURES_H
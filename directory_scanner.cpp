@@ -0,0 +1,162 @@
+#include "directory_scanner.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "downscaler.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    const vector<string> supportedExtensions = {".jpg", ".jpeg", ".png", ".webp"};
+
+
+    class DirectoryScanner {
+    public:
+        explicit DirectoryScanner(const std::function<void(const string&)>& onImageFound) : onImageFound(onImageFound) {}
+
+        size_t run(const string& rootPath, unsigned int numThreads) {
+            pendingDirectories.push_back(rootPath);
+            vector<std::thread> threads;
+            for (unsigned int i = 0; i < numThreads; ++i) {
+                threads.emplace_back(&DirectoryScanner::scanLoop, this);
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+            return imagesFound;
+        }
+
+    private:
+        void scanLoop() {
+            while (true) {
+                string directoryPath;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    // Done once nothing is queued and nobody is listing a directory that could queue more
+                    cv.wait(lock, [this] { return !pendingDirectories.empty() || busyThreads == 0; });
+                    if (pendingDirectories.empty()) {
+                        return;
+                    }
+                    // Newest first, stays close to a depth-first walk and keeps the queue short
+                    directoryPath = std::move(pendingDirectories.back());
+                    pendingDirectories.pop_back();
+                    ++busyThreads;
+                }
+
+                vector<string> subdirectories;
+                listDirectory(directoryPath, subdirectories);
+
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    for (string& subdirectory : subdirectories) {
+                        pendingDirectories.push_back(std::move(subdirectory));
+                    }
+                    --busyThreads;
+                }
+                cv.notify_all();
+            }
+        }
+
+        void addFile(const string& filePath, const string& fileName) {
+            if (isSupportedImageFile(fileName)) {
+                ++imagesFound;
+                // Hand the image over right away, workers don't wait for the rest of the tree
+                onImageFound(filePath);
+            }
+        }
+
+#ifdef _WIN32
+        void listDirectory(const string& directoryPath, vector<string>& subdirectories) {
+            // FindNextFile already returns the attributes, directory_entry caches them, so this needs no extra stats
+            std::error_code error;
+            fs::directory_iterator iterator(directoryPath, error);
+            if (error) {
+                cerrPlus("Failed to open the directory: " + directoryPath + " (" + error.message() + ")");
+                return;
+            }
+            for (const fs::directory_entry& entry : iterator) {
+                if (entry.is_directory(error) && !entry.is_symlink(error)) {
+                    subdirectories.push_back(entry.path().string());
+                } else if (entry.is_regular_file(error)) {
+                    addFile(entry.path().string(), entry.path().filename().string());
+                }
+            }
+        }
+#else
+        void listDirectory(const string& directoryPath, vector<string>& subdirectories) {
+            DIR* directory = opendir(directoryPath.c_str());
+            if (directory == nullptr) {
+                cerrPlus("Failed to open the directory: " + directoryPath);
+                return;
+            }
+
+            string prefix = directoryPath;
+            if (prefix.empty() || prefix.back() != '/') {
+                prefix += '/';
+            }
+            while (dirent* entry = readdir(directory)) {
+                const char* name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                    continue;
+                }
+                string path = prefix + name;
+
+                // d_type comes with the listing, only file systems that don't fill it in (and symlinks) need a stat
+                unsigned char type = entry->d_type;
+                if (type == DT_UNKNOWN || type == DT_LNK) {
+                    struct stat info;
+                    if (stat(path.c_str(), &info) != 0) {
+                        continue;
+                    }
+                    if (S_ISREG(info.st_mode)) {
+                        type = DT_REG;
+                    } else if (S_ISDIR(info.st_mode) && entry->d_type == DT_UNKNOWN) {
+                        // Symlinked directories aren't followed, they could form a cycle
+                        type = DT_DIR;
+                    }
+                }
+
+                if (type == DT_DIR) {
+                    subdirectories.push_back(std::move(path));
+                } else if (type == DT_REG) {
+                    addFile(path, name);
+                }
+            }
+            closedir(directory);
+        }
+#endif
+
+        const std::function<void(const string&)>& onImageFound;
+        std::mutex mtx;
+        std::condition_variable cv;
+        vector<string> pendingDirectories;
+        unsigned int busyThreads = 0;
+        std::atomic<size_t> imagesFound = 0;
+    };
+}
+
+
+size_t scanDirectory(const string& rootPath, unsigned int numThreads, const std::function<void(const string&)>& onImageFound) {
+    DirectoryScanner scanner(onImageFound);
+    return scanner.run(rootPath, std::max(1u, numThreads));
+}
+
+
+bool isSupportedImageFile(const string& fileName) {
+    size_t dot = fileName.rfind('.');
+    if (dot == string::npos) {
+        return false;
+    }
+    return isStringInList(toLowerCase(fileName.substr(dot)), supportedExtensions);
+}
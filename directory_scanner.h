@@ -0,0 +1,16 @@
+#ifndef IMAGE_DOWNSCALER_DIRECTORY_SCANNER_H
+#define IMAGE_DOWNSCALER_DIRECTORY_SCANNER_H
+
+#include <functional>
+#include <string>
+
+
+// Walks the directory tree under rootPath with numThreads threads, every thread lists one directory at a time and
+// queues its subdirectories for the others. Every supported image is passed to onImageFound as soon as it's listed,
+// so processing overlaps with the rest of the scan. onImageFound is called from several threads at once.
+// Returns the number of images found.
+size_t scanDirectory(const std::string& rootPath, unsigned int numThreads, const std::function<void(const std::string&)>& onImageFound);
+bool isSupportedImageFile(const std::string& fileName);
+
+
+#endif //IMAGE_DOWNSCALER_DIRECTORY_SCANNER_H
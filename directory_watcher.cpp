@@ -0,0 +1,242 @@
+#include "directory_watcher.h"
+#include <filesystem>
+#include "directory_scanner.h"
+#include "downscaler.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+namespace fs = std::filesystem;
+
+
+#ifdef __linux__
+namespace {
+    // IN_CREATE and IN_MOVED_FROM are only used for directories, a new file is reported once it's closed.
+    // IN_EXCL_UNLINK: no more events for files that were already deleted but are still open.
+    const uint32_t watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_ONLYDIR | IN_EXCL_UNLINK;
+    // Room for a few hundred events per read
+    const size_t eventBufferSize = 64 * 1024;
+
+
+    string removeTrailingSlashes(string path) {
+        while (path.size() > 1 && path.back() == '/') {
+            path.pop_back();
+        }
+        return path;
+    }
+}
+
+
+DirectoryWatcher::DirectoryWatcher() : eventBuffer(eventBufferSize) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        cerrPlus(string("Failed to create an inotify instance (") + std::strerror(errno) + ")");
+        return;
+    }
+    if (pipe2(stopPipe, O_NONBLOCK | O_CLOEXEC) != 0 || pipe2(wakePipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+}
+
+
+DirectoryWatcher::~DirectoryWatcher() {
+    for (int fd : {inotifyFd, stopPipe[0], stopPipe[1], wakePipe[0], wakePipe[1]}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+
+bool DirectoryWatcher::isOpen() const {
+    return inotifyFd >= 0;
+}
+
+
+bool DirectoryWatcher::addTree(const string& rootPath) {
+    return watchTree(rootPath, nullptr);
+}
+
+
+WatchEvents DirectoryWatcher::wait(int timeoutMs) {
+    WatchEvents events;
+    pollfd fds[3] = {{inotifyFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+    // Interrupted by a signal counts as a timeout, its handler has called requestStop() if it should stop
+    if (poll(fds, 3, timeoutMs) <= 0) {
+        return events;
+    }
+    events.stopped = (fds[1].revents & POLLIN) != 0;
+    if (fds[2].revents & POLLIN) {
+        // Unlike the stop byte these are read, so one wake() only ends one wait()
+        char bytes[64];
+        while (read(wakePipe[0], bytes, sizeof(bytes)) > 0) {
+        }
+        events.woken = true;
+    }
+    if (fds[0].revents & POLLIN) {
+        readEvents(events);
+    }
+    return events;
+}
+
+
+void DirectoryWatcher::requestStop() {
+    // The byte is never read, so every later wait() returns right away as well
+    char byte = 1;
+    [[maybe_unused]] ssize_t written = write(stopPipe[1], &byte, 1);
+}
+
+
+void DirectoryWatcher::wake() {
+    char byte = 1;
+    [[maybe_unused]] ssize_t written = write(wakePipe[1], &byte, 1);
+}
+
+
+bool DirectoryWatcher::addDirectory(const string& directoryPath) {
+    int watchDescriptor = inotify_add_watch(inotifyFd, directoryPath.c_str(), watchMask);
+    if (watchDescriptor < 0) {
+        if (errno == ENOSPC) {
+            cerrPlus("Too many directories to watch, raise fs.inotify.max_user_watches: " + directoryPath);
+        } else {
+            cerrPlus("Failed to watch the directory: " + directoryPath + " (" + std::strerror(errno) + ")");
+        }
+        return false;
+    }
+    directories[watchDescriptor] = directoryPath;
+    return true;
+}
+
+
+bool DirectoryWatcher::watchTree(const string& rootPath, vector<string>* images) {
+    string root = removeTrailingSlashes(rootPath);
+    if (!addDirectory(root)) {
+        return false;
+    }
+
+    // The watch on a directory is added before it's listed, so nothing created in it in the meantime is missed.
+    // Images that are listed and then reported by an event as well are only processed once, the cache sees to that.
+    std::error_code error;
+    fs::recursive_directory_iterator iterator(root, fs::directory_options::skip_permission_denied, error);
+    for (; !error && iterator != fs::recursive_directory_iterator(); iterator.increment(error)) {
+        const fs::directory_entry& entry = *iterator;
+        if (entry.is_symlink(error)) {
+            // Symlinked directories aren't followed, same as when scanning
+            continue;
+        }
+        if (entry.is_directory(error)) {
+            addDirectory(entry.path().string());
+        } else if (images != nullptr && entry.is_regular_file(error) && isSupportedImageFile(entry.path().filename().string())) {
+            images->push_back(entry.path().string());
+        }
+    }
+    return true;
+}
+
+
+void DirectoryWatcher::removeTree(const string& rootPath) {
+    string prefix = rootPath + "/";
+    for (auto it = directories.begin(); it != directories.end();) {
+        if (it->second == rootPath || it->second.starts_with(prefix)) {
+            inotify_rm_watch(inotifyFd, it->first);
+            it = directories.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+void DirectoryWatcher::readEvents(WatchEvents& events) {
+    while (true) {
+        ssize_t length = read(inotifyFd, eventBuffer.data(), eventBuffer.size());
+        if (length <= 0) {
+            // EAGAIN, everything is read
+            return;
+        }
+
+        for (ssize_t offset = 0; offset < length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(eventBuffer.data() + offset);
+            offset += (ssize_t) (sizeof(inotify_event) + event->len);
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                events.overflowed = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory was deleted or unmounted
+                directories.erase(event->wd);
+                continue;
+            }
+            auto directory = directories.find(event->wd);
+            if (directory == directories.end() || event->len == 0) {
+                continue;
+            }
+
+            string path = directory->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    watchTree(path, &events.images);
+                } else if (event->mask & IN_MOVED_FROM) {
+                    // Moved within the tree it comes back with IN_MOVED_TO, otherwise it's gone for good
+                    removeTree(path);
+                }
+            } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && isSupportedImageFile(event->name)) {
+                events.images.push_back(std::move(path));
+            }
+        }
+    }
+}
+#else
+DirectoryWatcher::DirectoryWatcher() {}
+
+
+DirectoryWatcher::~DirectoryWatcher() {}
+
+
+bool DirectoryWatcher::isOpen() const {
+    return false;
+}
+
+
+bool DirectoryWatcher::addTree(const string&) {
+    return false;
+}
+
+
+WatchEvents DirectoryWatcher::wait(int) {
+    WatchEvents events;
+    events.stopped = true;
+    return events;
+}
+
+
+void DirectoryWatcher::requestStop() {}
+
+
+void DirectoryWatcher::wake() {}
+
+
+bool DirectoryWatcher::addDirectory(const string&) {
+    return false;
+}
+
+
+bool DirectoryWatcher::watchTree(const string&, vector<string>*) {
+    return false;
+}
+
+
+void DirectoryWatcher::removeTree(const string&) {}
+
+
+void DirectoryWatcher::readEvents(WatchEvents&) {}
+#endif
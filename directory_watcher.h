@@ -0,0 +1,56 @@
+#ifndef IMAGE_DOWNSCALER_DIRECTORY_WATCHER_H
+#define IMAGE_DOWNSCALER_DIRECTORY_WATCHER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+struct WatchEvents {
+    std::vector<std::string> images;  // finished writing or moved in, may repeat and may already be gone again
+    bool overflowed = false;  // the kernel dropped events, the trees have to be scanned again to find everything
+    bool stopped = false;  // requestStop() was called
+    bool woken = false;  // wake() was called
+};
+
+
+// Reports the images that are written to, or moved into, the trees under the watched directories (inotify, so Linux
+// only). An image is reported once its writer closed it (IN_CLOSE_WRITE) or once it was renamed into place
+// (IN_MOVED_TO), never while it's half written. Directories created or moved in later are watched as they appear,
+// and the images that were already in them by then are reported as well. Not thread-safe, except for requestStop() and
+// wake().
+class DirectoryWatcher {
+public:
+    DirectoryWatcher();
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // False if watching isn't supported on this system or the inotify instance couldn't be created.
+    bool isOpen() const;
+    // Watches rootPath and every directory below it. False if rootPath itself can't be watched.
+    bool addTree(const std::string& rootPath);
+    // Blocks until something happens or timeoutMs passed (-1 = no timeout), without using any CPU while waiting.
+    WatchEvents wait(int timeoutMs);
+    // Makes the current or the next wait() return with stopped set. Async-signal-safe.
+    void requestStop();
+    // Makes the current or the next wait() return once with woken set, for work other threads hand to the waiting one.
+    void wake();
+
+private:
+    bool addDirectory(const std::string& directoryPath);
+    // Adds the images found on the way to images, unless that's null
+    bool watchTree(const std::string& rootPath, std::vector<std::string>* images);
+    void removeTree(const std::string& rootPath);
+    void readEvents(WatchEvents& events);
+
+    int inotifyFd = -1;
+    int stopPipe[2] = {-1, -1};
+    int wakePipe[2] = {-1, -1};
+    std::unordered_map<int, std::string> directories;  // watch descriptor -> directory path
+    std::vector<char> eventBuffer;
+};
+
+
+#endif //IMAGE_DOWNSCALER_DIRECTORY_WATCHER_H
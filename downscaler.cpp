@@ -0,0 +1,945 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <vector>
+#include <filesystem>
+#include <mutex>
+#include <format>
+#include <fstream>
+#include <cstdlib>
+#include <opencv2/opencv.hpp>
+#include "downscaler.h"
+#include "atomic_file.h"
+#include "image_analysis.h"
+#include "image_codec.h"
+#include "image_probe.h"
+#include "quality_search.h"
+#include "resampler.h"
+#include "result_cache.h"
+#include "stats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace fs = std::filesystem;
+
+
+string getColorEscapeSequence(const string& color);
+void setConsoleTextColor(const string& color);
+
+
+std::mutex consoleMtx;
+std::mutex writtenOutputsMtx;
+std::unordered_set<string> writtenOutputs;  // new files format conversions created in this run
+const size_t maxRetainedFileBufferBytes = 32 * 1024 * 1024;  // a file buffer larger than this is freed after use
+int maxImageLength = 1920;
+int imageCompression = 3;  // [0(no compression, highest image quality), 10(max compression, lowest image quality)]
+int imageQuality = -1;  // [1, 100] JPEG and WebP quality, -1 = derive it from imageCompression
+string outputFormat;  // ".jpg", ".png" or ".webp" to convert every image to that format, empty = keep the format
+bool autoOutputFormat = false;
+ProcessingPolicy processingPolicy = ProcessingPolicy::RecompressIfSmaller;
+ResampleFilter resampleFilter = ResampleFilter::Area;
+int streamAboveMegapixels = 50;
+QualitySearch qualitySearch;
+QualityGuard qualityGuard;
+vector<Rendition> renditions;
+string renditionNamePattern = "{name}-{size}{ext}";
+EncoderBackend encoderBackend = EncoderBackend::Native;
+bool progressiveJpeg = false;
+MetadataPolicy metadataPolicy = MetadataPolicy::Keep;
+size_t maxMetadataBytes = 0;
+int jpegSamplingFactor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_420;
+bool quietOutput = false;
+bool dryRun = false;
+bool colorOutput = true;
+FsyncPolicy fsyncPolicy = FsyncPolicy::File;
+bool preserveTimestamps = false;
+ResultCache* resultCache = nullptr;
+
+
+string toLowerCase(const string& str) {
+    string result = str;
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) {
+        return std::tolower(c);
+    });
+    return result;
+}
+
+
+bool isStringInList(const string& element, const vector<string>& list) {
+    return std::find(list.begin(), list.end(), element) != list.end();
+}
+
+
+void processTask(const string& imagePath, int taskId, bool isKnownOutdated) {
+    StatsClock::time_point startTime = StatsClock::now();
+    if (isImageUpToDate(imagePath, startTime, isKnownOutdated) || shouldSkipImage(imagePath)) {
+        return;
+    }
+    if (dryRun) {
+        previewImage(imagePath, startTime);
+        return;
+    }
+
+//    {
+//        std::unique_lock<std::mutex> lock(consoleMtx);
+//        std::cout << "Processing Task " << taskId << " on Thread " << std::this_thread::get_id() << std::endl;
+//    }
+
+    // The size comes from the read itself, the file isn't opened again just to look at it
+    vector<uchar>& fileBytes = getFileBuffer();
+    std::optional<LoadedImage> readResult;
+    if (readFileInto(imagePath, fileBytes)) {
+        readResult = decodeImage(fileBytes, imagePath);
+    }
+    int oldFileSize = (int) fileBytes.size();
+    trimFileBuffer(fileBytes);
+    if (!readResult.has_value()) {
+        recordImage(ImageOutcome::Failed, startTime);
+        return;
+    }
+    Mat img = readResult->image;
+
+    auto resizeResult = resizeImage(readResult.value());
+    if (get<0>(resizeResult).has_value()) {
+        img = get<0>(resizeResult).value();
+    }
+
+    bool wasResized = get<3>(resizeResult) != -1;
+    std::optional<WrittenImage> writtenImage = writeImage(imagePath, img, wasResized, readResult->metadata, oldFileSize);
+    bool written = writtenImage.has_value();
+    string outputPath = written ? writtenImage->path : imagePath;
+    int newFileSize = written ? writtenImage->fileSize : oldFileSize;
+    recordImage(getImageOutcome(wasResized, written), startTime, std::max(oldFileSize, 0), std::max(newFileSize, 0));
+    // A kept original is hashed from disk, a written one from the bytes that were encoded
+    markImageUpToDate(outputPath, written ? std::optional(writtenImage->hash) : std::nullopt);
+
+    printDownscaledImageStats(outputPath, oldFileSize / 1024.0, newFileSize / 1024.0, get<1>(resizeResult), get<2>(resizeResult), get<3>(resizeResult), get<4>(resizeResult), !written);
+}
+
+
+// Dry run: reports what processTask would do from the header alone, without decoding or writing anything.
+void previewImage(const string& imagePath, StatsClock::time_point startTime) {
+    std::optional<ImageHeader> header;
+    {
+        StageTimer timer(Stage::Stat);
+        header = probeImageFile(imagePath);
+    }
+    if (!header.has_value()) {
+        recordImage(ImageOutcome::Failed, startTime);
+        cerrPlus("Unknown or corrupt image: " + imagePath);
+        return;
+    }
+
+    int fileSize = std::max(getFileSizeTimed(imagePath), 0);
+    std::optional<cv::Size> newSize = getDownscaledSize(header->width, header->height);
+    recordImage(newSize.has_value() ? ImageOutcome::Resized : ImageOutcome::Recompressed, startTime, fileSize, fileSize);
+    if (quietOutput) {
+        return;
+    }
+
+    string oldDimensions = std::format("[{}x{}]", header->width, header->height);
+    string dimensions = newSize.has_value() ? std::format("{} => [{}x{}]", oldDimensions, newSize->width, newSize->height)
+                                            : std::format("{} (re-encode)", oldDimensions);
+    string outputPath = getOutputPath(imagePath);
+    string path = outputPath == imagePath ? imagePath : std::format("{} -> {}", imagePath, fs::path(outputPath).filename().string());
+    if (autoOutputFormat) {
+        // --format auto picks the format from the downscaled pixels, which a dry run never decodes
+        path = imagePath + " -> auto";
+    }
+    vector<string> texts = {std::format("{:.2f}kB (dry run)", fileSize / 1024.0), dimensions, path};
+    vector<string> colors = {"yellow", "blue", "light-yellow"};
+    vector<int> paddings = {26, 34, 0};
+    vector<string> alignments = {"left", "left", "left"};
+    coutPlusPlus(texts, colors, true, paddings, alignments);
+}
+
+
+ImageOutcome getImageOutcome(bool wasResized, bool written) {
+    if (!written) {
+        return ImageOutcome::KeptOriginal;
+    }
+    return wasResized ? ImageOutcome::Resized : ImageOutcome::Recompressed;
+}
+
+
+bool shouldSkipImage(const string& imagePath) {
+    if (processingPolicy != ProcessingPolicy::ResizeOnly) {
+        return false;
+    }
+
+    // Only the header is read here, the image is decoded later only if it actually needs to be downscaled
+    std::optional<ImageHeader> header;
+    {
+        StageTimer timer(Stage::Stat);
+        header = probeImageFile(imagePath);
+    }
+    if (!header.has_value()) {
+        // Every scanned format has a header the probe reads, without one the file is corrupt or not what its
+        // extension says; decoding it just to find out would go against the policy
+        recordImage(ImageOutcome::Failed, StatsClock::now());
+        cerrPlus("Unknown or corrupt image: " + imagePath);
+        return true;
+    }
+    if (getOutputPath(imagePath) != imagePath) {
+        // Has to be converted to the output format. --format auto only picks one for images that are decoded anyway,
+        // one that's small enough keeps its format.
+        return false;
+    }
+    if (header->width > maxImageLength || header->height > maxImageLength) {
+        return false;
+    }
+
+    recordImage(ImageOutcome::Skipped, StatsClock::now());
+    markImageUpToDate(imagePath);
+    printSkippedImageStats(imagePath, header->width, header->height);
+    return true;
+}
+
+
+bool isImageUpToDate(const string& imagePath, StatsClock::time_point startTime, bool isKnownOutdated) {
+    if (isKnownOutdated || resultCache == nullptr || !resultCache->isUpToDate(imagePath)) {
+        return false;
+    }
+    recordImage(ImageOutcome::Cached, startTime);
+    return true;
+}
+
+
+void markImageUpToDate(const string& imagePath, std::optional<uint64_t> contentHash) {
+    // A dry run leaves the cache as it found it
+    if (resultCache != nullptr && !dryRun) {
+        resultCache->update(imagePath, contentHash);
+    }
+}
+
+
+// Writes the image to getOutputPath(imagePath), or in the format --format auto picks for it, if that's a different file
+// (format conversion) the original is deleted. Returns where and how large the written file is, or nothing if the
+// original file was kept as it is. oldFileSize is the size of the original, known from reading it.
+std::optional<WrittenImage> writeImage(const string& imagePath, const Mat& image, bool wasResized,
+                                       const ImageMetadata& metadata, int oldFileSize) {
+    string outputExtension = outputFormat;
+    Mat outputImage = image;
+    bool isLossless = false;
+    if (autoOutputFormat) {
+        // Counted as encoding, it's part of deciding how to encode
+        StageTimer timer(Stage::Encode, image.total() * image.elemSize());
+        ImageAnalysis analysis = analyzeImage(image);
+        OutputKind kind = chooseOutputKind(analysis, canEncodePalettePng(encoderBackend));
+        outputExtension = getOutputKindExtension(kind);
+        outputImage = reduceChannels(image, analysis);
+        isLossless = kind == OutputKind::WebpLossless;
+    }
+
+    string outputPath = getOutputPath(imagePath, outputExtension);
+    bool isConversion = outputPath != imagePath;
+    if (isConversion && fs::exists(outputPath)) {
+        cerrPlus("Not converting the image, " + outputPath + " already exists: " + imagePath);
+        return std::nullopt;
+    }
+
+    string fileExtension = toLowerCase(getFileExtension(outputPath));
+    vector<int> compressionParams;
+    compressionParams = getCompressionParamsForImage(fileExtension);
+    if (isLossless) {
+        // Above 100 is lossless
+        setCompressionParam(compressionParams, cv::IMWRITE_WEBP_QUALITY, 101);
+    }
+
+    // Encoded into memory first, so the size can be checked before anything on disk changes
+    vector<uchar>& encodedImage = getEncodeBuffer();
+    if (!encodeOutputImage(fileExtension, outputImage, compressionParams, metadata, encodedImage)) {
+        cerrPlus("Failed to encode the image: " + imagePath);
+        return std::nullopt;
+    }
+    if (processingPolicy == ProcessingPolicy::RecompressIfSmaller && !wasResized) {
+        // Nothing was downscaled, so re-encoding is only worth it if it makes the file smaller, otherwise the
+        // original stays (a downscaled image is always written, the original is too large whatever its size)
+        if ((int) encodedImage.size() >= oldFileSize) {
+            return std::nullopt;
+        }
+    }
+
+    // Registered before it appears under its name, a scan that's still running can't take it for an image to process
+    if (isConversion) {
+        std::lock_guard<std::mutex> lock(writtenOutputsMtx);
+        writtenOutputs.insert(outputPath);
+    }
+    // A conversion creates a new file, it takes over the attributes of the original it replaces
+    if (!saveEncodedImage(outputPath, encodedImage, imagePath)) {
+        return std::nullopt;
+    }
+
+    if (isConversion) {
+        std::error_code error;
+        fs::remove(imagePath, error);
+        if (error) {
+            cerrPlus("Failed to delete the original image: " + imagePath + " (" + error.message() + ")");
+        }
+    }
+    uint64_t hash = resultCache != nullptr ? xxHash64(encodedImage.data(), encodedImage.size()) : 0;
+    return WrittenImage{outputPath, (int) encodedImage.size(), hash};
+}
+
+
+// Encodes an output image: with the quality search, which re-encodes the same (downscaled) image for every quality it
+// tries, verified against that image if the quality guard is on, and with the metadata spliced in afterwards.
+bool encodeOutputImage(const string& fileExtension, const Mat& image, const vector<int>& compressionParams,
+                       const ImageMetadata& metadata, vector<uchar>& encodedImage) {
+    // A byte budget is for the whole file, metadata included
+    QualitySearch search = qualitySearch;
+    if (search.maxBytes > 0) {
+        search.maxBytes = std::max<size_t>(search.maxBytes - std::min(search.maxBytes, metadata.size()), 1);
+    }
+    std::optional<int> quality = encodeWithQualitySearch(fileExtension, image, compressionParams, search, encodedImage);
+    if (!quality.has_value()) {
+        return false;
+    }
+    // Before the metadata goes in, the decoder shouldn't rotate anything
+    if (qualityGuard.enabled && !verifyEncodedImage(fileExtension, image, compressionParams, quality.value(), qualityGuard, encodedImage)) {
+        return false;
+    }
+    if (!metadata.empty()) {
+        thread_local vector<uchar> imageWithMetadata;
+        if (writeImageMetadata(encodedImage, metadata, imageWithMetadata)) {
+            std::swap(encodedImage, imageWithMetadata);
+        }
+    }
+    return true;
+}
+
+
+bool isWrittenOutput(const string& imagePath) {
+    std::lock_guard<std::mutex> lock(writtenOutputsMtx);
+    return writtenOutputs.contains(imagePath);
+}
+
+
+string getOutputPath(const string& imagePath) {
+    return getOutputPath(imagePath, outputFormat);
+}
+
+
+string getOutputPath(const string& imagePath, const string& outputExtension) {
+    if (outputExtension.empty()) {
+        return imagePath;
+    }
+    string fileExtension = toLowerCase(getFileExtension(imagePath));
+    if (fileExtension == outputExtension || (outputExtension == ".jpg" && fileExtension == ".jpeg")) {
+        return imagePath;
+    }
+    return fs::path(imagePath).replace_extension(outputExtension).string();
+}
+
+
+void printDownscaledImageStats(const string& imagePath, const double& oldImageSize, const double& newImageSize, int oldWidth, int oldHeight, int newWidth, int newHeight, bool keptOriginal) {
+    if (quietOutput) {
+        return;
+    }
+    std::ostringstream oss1;
+    oss1 << std::fixed << std::setprecision(2) << newImageSize;
+    string strNewImageSize = oss1.str();
+    std::ostringstream oss2;
+    oss2 << std::fixed << std::setprecision(2) << oldImageSize;
+    string strOldImageSize = oss2.str();
+
+    string msg = std::format("{}", imagePath);
+    vector<string> texts;
+    vector<string> colors;
+    vector<int> paddings = {26, 34, 0};
+    vector<string> alignments = {"left", "left", "left"};
+    string fileSizeDiff;
+    string fileSizeDiffColor;
+
+    if (oldImageSize > newImageSize) {
+        fileSizeDiff = std::format("{}kB > {}kB", strOldImageSize, strNewImageSize);
+        fileSizeDiffColor = "green";
+    } else {
+        fileSizeDiff = std::format("{}kB < {}kB", strOldImageSize, strNewImageSize);
+        fileSizeDiffColor = "red";
+    }
+
+    string oldDimensions = std::format("[{}x{}]", oldWidth, oldHeight);
+    string newDimensions = std::format("[{}x{}]", newWidth, newHeight);
+
+    if (newWidth == -1 && keptOriginal) {
+        fileSizeDiff = std::format("{}kB = {}kB", strOldImageSize, strNewImageSize);
+        string keptOriginalText = std::format("{} (kept original)", oldDimensions);
+        texts = {fileSizeDiff, keptOriginalText, msg};
+        colors = {"yellow", "yellow", "light-yellow"};
+    } else if (newWidth == -1) {
+        string notDownscaled = std::format("{} (not downscaled)", oldDimensions);
+        texts = {fileSizeDiff, notDownscaled, msg};
+        colors = {fileSizeDiffColor, "yellow", "light-yellow"};
+    } else {
+        string downscaled = std::format("{} => {}", oldDimensions, newDimensions);
+        texts = {fileSizeDiff, downscaled, msg};
+        colors = {fileSizeDiffColor, "blue", "light-yellow"};
+    }
+
+    coutPlusPlus(texts, colors, true, paddings, alignments);
+}
+
+
+void printSkippedImageStats(const string& imagePath, int width, int height) {
+    if (quietOutput) {
+        return;
+    }
+    double imageSize = getFileSizeInKB(imagePath);
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(2) << imageSize;
+
+    string fileSize = std::format("{}kB", oss.str());
+    string skipped = std::format("[{}x{}] (skipped)", width, height);
+    vector<string> texts = {fileSize, skipped, imagePath};
+    vector<string> colors = {"yellow", "yellow", "light-yellow"};
+    vector<int> paddings = {26, 34, 0};
+    vector<string> alignments = {"left", "left", "left"};
+
+    coutPlusPlus(texts, colors, true, paddings, alignments);
+}
+
+
+string getFileExtension(const string& filePath) {
+    fs::path path(filePath);
+    return path.extension().string();
+}
+
+
+int getFileSize(const string& filePath) {
+    // A single stat, opening the file isn't needed for its size
+    std::error_code error;
+    std::uintmax_t fileSize = fs::file_size(filePath, error);
+    if (error)
+        return -1; // Error reading the file attributes
+
+    return (int) fileSize;
+}
+
+
+int getFileSizeTimed(const string& filePath) {
+    StageTimer timer(Stage::Stat);
+    return getFileSize(filePath);
+}
+
+
+double getFileSizeInKB(const string& filePath) {
+    std::streampos fileSize = getFileSize(filePath);
+    if (fileSize == -1) {
+        cerrPlus("Failed to get image file size.");
+    }
+    double sizeKB = (double) fileSize / 1024.0;
+
+    return sizeKB;
+}
+
+
+std::optional<LoadedImage> readImage(const string& imagePath) {
+    vector<uchar>& fileBytes = getFileBuffer();
+    std::optional<LoadedImage> loadedImage;
+    if (readFileInto(imagePath, fileBytes)) {
+        loadedImage = decodeImage(fileBytes, imagePath);
+    }
+    trimFileBuffer(fileBytes);
+    return loadedImage;
+}
+
+
+// The file bytes are only needed until the image is decoded, so every thread keeps reusing one buffer, whichever
+// function reads the file
+vector<uchar>& getFileBuffer() {
+    thread_local vector<uchar> fileBytes;
+    return fileBytes;
+}
+
+
+// One huge file shouldn't pin its memory on every thread it went through for the rest of the run
+void trimFileBuffer(vector<uchar>& fileBytes) {
+    if (fileBytes.capacity() > maxRetainedFileBufferBytes) {
+        vector<uchar>().swap(fileBytes);
+    }
+}
+
+
+// One open, one fstat for the size and reads straight into the buffer, which keeps its capacity from the last image.
+// Not mmap: the whole file is decoded right away, so mapping it only adds a page fault per 4 KB and a SIGBUS if the
+// file is truncated while it's being decoded.
+bool readFileInto(const string& filePath, vector<uchar>& fileBytes) {
+    StageTimer timer(Stage::Read);
+#ifdef _WIN32
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        cerrPlus("Failed to open the image: " + filePath);
+        return false;
+    }
+    fileBytes.resize((size_t) file.tellg());
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(fileBytes.data()), (std::streamsize) fileBytes.size())) {
+        cerrPlus("Failed to read the image: " + filePath);
+        return false;
+    }
+#else
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        cerrPlus("Failed to open the image: " + filePath);
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        cerrPlus("Failed to read the image: " + filePath);
+        return false;
+    }
+    fileBytes.resize((size_t) fileStat.st_size);
+    size_t offset = 0;
+    while (offset < fileBytes.size()) {
+        ssize_t count = pread(fd, fileBytes.data() + offset, fileBytes.size() - offset, (off_t) offset);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        offset += (size_t) count;
+    }
+    close(fd);
+    if (offset != fileBytes.size()) {
+        cerrPlus("Failed to read the image: " + filePath);
+        return false;
+    }
+#endif
+    timer.setBytes(fileBytes.size());
+    return true;
+}
+
+
+std::optional<LoadedImage> decodeImage(const vector<uchar>& fileBytes, const string& imagePath) {
+    StageTimer timer(Stage::Decode, fileBytes.size());
+    LoadedImage loadedImage;
+    int readFlags = cv::IMREAD_COLOR;
+
+    // The orientation is applied below from the EXIF read here, OpenCV only does it for some formats and versions,
+    // and this way it's known whether the pixels were turned and the tag has to be reset
+    loadedImage.metadata = readImageMetadata(fileBytes.data(), fileBytes.size());
+    int orientation = getExifOrientation(loadedImage.metadata.exif);
+
+    // Only JPEG can really decode at a lower resolution (scaled IDCT), OpenCV would decode any other format
+    // at full size and then shrink it, which is slower than leaving it to resizeImage
+    std::optional<ImageHeader> header = probeImageHeader(fileBytes.data(), fileBytes.size());
+    if (header.has_value() && header->format == ImageFormat::Jpeg) {
+        loadedImage.decodeReduction = getDecodeReduction(header->width, header->height);
+        if (loadedImage.decodeReduction == 2) {
+            readFlags = cv::IMREAD_REDUCED_COLOR_2;
+        } else if (loadedImage.decodeReduction == 4) {
+            readFlags = cv::IMREAD_REDUCED_COLOR_4;
+        } else if (loadedImage.decodeReduction == 8) {
+            readFlags = cv::IMREAD_REDUCED_COLOR_8;
+        }
+    } else if (header.has_value() && (header->format == ImageFormat::Png || header->format == ImageFormat::Webp)) {
+        // IMREAD_COLOR would drop the alpha channel and turn gray images into BGR, the output keeps both
+        readFlags = cv::IMREAD_UNCHANGED;
+    }
+
+    std::unique_ptr<RowDecoder> rowDecoder;
+    if (header.has_value() && shouldStreamImage(header.value())) {
+        rowDecoder = openRowDecoder(fileBytes.data(), fileBytes.size(), loadedImage.decodeReduction);
+    }
+    if (rowDecoder != nullptr) {
+        // Downscaled to the final size while decoding, resizeImage then has nothing left to do. The size is
+        // computed for the image as it's shown, the pixels are still the way they're stored.
+        bool isTransposed = orientation >= 5;
+        cv::Size newSize = isTransposed ? getDownscaledSize(header->height, header->width).value()
+                                        : getDownscaledSize(header->width, header->height).value();
+        loadedImage.image = downscaleRows(*rowDecoder, isTransposed ? cv::Size(newSize.height, newSize.width) : newSize);
+    } else {
+        loadedImage.image = cv::imdecode(fileBytes, readFlags | cv::IMREAD_IGNORE_ORIENTATION);
+    }
+
+    if (loadedImage.image.empty()) {
+        cerrPlus("Failed to load the image: " + imagePath);
+        return std::nullopt;
+    }
+    if (loadedImage.image.depth() != CV_8U) {
+        // 16-bit PNGs, everything after decoding works on 8 bits
+        loadedImage.image.convertTo(loadedImage.image, CV_8U, 1.0 / 257);
+    }
+
+    if (header.has_value()) {
+        loadedImage.originalWidth = header->width;
+        loadedImage.originalHeight = header->height;
+    } else {
+        loadedImage.originalWidth = loadedImage.image.cols;
+        loadedImage.originalHeight = loadedImage.image.rows;
+    }
+
+    if (orientation != 1) {
+        applyExifOrientation(loadedImage.image, orientation);
+        setExifOrientation(loadedImage.metadata.exif, 1);
+        if (orientation >= 5) {
+            std::swap(loadedImage.originalWidth, loadedImage.originalHeight);
+        }
+    }
+    limitImageMetadata(loadedImage.metadata, metadataPolicy, maxMetadataBytes);
+    return loadedImage;
+}
+
+
+// Decoding the whole image would need more memory than it's worth, and it gets downscaled anyway
+bool shouldStreamImage(const ImageHeader& header) {
+    if (streamAboveMegapixels <= 0) {
+        return false;
+    }
+    // Both sides count the same for the orientation, getDownscaledSize only compares them to maxImageLength
+    bool isLarge = (int64_t) header.width * header.height > (int64_t) streamAboveMegapixels * 1000 * 1000;
+    return isLarge && getDownscaledSize(header.width, header.height).has_value();
+}
+
+
+// Rough peak memory processTask needs for the image, from its header and file size: the file bytes, the decoded pixels
+// (twice, turning or converting them makes a copy) and the downscaled image with its encode buffers. Only used to
+// decide how many images can be processed at once, so it errs on the large side.
+size_t estimateImageMemory(const string& imagePath) {
+    std::optional<ImageHeader> header;
+    {
+        StageTimer timer(Stage::Stat);
+        header = probeImageFile(imagePath);
+    }
+    size_t fileSize = (size_t) std::max(getFileSize(imagePath), 0);
+    if (!header.has_value()) {
+        return fileSize;
+    }
+
+    int reduction = header->format == ImageFormat::Jpeg ? getDecodeReduction(header->width, header->height) : 1;
+    size_t decodedWidth = (size_t) (header->width + reduction - 1) / reduction;
+    size_t decodedHeight = (size_t) (header->height + reduction - 1) / reduction;
+    // PNGs and WebPs are decoded with their alpha channel, if they have one
+    size_t channels = header->format == ImageFormat::Jpeg ? 3 : 4;
+    size_t decodedBytes = decodedWidth * decodedHeight * channels * 2;
+    if (shouldStreamImage(header.value()) && canDecodeRows(header->format)) {
+        // Only the resampler's window of rows, the widest filter (Lanczos3) covers 6 source rows per output row
+        double scale = (double) std::max(decodedWidth, decodedHeight) / maxImageLength;
+        decodedBytes = decodedWidth * channels * (size_t) (std::ceil(6 * scale) + 1);
+    }
+
+    std::optional<cv::Size> newSize = getDownscaledSize(header->width, header->height);
+    size_t outputBytes = newSize.has_value() ? (size_t) newSize->area() * channels * 2 : decodedBytes;
+    return fileSize + decodedBytes + outputBytes;
+}
+
+
+// Feeds the decoded rows straight into the resampler, only the rows of its filter window are ever in memory at once
+Mat downscaleRows(RowDecoder& rowDecoder, cv::Size newSize) {
+    int channels = rowDecoder.getChannels();
+    Resampler resampler(rowDecoder.getWidth(), rowDecoder.getHeight(), newSize.width, newSize.height, channels, resampleFilter);
+    Mat image(newSize, CV_8UC(channels));
+    vector<uchar> row((size_t) rowDecoder.getWidth() * channels);
+    for (int y = 0; y < rowDecoder.getHeight(); ++y) {
+        if (!rowDecoder.readRow(row.data())) {
+            return Mat();
+        }
+        resampler.pushRow(row.data());
+        while (resampler.hasOutputRow()) {
+            resampler.writeOutputRow(image.ptr(resampler.getDstRowsWritten()));
+        }
+    }
+    return resampler.getDstRowsWritten() == newSize.height ? image : Mat();
+}
+
+
+// Turns the pixels the way the EXIF orientation tag says they should be shown (same steps as OpenCV's imread)
+void applyExifOrientation(Mat& image, int orientation) {
+    switch (orientation) {
+        case 2:
+            cv::flip(image, image, 1);
+            break;
+        case 3:
+            cv::flip(image, image, -1);
+            break;
+        case 4:
+            cv::flip(image, image, 0);
+            break;
+        case 5:
+            cv::transpose(image, image);
+            break;
+        case 6:
+            cv::transpose(image, image);
+            cv::flip(image, image, 1);
+            break;
+        case 7:
+            cv::transpose(image, image);
+            cv::flip(image, image, -1);
+            break;
+        case 8:
+            cv::transpose(image, image);
+            cv::flip(image, image, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+
+int getDecodeReduction(int width, int height) {
+    // Largest power of two reduction that still leaves the longer side at or above maxImageLength,
+    // resizeImage then does the precise rest of the downscaling
+    int longerSide = std::max(width, height);
+    for (int reduction : {8, 4, 2}) {
+        int reducedSide = (longerSide + reduction - 1) / reduction;
+        if (reducedSide >= maxImageLength) {
+            return reduction;
+        }
+    }
+    return 1;
+}
+
+
+bool saveImage(const string& outputFileName, const Mat& image, const vector<int>& compressionParams) {
+    // Encoding and writing separately (instead of imwrite) lets the statistics tell the two apart
+    vector<uchar>& encodedImage = getEncodeBuffer();
+    if (!encodeImage(getFileExtension(outputFileName), image, encodedImage, compressionParams)) {
+        cerrPlus("Failed to encode the image: " + outputFileName);
+        return false;
+    }
+    return saveEncodedImage(outputFileName, encodedImage);
+}
+
+
+// One encode buffer per thread, its capacity is kept between images, so encoding doesn't allocate once it has grown
+// to the largest output the thread has produced
+vector<uchar>& getEncodeBuffer() {
+    thread_local vector<uchar> encodeBuffer;
+    return encodeBuffer;
+}
+
+
+bool encodeImage(const string& fileExtension, const Mat& image, vector<uchar>& encodedImage, const vector<int>& compressionParams) {
+    StageTimer timer(Stage::Encode, image.total() * image.elemSize());
+    string lowerCaseExtension = toLowerCase(fileExtension);
+    const ImageEncoder& encoder = selectImageEncoder(encoderBackend, lowerCaseExtension, image);
+    return encoder.encode(lowerCaseExtension, image, compressionParams, encodedImage);
+}
+
+
+bool saveEncodedImage(const string& outputFileName, const vector<uchar>& encodedImage, const string& originalPath) {
+    StageTimer timer(Stage::Write, encodedImage.size());
+    AtomicWriteOptions options;
+    options.fsyncPolicy = fsyncPolicy;
+    options.attributesFrom = originalPath.empty() ? outputFileName : originalPath;
+    options.preserveTimes = preserveTimestamps;
+    return writeFileAtomically(outputFileName, encodedImage.data(), encodedImage.size(), options);
+}
+
+
+vector<int> getCompressionParamsForImage(const string& imageType) {
+    vector<int> compressionParams;
+    if (imageType == ".jpg" || imageType == ".jpeg") {
+        compressionParams.push_back(cv::IMWRITE_JPEG_QUALITY);
+        int imgQuality = imageQuality != -1 ? imageQuality : 100 - (imageCompression * 10);
+        // Set the desired compression level [0(max compression/lowest image quality), 100(no compression/highest image quality)]
+        compressionParams.push_back(imgQuality);
+        // Optimized Huffman tables make every JPEG a few percent smaller for little extra time
+        compressionParams.push_back(cv::IMWRITE_JPEG_OPTIMIZE);
+        compressionParams.push_back(1);
+        compressionParams.push_back(cv::IMWRITE_JPEG_PROGRESSIVE);
+        compressionParams.push_back(progressiveJpeg ? 1 : 0);
+        compressionParams.push_back(cv::IMWRITE_JPEG_SAMPLING_FACTOR);
+        compressionParams.push_back(jpegSamplingFactor);
+    } else if (imageType == ".png") {
+        compressionParams.push_back(cv::IMWRITE_PNG_COMPRESSION);
+        int imgCompression =  static_cast<int>(imageCompression * 9 / 10.0);
+        // Set the desired compression level [0(no compression/highest image quality), 9(max compression/lowest image quality)]
+        compressionParams.push_back(imgCompression);
+    } else if (imageType == ".webp") {
+        compressionParams.push_back(cv::IMWRITE_WEBP_QUALITY);
+        int imgQuality = imageQuality != -1 ? imageQuality : 100 - (imageCompression * 10);
+        // Set the desired compression level [0(max compression/lowest image quality), 100(no compression/highest image quality)]
+        compressionParams.push_back(imgQuality);
+    }
+//    } else if (imageType == ".tiff") {
+//        compressionParams.push_back(cv::IMWRITE_TIFF_COMPRESSION);
+//        int imgCompression = -1;  // TODO - different types of compression for .tiff
+////      Set the desired compression level [0(no compression/best image quality), 9(max compression/worst image quality)]
+//        compressionParams.push_back(imgCompression);
+//    }
+
+    return compressionParams;
+}
+
+
+std::tuple<std::optional<Mat>, int, int, int, int> resizeImage(const Mat& image) {
+    int width = image.cols;
+    int height = image.rows;
+
+    std::optional<cv::Size> newSize = getDownscaledSize(width, height);
+    if (!newSize.has_value()) {
+        return make_tuple(std::nullopt, width, height, -1, -1);
+    }
+    int newWidth = newSize->width;
+    int newHeight = newSize->height;
+
+    Mat resizedImage;
+    resizeTo(image, resizedImage, cv::Size(newWidth, newHeight), resampleFilter);
+
+    return std::make_tuple(resizedImage, width, height, newWidth, newHeight);
+}
+
+
+void resizeTo(const Mat& image, Mat& resizedImage, cv::Size newSize, ResampleFilter filter) {
+    bool isSupportedByResampler = image.depth() == CV_8U && (image.channels() == 1 || image.channels() == 3 || image.channels() == 4);
+    if (isSupportedByResampler) {
+        resampleImage(image, resizedImage, newSize, filter);
+    } else {
+        resize(image, resizedImage, newSize, 0, 0, cv::INTER_AREA);
+    }
+}
+
+
+// Returns std::nullopt if the image already fits into maxImageLength.
+std::optional<cv::Size> getDownscaledSize(int width, int height) {
+    return getDownscaledSize(width, height, maxImageLength);
+}
+
+
+std::optional<cv::Size> getDownscaledSize(int width, int height, int maxLength) {
+    if (width <= maxLength && height <= maxLength) {
+        return std::nullopt;
+    }
+    // 64 bits, maxLength * 70000 doesn't fit into an int; and at least 1 pixel, however extreme the aspect ratio
+    if (width > height) {
+        return cv::Size(maxLength, (int) std::max<int64_t>(1, (int64_t) maxLength * height / width));
+    }
+    return cv::Size((int) std::max<int64_t>(1, (int64_t) maxLength * width / height), maxLength);
+}
+
+
+std::tuple<std::optional<Mat>, int, int, int, int> resizeImage(const LoadedImage& loadedImage) {
+    StageTimer timer(Stage::Resize, loadedImage.image.total() * loadedImage.image.elemSize());
+    auto resizeResult = resizeImage(loadedImage.image);
+
+    // Report the dimensions from the file, not the ones of the (possibly reduced) decoded image
+    get<1>(resizeResult) = loadedImage.originalWidth;
+    get<2>(resizeResult) = loadedImage.originalHeight;
+    bool wasReducedWhileDecoding = std::max(loadedImage.image.cols, loadedImage.image.rows) <
+                                   std::max(loadedImage.originalWidth, loadedImage.originalHeight);
+    if (!get<0>(resizeResult).has_value() && wasReducedWhileDecoding) {
+        // The reduced or streamed decode alone already brought the image down to maxImageLength
+        get<3>(resizeResult) = loadedImage.image.cols;
+        get<4>(resizeResult) = loadedImage.image.rows;
+    }
+    return resizeResult;
+}
+
+
+void coutPlusPlus(const vector<string>& texts, const vector<string>& colors, bool endLine, const vector<int>& paddings, const vector<string>& alignments) {
+    {
+        std::lock_guard<std::mutex> lock(consoleMtx);
+
+        if (paddings.empty()) {
+            for (size_t i = 0; i < texts.size(); ++i) {
+                setConsoleTextColor(colors[i]);
+                std::cout << texts[i];
+                setConsoleTextColor("DEFAULT");
+            }
+        }
+        else {
+            for (size_t i = 0; i < texts.size(); ++i) {
+                // The color goes out first, otherwise the escape sequence would use up the padding
+                setConsoleTextColor(colors[i]);
+                std::cout << std::setfill('.') << std::setw(paddings[i]);
+                if (alignments[i] == "left") std::cout << std::left;
+                if (alignments[i] == "right") std::cout << std::right;
+                std::cout << texts[i];
+                setConsoleTextColor("DEFAULT");
+            }
+        }
+        if (endLine) {
+            std::cout << std::endl;
+        }
+    }
+}
+
+
+void coutPlus(const string& text, const string& color, bool endLine) {
+    {
+        std::lock_guard<std::mutex> lock(consoleMtx);
+
+        setConsoleTextColor(color);
+        std::cout << text;
+        setConsoleTextColor("DEFAULT");
+        if (endLine) {
+            std::cout << std::endl;
+        }
+    }
+}
+
+
+void cerrPlus(const string& text) {
+    {
+        std::lock_guard<std::mutex> lock(consoleMtx);
+        std::cerr << text << std::endl;
+    }
+}
+
+
+// Turns the colors off when stdout isn't a terminal (or NO_COLOR is set), so redirected output stays plain text.
+void initConsole() {
+    if (std::getenv("NO_COLOR") != nullptr) {
+        colorOutput = false;
+    }
+#ifdef _WIN32
+    if (!_isatty(_fileno(stdout))) {
+        colorOutput = false;
+    }
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    if (colorOutput && (!GetConsoleMode(hConsole, &mode) || !SetConsoleMode(hConsole, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING))) {
+        // Consoles older than Windows 10 don't understand ANSI escape sequences
+        colorOutput = false;
+    }
+#else
+    if (!isatty(STDOUT_FILENO)) {
+        colorOutput = false;
+    }
+#endif
+}
+
+
+void setConsoleTextColor(const string& color) {
+    if (colorOutput) {
+        std::cout << getColorEscapeSequence(color);
+    }
+}
+
+
+string getColorEscapeSequence(const string& color) {
+    static std::unordered_map<string, string> colorMap = {
+            {"DEFAULT", "\033[0m"},
+            {"red", "\033[91m"},
+            {"green", "\033[92m"},
+            {"blue", "\033[94m"},
+            {"yellow", "\033[33m"},
+            {"light-yellow", "\033[93m"},
+            {"pink", "\033[95m"},
+            {"light-blue", "\033[96m"}
+    };
+
+    auto it = colorMap.find(color);
+    if (it != colorMap.end()) {
+        return it->second;
+    }
+
+    // Return default color if color is not found
+    return colorMap["DEFAULT"];
+}
@@ -0,0 +1,125 @@
+#ifndef IMAGE_DOWNSCALER_DOWNSCALER_H
+#define IMAGE_DOWNSCALER_DOWNSCALER_H
+
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "atomic_file.h"
+#include "image_codec.h"
+#include "image_metadata.h"
+#include "image_probe.h"
+#include "quality_search.h"
+#include "renditions.h"
+#include "resampler.h"
+#include "stats.h"
+
+
+using std::string;
+using std::vector;
+using cv::Mat;
+
+
+class ResultCache;
+
+
+struct LoadedImage {
+    Mat image;
+    int originalWidth = 0;  // dimensions of the image in the file, before any decode-time reduction
+    int originalHeight = 0;
+    int decodeReduction = 1;  // 1, 2, 4 or 8 - how much smaller the image was decoded
+    ImageMetadata metadata;  // to write into the output, already limited by metadataPolicy and maxMetadataBytes
+};
+
+
+struct WrittenImage {
+    string path;  // the original's, or the converted file that replaced it
+    int fileSize = 0;
+    uint64_t hash = 0;  // xxHash64 of the written bytes, the result cache doesn't read the file back for it
+};
+
+
+enum class ProcessingPolicy {
+    ResizeOnly,  // only touch images larger than maxImageLength, skip the rest without decoding them
+    RecompressIfSmaller,  // also re-encode the rest, but only keep the result if it's smaller than the original
+    Always  // re-encode every image
+};
+
+
+extern int maxImageLength;
+extern int imageCompression;  // [0(no compression, highest image quality), 10(max compression, lowest image quality)]
+extern int imageQuality;  // [1, 100] JPEG and WebP quality, -1 = derive it from imageCompression
+extern string outputFormat;  // ".jpg", ".png" or ".webp" to convert every image to that format, empty = keep the format
+extern bool autoOutputFormat;  // pick JPEG, WebP or PNG for every image from its pixels, outputFormat is empty then
+extern ProcessingPolicy processingPolicy;
+extern ResampleFilter resampleFilter;
+extern int streamAboveMegapixels;  // larger images are decoded row by row into the resampler, 0 = never
+extern EncoderBackend encoderBackend;
+extern bool progressiveJpeg;
+extern int jpegSamplingFactor;  // cv::IMWRITE_JPEG_SAMPLING_FACTOR_*, chroma subsampling of the JPEGs written
+extern MetadataPolicy metadataPolicy;
+extern size_t maxMetadataBytes;  // EXIF, ICC profiles and XMP larger than this are dropped, 0 = no limit
+extern vector<Rendition> renditions;  // sizes written next to every original instead of replacing it, largest first
+extern string renditionNamePattern;
+extern QualitySearch qualitySearch;  // how far the JPEG/WebP quality may be lowered below the configured one
+extern QualityGuard qualityGuard;  // how every JPEG/WebP output is checked after encoding
+extern bool quietOutput;  // don't print a line for every processed image
+extern bool dryRun;  // only report what would be done, don't write anything
+extern bool colorOutput;
+extern FsyncPolicy fsyncPolicy;
+extern bool preserveTimestamps;  // give rewritten images the timestamps of the original, not the time of the run
+extern ResultCache* resultCache;  // nullptr = process every image, even if an earlier run already did
+
+
+void coutPlus(const string& text, const string& color="DEFAULT", bool endLine=true);
+void cerrPlus(const string& text);
+void initConsole();
+void coutPlusPlus(const vector<string>& texts, const vector<string>& colors, bool endLine=true, const vector<int>& paddings={}, const vector<string>& alignments={});
+string toLowerCase(const string& str);
+bool isStringInList(const string& element, const vector<string>& list);
+// isKnownOutdated: the caller already looked the image up in the result cache and it isn't up to date, it's neither
+// stat'ed nor hashed for that again
+void processTask(const string& imagePath, int taskId, bool isKnownOutdated = false);
+ImageOutcome getImageOutcome(bool wasResized, bool written);
+void previewImage(const string& imagePath, StatsClock::time_point startTime);
+std::optional<cv::Size> getDownscaledSize(int width, int height);
+std::optional<cv::Size> getDownscaledSize(int width, int height, int maxLength);
+std::tuple<std::optional<Mat>, int, int, int, int> resizeImage(const Mat& image);
+std::tuple<std::optional<Mat>, int, int, int, int> resizeImage(const LoadedImage& loadedImage);
+void resizeTo(const Mat& image, Mat& resizedImage, cv::Size newSize, ResampleFilter filter);
+std::optional<LoadedImage> readImage(const string& imagePath);
+// Per-thread buffer for the bytes of the file being decoded, only valid until the next read on the same thread
+vector<uchar>& getFileBuffer();
+// Frees a buffer's memory if a large file grew it, call it once the bytes are decoded
+void trimFileBuffer(vector<uchar>& fileBytes);
+bool readFileInto(const string& filePath, vector<uchar>& fileBytes);  // reuses the buffer's capacity
+std::optional<LoadedImage> decodeImage(const vector<uchar>& fileBytes, const string& imagePath);
+bool shouldStreamImage(const ImageHeader& header);
+size_t estimateImageMemory(const string& imagePath);
+Mat downscaleRows(RowDecoder& rowDecoder, cv::Size newSize);
+void applyExifOrientation(Mat& image, int orientation);
+int getDecodeReduction(int width, int height);
+bool shouldSkipImage(const string& imagePath);
+bool isImageUpToDate(const string& imagePath, StatsClock::time_point startTime, bool isKnownOutdated = false);
+void markImageUpToDate(const string& imagePath, std::optional<uint64_t> contentHash = std::nullopt);
+std::optional<WrittenImage> writeImage(const string& imagePath, const Mat& image, bool wasResized, const ImageMetadata& metadata, int oldFileSize);
+bool encodeOutputImage(const string& fileExtension, const Mat& image, const vector<int>& compressionParams, const ImageMetadata& metadata, vector<uchar>& encodedImage);
+// Whether this run created the file by converting another image, so it mustn't be processed again
+bool isWrittenOutput(const string& imagePath);
+string getOutputPath(const string& imagePath);  // with outputFormat, the original's path with --format auto
+string getOutputPath(const string& imagePath, const string& outputExtension);
+bool saveImage(const string& outputFileName, const Mat& image, const vector<int>& compressionParams={});
+vector<uchar>& getEncodeBuffer();
+bool encodeImage(const string& fileExtension, const Mat& image, vector<uchar>& encodedImage, const vector<int>& compressionParams={});
+bool saveEncodedImage(const string& outputFileName, const vector<uchar>& encodedImage, const string& originalPath="");
+vector<int> getCompressionParamsForImage(const string& imageType);
+int getFileSize(const string& filePath);
+int getFileSizeTimed(const string& filePath);  // getFileSize, counted as the stat stage
+double getFileSizeInKB(const string& filePath);
+string getFileExtension(const string& filePath);
+void printDownscaledImageStats(const string& imagePath, const double& oldImageSize, const double& newImageSize, int oldWidth, int oldHeight, int newWidth, int newHeight, bool keptOriginal=false);
+void printSkippedImageStats(const string& imagePath, int width, int height);
+
+
+#endif //IMAGE_DOWNSCALER_DOWNSCALER_H
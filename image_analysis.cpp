@@ -0,0 +1,429 @@
+#include "image_analysis.h"
+#include <algorithm>
+#include <bit>
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IMAGE_DOWNSCALER_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define IMAGE_DOWNSCALER_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2/SSE4.1 instructions in functions explicitly marked for them, MSVC always can
+#if defined(IMAGE_DOWNSCALER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+
+using cv::Mat;
+using std::string;
+using std::vector;
+
+
+namespace {
+    // Share of bytes equal to the same byte of the pixel to their left, above which an image counts as a graphic.
+    // Downscaled photos stay well below it even in skies and other smooth areas, screenshots and drawings are mostly
+    // flat backgrounds far above it.
+    const double graphicRepeatedShare = 0.5;
+    // Every row is checked for alpha and colour, a sample of this many rows is enough for how flat the image is
+    const int maxSampledRows = 256;
+
+
+    // ---- Scalar ----
+
+    bool isOpaqueRowScalar(const uchar* row, int width, int start = 0) {
+        for (int x = start; x < width; ++x) {
+            if (row[x * 4 + 3] != 255) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    bool isGrayRowScalar(const uchar* row, int width, int channels, int start = 0) {
+        for (int x = start; x < width; ++x) {
+            const uchar* pixel = row + x * channels;
+            if (pixel[0] != pixel[1] || pixel[1] != pixel[2]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    // Bytes from start to length that are equal to the byte distance before them, start >= distance
+    int countRepeatedBytesScalar(const uchar* row, int length, int distance, int start) {
+        int count = 0;
+        for (int i = start; i < length; ++i) {
+            count += row[i] == row[i - distance];
+        }
+        return count;
+    }
+
+
+    // Bits of the pixels' B and G bytes in a comparison mask of step bytes: B == G and G == R of every pixel are the
+    // comparisons of these bytes with the one after them
+    uint32_t getGrayCheckBits(int channels, int step) {
+        uint32_t bits = 0;
+        for (int i = 0; i < step; ++i) {
+            if (i % channels < 2) {
+                bits |= 1u << i;
+            }
+        }
+        return bits;
+    }
+
+
+#ifdef IMAGE_DOWNSCALER_X86
+    // ---- SSE4.1 ----
+    // Bytes are compared 16 at a time and the results collected with movemask. The gray check compares every byte with
+    // the next one and only looks at the bits of B and G; BGR pixels are checked 5 (15 bytes) at a time so every vector
+    // starts at a pixel.
+
+    TARGET_SSE41 bool isOpaqueRowSse41(const uchar* row, int width) {
+        const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4));
+            // Carry flag: every alpha bit set in the pixels
+            if (!_mm_testc_si128(pixels, alpha)) {
+                return false;
+            }
+        }
+        return isOpaqueRowScalar(row, width, x);
+    }
+
+
+    TARGET_SSE41 bool isGrayRowSse41(const uchar* row, int width, int channels) {
+        int pixelsPerStep = channels == 3 ? 5 : 4;
+        int checkBits = (int) getGrayCheckBits(channels, pixelsPerStep * channels);
+        int rowBytes = width * channels;
+        int x = 0;
+        // The comparison with the next byte reads one byte past the 16
+        for (; x * channels + 17 <= rowBytes; x += pixelsPerStep) {
+            const uchar* bytes = row + x * channels;
+            __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+            __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 1));
+            if ((_mm_movemask_epi8(_mm_cmpeq_epi8(current, next)) & checkBits) != checkBits) {
+                return false;
+            }
+        }
+        return isGrayRowScalar(row, width, channels, x);
+    }
+
+
+    TARGET_SSE41 int countRepeatedBytesSse41(const uchar* row, int length, int distance) {
+        int count = 0;
+        int i = distance;
+        for (; i + 16 <= length; i += 16) {
+            __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+            __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - distance));
+            count += std::popcount((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(current, previous)));
+        }
+        return count + countRepeatedBytesScalar(row, length, distance, i);
+    }
+
+
+    // ---- AVX2 ----
+    // Same as SSE4.1 with 32 bytes, BGR pixels 10 (30 bytes) at a time
+
+    TARGET_AVX2 bool isOpaqueRowAvx2(const uchar* row, int width) {
+        const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x * 4));
+            if (!_mm256_testc_si256(pixels, alpha)) {
+                return false;
+            }
+        }
+        return isOpaqueRowScalar(row, width, x);
+    }
+
+
+    TARGET_AVX2 bool isGrayRowAvx2(const uchar* row, int width, int channels) {
+        int pixelsPerStep = channels == 3 ? 10 : 8;
+        uint32_t checkBits = getGrayCheckBits(channels, pixelsPerStep * channels);
+        int rowBytes = width * channels;
+        int x = 0;
+        for (; x * channels + 33 <= rowBytes; x += pixelsPerStep) {
+            const uchar* bytes = row + x * channels;
+            __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes));
+            __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + 1));
+            if (((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(current, next)) & checkBits) != checkBits) {
+                return false;
+            }
+        }
+        return isGrayRowScalar(row, width, channels, x);
+    }
+
+
+    TARGET_AVX2 int countRepeatedBytesAvx2(const uchar* row, int length, int distance) {
+        int count = 0;
+        int i = distance;
+        for (; i + 32 <= length; i += 32) {
+            __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+            __m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i - distance));
+            count += std::popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(current, previous)));
+        }
+        return count + countRepeatedBytesScalar(row, length, distance, i);
+    }
+#endif
+
+
+#ifdef IMAGE_DOWNSCALER_NEON
+    // ---- NEON ----
+    // The interleaved loads split 16 pixels into one vector per channel, so the channels are compared directly
+
+    bool isOpaqueRowNeon(const uchar* row, int width) {
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            if (vminvq_u8(vld4q_u8(row + x * 4).val[3]) != 255) {
+                return false;
+            }
+        }
+        return isOpaqueRowScalar(row, width, x);
+    }
+
+
+    bool isGrayRowNeon(const uchar* row, int width, int channels) {
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16_t b, g, r;
+            if (channels == 3) {
+                uint8x16x3_t pixels = vld3q_u8(row + x * 3);
+                b = pixels.val[0], g = pixels.val[1], r = pixels.val[2];
+            } else {
+                uint8x16x4_t pixels = vld4q_u8(row + x * 4);
+                b = pixels.val[0], g = pixels.val[1], r = pixels.val[2];
+            }
+            if (vminvq_u8(vandq_u8(vceqq_u8(b, g), vceqq_u8(g, r))) != 255) {
+                return false;
+            }
+        }
+        return isGrayRowScalar(row, width, channels, x);
+    }
+
+
+    int countRepeatedBytesNeon(const uchar* row, int length, int distance) {
+        int count = 0;
+        int i = distance;
+        for (; i + 16 <= length; i += 16) {
+            uint8x16_t equal = vceqq_u8(vld1q_u8(row + i), vld1q_u8(row + i - distance));
+            count += vaddvq_u8(vshrq_n_u8(equal, 7));
+        }
+        return count + countRepeatedBytesScalar(row, length, distance, i);
+    }
+#endif
+
+
+    bool isOpaqueRow(SimdLevel simdLevel, const uchar* row, int width) {
+#ifdef IMAGE_DOWNSCALER_X86
+        if (simdLevel == SimdLevel::Avx2) {
+            return isOpaqueRowAvx2(row, width);
+        }
+        if (simdLevel == SimdLevel::Sse41) {
+            return isOpaqueRowSse41(row, width);
+        }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+        if (simdLevel == SimdLevel::Neon) {
+            return isOpaqueRowNeon(row, width);
+        }
+#endif
+        return isOpaqueRowScalar(row, width);
+    }
+
+
+    bool isGrayRow(SimdLevel simdLevel, const uchar* row, int width, int channels) {
+#ifdef IMAGE_DOWNSCALER_X86
+        if (simdLevel == SimdLevel::Avx2) {
+            return isGrayRowAvx2(row, width, channels);
+        }
+        if (simdLevel == SimdLevel::Sse41) {
+            return isGrayRowSse41(row, width, channels);
+        }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+        if (simdLevel == SimdLevel::Neon) {
+            return isGrayRowNeon(row, width, channels);
+        }
+#endif
+        return isGrayRowScalar(row, width, channels);
+    }
+
+
+    int countRepeatedBytes(SimdLevel simdLevel, const uchar* row, int length, int distance) {
+#ifdef IMAGE_DOWNSCALER_X86
+        if (simdLevel == SimdLevel::Avx2) {
+            return countRepeatedBytesAvx2(row, length, distance);
+        }
+        if (simdLevel == SimdLevel::Sse41) {
+            return countRepeatedBytesSse41(row, length, distance);
+        }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+        if (simdLevel == SimdLevel::Neon) {
+            return countRepeatedBytesNeon(row, length, distance);
+        }
+#endif
+        return countRepeatedBytesScalar(row, length, distance, distance);
+    }
+
+
+    int countGrayLevels(const Mat& image) {
+        bool isUsed[256] = {};
+        int count = 0;
+        for (int y = 0; y < image.rows; ++y) {
+            const uchar* row = image.ptr<uchar>(y);
+            for (int x = 0; x < image.cols; ++x) {
+                count += !isUsed[row[x]];
+                isUsed[row[x]] = true;
+            }
+        }
+        return count;
+    }
+}
+
+
+ImageAnalysis analyzeImage(const Mat& image, SimdLevel simdLevel) {
+    ImageAnalysis analysis;
+    int channels = image.channels();
+    analysis.hasAlpha = channels == 4;
+    analysis.isGrayscale = channels == 1;
+    if (image.depth() != CV_8U || (channels != 1 && channels != 3 && channels != 4) || image.empty()) {
+        return analysis;
+    }
+
+    if (channels == 4) {
+        analysis.hasAlpha = false;
+        for (int y = 0; y < image.rows && !analysis.hasAlpha; ++y) {
+            analysis.hasAlpha = !isOpaqueRow(simdLevel, image.ptr<uchar>(y), image.cols);
+        }
+    }
+    if (channels >= 3) {
+        analysis.isGrayscale = true;
+        for (int y = 0; y < image.rows && analysis.isGrayscale; ++y) {
+            analysis.isGrayscale = isGrayRow(simdLevel, image.ptr<uchar>(y), image.cols, channels);
+        }
+    }
+
+    int rowBytes = image.cols * channels;
+    int rowStep = std::max(1, image.rows / maxSampledRows);
+    int64_t repeatedBytes = 0, comparedBytes = 0;
+    for (int y = 0; y < image.rows; y += rowStep) {
+        repeatedBytes += countRepeatedBytes(simdLevel, image.ptr<uchar>(y), rowBytes, channels);
+        comparedBytes += rowBytes - channels;
+    }
+    analysis.isGraphic = comparedBytes > 0 && (double) repeatedBytes >= graphicRepeatedShare * (double) comparedBytes;
+
+    if (channels == 1) {
+        analysis.numColors = countGrayLevels(image);
+    } else {
+        std::optional<vector<uint32_t>> palette = findPalette(image, maxPaletteColors);
+        analysis.numColors = palette.has_value() ? (int) palette->size() : 0;
+    }
+    return analysis;
+}
+
+
+OutputKind chooseOutputKind(const ImageAnalysis& analysis, bool canWritePalettePng) {
+    // A grayscale photo never has more than 256 colours, but without flat areas it's still a photo
+    bool hasFewColors = analysis.numColors > 0 && (analysis.isGraphic || !analysis.isGrayscale);
+    if (!analysis.isGraphic && !hasFewColors) {
+        return analysis.hasAlpha ? OutputKind::WebpLossy : OutputKind::Jpeg;
+    }
+    bool isGrayPng = analysis.isGrayscale && !analysis.hasAlpha;
+    if (hasFewColors && (canWritePalettePng || isGrayPng)) {
+        return OutputKind::Png;
+    }
+    return OutputKind::WebpLossless;
+}
+
+
+string getOutputKindExtension(OutputKind kind) {
+    switch (kind) {
+        case OutputKind::Jpeg:
+            return ".jpg";
+        case OutputKind::WebpLossy:
+        case OutputKind::WebpLossless:
+            return ".webp";
+        case OutputKind::Png:
+            return ".png";
+    }
+    return ".jpg";
+}
+
+
+Mat reduceChannels(const Mat& image, const ImageAnalysis& analysis) {
+    Mat reduced;
+    if (analysis.isGrayscale && !analysis.hasAlpha && image.channels() > 1) {
+        cv::cvtColor(image, reduced, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        return reduced;
+    }
+    if (image.channels() == 4 && !analysis.hasAlpha) {
+        cv::cvtColor(image, reduced, cv::COLOR_BGRA2BGR);
+        return reduced;
+    }
+    return image;
+}
+
+
+std::optional<vector<uint32_t>> findPalette(const Mat& image, int maxColors, Mat* indices) {
+    int channels = image.channels();
+    bool hasIndices = indices != nullptr;
+    if (image.depth() != CV_8U || (channels != 3 && channels != 4) || maxColors < 1 || (hasIndices && maxColors > 256)) {
+        return std::nullopt;
+    }
+    if (hasIndices) {
+        indices->create(image.rows, image.cols, CV_8U);
+    }
+
+    // Open addressing, at most a quarter full so lookups rarely probe more than one slot
+    size_t numSlots = std::bit_ceil((size_t) maxColors * 4);
+    int hashShift = 32 - std::countr_zero(numSlots);
+    vector<uint32_t> slots(numSlots);
+    vector<uchar> isUsed(numSlots);
+    vector<uchar> slotIndices(hasIndices ? numSlots : 0);
+    vector<uint32_t> palette;
+    for (int y = 0; y < image.rows; ++y) {
+        const uchar* row = image.ptr<uchar>(y);
+        uchar* indexRow = hasIndices ? indices->ptr<uchar>(y) : nullptr;
+        uint32_t previous = 0;
+        size_t slot = 0;
+        for (int x = 0; x < image.cols; ++x) {
+            const uchar* pixel = row + x * channels;
+            uint32_t alpha = channels == 4 ? pixel[3] : 255;
+            uint32_t color = alpha << 24 | (uint32_t) pixel[2] << 16 | (uint32_t) pixel[1] << 8 | pixel[0];
+            // Runs of one colour are the common case in images with few of them
+            if (x == 0 || color != previous) {
+                previous = color;
+                slot = (color * 0x9E3779B1u) >> hashShift;
+                while (isUsed[slot] && slots[slot] != color) {
+                    slot = (slot + 1) & (numSlots - 1);
+                }
+                if (!isUsed[slot]) {
+                    if ((int) palette.size() == maxColors) {
+                        return std::nullopt;
+                    }
+                    isUsed[slot] = true;
+                    slots[slot] = color;
+                    if (hasIndices) {
+                        slotIndices[slot] = (uchar) palette.size();
+                    }
+                    palette.push_back(color);
+                }
+            }
+            if (hasIndices) {
+                indexRow[x] = slotIndices[slot];
+            }
+        }
+    }
+    return palette;
+}
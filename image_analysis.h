@@ -0,0 +1,47 @@
+#ifndef IMAGE_DOWNSCALER_IMAGE_ANALYSIS_H
+#define IMAGE_DOWNSCALER_IMAGE_ANALYSIS_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "cpu_features.h"
+
+
+constexpr int maxPaletteColors = 256;
+
+
+// What the pixels of an 8-bit image actually use, found with a few SIMD scans that stop as soon as the answer is clear.
+struct ImageAnalysis {
+    bool hasAlpha = false;  // 4 channels, and at least one pixel isn't fully opaque
+    bool isGrayscale = false;  // B == G == R in every pixel (always for 1 channel)
+    int numColors = 0;  // distinct colours, alpha included, 0 if there are more than maxPaletteColors
+    bool isGraphic = false;  // large flat areas, most pixels repeat their left neighbour: screenshots, drawings, text
+};
+
+
+enum class OutputKind {
+    Jpeg,
+    WebpLossy,
+    WebpLossless,
+    Png  // with a palette for colour images
+};
+
+
+ImageAnalysis analyzeImage(const cv::Mat& image, SimdLevel simdLevel = detectSimdLevel());
+// What --format auto writes: photos as JPEG (lossy WebP if they're transparent), graphics and images with few colours
+// losslessly, as PNG if it's grayscale or this build can write palette PNGs, as lossless WebP otherwise
+OutputKind chooseOutputKind(const ImageAnalysis& analysis, bool canWritePalettePng);
+std::string getOutputKindExtension(OutputKind kind);
+// The image in the fewest channels that keep what it shows: gray if it's grayscale (and opaque), without the alpha
+// channel if every pixel is opaque. The image itself if it's already there.
+cv::Mat reduceChannels(const cv::Mat& image, const ImageAnalysis& analysis);
+// Distinct colours of an 8-bit 3 or 4 channel image as 0xAARRGGBB (alpha 255 without an alpha channel), in the order they
+// first appear. Nothing if there are more than maxColors, the scan stops at the first one too many. With indices (and
+// maxColors at most 256), it also receives every pixel's position in the palette as a CV_8U image, from the same
+// hash table lookups.
+std::optional<std::vector<uint32_t>> findPalette(const cv::Mat& image, int maxColors, cv::Mat* indices = nullptr);
+
+
+#endif //IMAGE_DOWNSCALER_IMAGE_ANALYSIS_H
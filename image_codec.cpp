@@ -0,0 +1,135 @@
+#include "image_codec.h"
+
+
+using std::string;
+using std::vector;
+
+
+namespace {
+    class OpenCvEncoder : public ImageEncoder {
+    public:
+        string getName() const override {
+            return "opencv";
+        }
+
+        bool canEncode(const string&, const cv::Mat&) const override {
+            return true;
+        }
+
+        bool encode(const string& fileExtension, const cv::Mat& image, const vector<int>& compressionParams,
+                    vector<uchar>& encodedImage) const override {
+            return cv::imencode(fileExtension, image, encodedImage, compressionParams);
+        }
+    };
+}
+
+
+const vector<const ImageEncoder*>& getImageEncoders() {
+    static const OpenCvEncoder openCvEncoder;
+    static const vector<const ImageEncoder*> encoders = [] {
+        vector<const ImageEncoder*> result = {&openCvEncoder};
+#ifdef IMAGE_DOWNSCALER_WITH_TURBOJPEG
+        result.push_back(getTurboJpegEncoder());
+#endif
+#ifdef IMAGE_DOWNSCALER_WITH_LIBWEBP
+        result.push_back(getWebpEncoder());
+#endif
+#ifdef IMAGE_DOWNSCALER_WITH_LIBPNG
+        result.push_back(getPngEncoder());
+#endif
+        return result;
+    }();
+    return encoders;
+}
+
+
+const ImageEncoder& selectImageEncoder(EncoderBackend backend, const string& fileExtension, const cv::Mat& image) {
+    const vector<const ImageEncoder*>& encoders = getImageEncoders();
+    if (backend == EncoderBackend::Native) {
+        for (size_t i = 1; i < encoders.size(); ++i) {
+            if (encoders[i]->canEncode(fileExtension, image)) {
+                return *encoders[i];
+            }
+        }
+    }
+    // Also what native falls back to, for formats, bit depths or channel counts no native encoder handles
+    return *encoders[0];
+}
+
+
+std::optional<EncoderBackend> parseEncoderBackend(const string& name) {
+    if (name == "opencv") {
+        return EncoderBackend::OpenCV;
+    }
+    if (name == "native") {
+        return EncoderBackend::Native;
+    }
+    return std::nullopt;
+}
+
+
+string getEncoderBackendName(EncoderBackend backend) {
+    return backend == EncoderBackend::Native ? "native" : "opencv";
+}
+
+
+bool canEncodePalettePng([[maybe_unused]] EncoderBackend backend) {
+#ifdef IMAGE_DOWNSCALER_WITH_LIBPNG
+    return backend == EncoderBackend::Native;
+#else
+    return false;
+#endif
+}
+
+
+std::unique_ptr<RowDecoder> openRowDecoder(const unsigned char* data, size_t size, [[maybe_unused]] int reduction) {
+    std::optional<ImageHeader> header = probeImageHeader(data, size);
+    if (!header.has_value()) {
+        return nullptr;
+    }
+#ifdef IMAGE_DOWNSCALER_WITH_LIBJPEG
+    if (header->format == ImageFormat::Jpeg) {
+        return openJpegRowDecoder(data, size, reduction);
+    }
+#endif
+#ifdef IMAGE_DOWNSCALER_WITH_LIBPNG
+    if (header->format == ImageFormat::Png) {
+        return openPngRowDecoder(data, size);
+    }
+#endif
+    return nullptr;
+}
+
+
+bool canDecodeRows([[maybe_unused]] ImageFormat format) {
+#ifdef IMAGE_DOWNSCALER_WITH_LIBJPEG
+    if (format == ImageFormat::Jpeg) {
+        return true;
+    }
+#endif
+#ifdef IMAGE_DOWNSCALER_WITH_LIBPNG
+    if (format == ImageFormat::Png) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+
+int getCompressionParam(const vector<int>& compressionParams, int flag, int defaultValue) {
+    for (size_t i = 0; i + 1 < compressionParams.size(); i += 2) {
+        if (compressionParams[i] == flag) {
+            return compressionParams[i + 1];
+        }
+    }
+    return defaultValue;
+}
+
+
+void setCompressionParam(vector<int>& compressionParams, int flag, int value) {
+    for (size_t i = 0; i + 1 < compressionParams.size(); i += 2) {
+        if (compressionParams[i] == flag) {
+            compressionParams[i + 1] = value;
+        }
+    }
+}
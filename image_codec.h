@@ -0,0 +1,76 @@
+#ifndef IMAGE_DOWNSCALER_IMAGE_CODEC_H
+#define IMAGE_DOWNSCALER_IMAGE_CODEC_H
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "image_probe.h"
+
+
+// Turns a Mat into the bytes of an image file. compressionParams are OpenCV's IMWRITE_* (flag, value) pairs for every
+// backend, so the settings, the quality search and the benchmarks don't care which one encodes; a backend maps the
+// flags it understands and ignores the rest.
+class ImageEncoder {
+public:
+    virtual ~ImageEncoder() = default;
+
+    virtual std::string getName() const = 0;
+    // fileExtension is lower case, including the dot
+    virtual bool canEncode(const std::string& fileExtension, const cv::Mat& image) const = 0;
+    // Replaces the contents of encodedImage (its capacity is reused)
+    virtual bool encode(const std::string& fileExtension, const cv::Mat& image, const std::vector<int>& compressionParams,
+                        std::vector<uchar>& encodedImage) const = 0;
+};
+
+
+// Decodes an image from the top down one row at a time, to 8-bit BGR, BGRA if it has an alpha channel, or gray for
+// gray PNGs, the way cv::imdecode would. For images too large to decode into one Mat: the rows go straight into a
+// Resampler, so only its window of rows is ever in memory.
+class RowDecoder {
+public:
+    virtual ~RowDecoder() = default;
+
+    virtual int getWidth() const = 0;
+    virtual int getHeight() const = 0;
+    virtual int getChannels() const { return 3; }
+    // Fills row with getWidth() * getChannels() bytes, false if the image data is corrupt
+    virtual bool readRow(uchar* row) = 0;
+};
+
+
+enum class EncoderBackend {
+    OpenCV,  // cv::imencode for every format
+    Native  // the library of the format directly (TurboJPEG, libwebp, libpng) when it's built in, OpenCV otherwise
+};
+
+
+// OpenCV first, then the native encoders this build includes
+const std::vector<const ImageEncoder*>& getImageEncoders();
+const ImageEncoder& selectImageEncoder(EncoderBackend backend, const std::string& fileExtension, const cv::Mat& image);
+std::optional<EncoderBackend> parseEncoderBackend(const std::string& name);
+std::string getEncoderBackendName(EncoderBackend backend);
+// Whether PNGs with few colours are written with a palette, only the libpng encoder does that
+bool canEncodePalettePng(EncoderBackend backend);
+// Row decoder for the JPEG or PNG file in data (which has to outlive it). JPEGs are decoded `reduction` (1, 2, 4 or 8)
+// times smaller. nullptr if this build has no row decoder for the format, or the file can't be decoded row by row
+// (progressive or CMYK JPEGs, interlaced PNGs) and has to go through cv::imdecode.
+std::unique_ptr<RowDecoder> openRowDecoder(const unsigned char* data, size_t size, int reduction);
+// Whether this build has a row decoder for the format at all
+bool canDecodeRows(ImageFormat format);
+// Value of the first `flag` in the (flag, value) pairs, defaultValue if it isn't there
+int getCompressionParam(const std::vector<int>& compressionParams, int flag, int defaultValue);
+// Changes the value of every `flag` in the pairs, does nothing if it isn't there
+void setCompressionParam(std::vector<int>& compressionParams, int flag, int value);
+
+// Only defined when built with the matching IMAGE_DOWNSCALER_WITH_* CMake option
+const ImageEncoder* getTurboJpegEncoder();
+const ImageEncoder* getWebpEncoder();
+const ImageEncoder* getPngEncoder();
+std::unique_ptr<RowDecoder> openJpegRowDecoder(const unsigned char* data, size_t size, int reduction);
+std::unique_ptr<RowDecoder> openPngRowDecoder(const unsigned char* data, size_t size);
+
+
+#endif //IMAGE_DOWNSCALER_IMAGE_CODEC_H
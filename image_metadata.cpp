@@ -0,0 +1,564 @@
+#include "image_metadata.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <zlib.h>
+
+
+using std::string;
+using std::vector;
+
+
+namespace {
+    const unsigned char exifPrefix[] = {'E', 'x', 'i', 'f', 0, 0};
+    const char xmpNamespace[] = "http://ns.adobe.com/xap/1.0/";  // the terminating 0 is part of the APP1 header
+    const char iccSignature[] = "ICC_PROFILE";  // followed by 0, the chunk number and the number of chunks
+    const char pngXmpKeyword[] = "XML:com.adobe.xmp";
+    const char pngIccProfileName[] = "ICC Profile";
+    const unsigned char pngSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    const size_t maxJpegSegmentPayload = 65533;  // the 16-bit segment length also counts itself
+    const size_t iccChunkHeaderSize = sizeof(iccSignature) + 2;
+    const size_t maxInflatedSize = 64 * 1024 * 1024;  // a corrupt or hostile zlib stream can't take all the memory
+    const unsigned char webpIccFlag = 0x20;
+    const unsigned char webpAlphaFlag = 0x10;
+    const unsigned char webpExifFlag = 0x08;
+    const unsigned char webpXmpFlag = 0x04;
+
+
+    unsigned int readUInt16BE(const unsigned char* p) {
+        return (p[0] << 8) | p[1];
+    }
+
+
+    unsigned int readUInt16LE(const unsigned char* p) {
+        return p[0] | (p[1] << 8);
+    }
+
+
+    unsigned int readUInt24LE(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+
+
+    unsigned int readUInt32BE(const unsigned char* p) {
+        return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+
+    unsigned int readUInt32LE(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+    }
+
+
+    void appendUInt16BE(vector<unsigned char>& out, unsigned int value) {
+        out.push_back((unsigned char) (value >> 8));
+        out.push_back((unsigned char) value);
+    }
+
+
+    void appendUInt24LE(vector<unsigned char>& out, unsigned int value) {
+        out.push_back((unsigned char) value);
+        out.push_back((unsigned char) (value >> 8));
+        out.push_back((unsigned char) (value >> 16));
+    }
+
+
+    void appendUInt32BE(vector<unsigned char>& out, unsigned int value) {
+        appendUInt16BE(out, value >> 16);
+        appendUInt16BE(out, value & 0xFFFF);
+    }
+
+
+    void appendUInt32LE(vector<unsigned char>& out, unsigned int value) {
+        appendUInt24LE(out, value);
+        out.push_back((unsigned char) (value >> 24));
+    }
+
+
+    void appendBytes(vector<unsigned char>& out, const void* data, size_t size) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+
+    bool startsWith(const unsigned char* data, size_t size, const void* prefix, size_t prefixSize) {
+        return size >= prefixSize && std::memcmp(data, prefix, prefixSize) == 0;
+    }
+
+
+    // PNG and WebP store the bare TIFF structure, but some writers copy JPEG's "Exif\0\0" along
+    vector<unsigned char> readExif(const unsigned char* data, size_t size) {
+        if (startsWith(data, size, exifPrefix, sizeof(exifPrefix))) {
+            return vector<unsigned char>(data + sizeof(exifPrefix), data + size);
+        }
+        return vector<unsigned char>(data, data + size);
+    }
+
+
+    bool inflateData(const unsigned char* data, size_t size, vector<unsigned char>& output) {
+        z_stream stream{};
+        if (inflateInit(&stream) != Z_OK) {
+            return false;
+        }
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.avail_in = (uInt) size;
+
+        output.clear();
+        unsigned char buffer[16384];
+        int result = Z_OK;
+        while (result == Z_OK) {
+            stream.next_out = buffer;
+            stream.avail_out = sizeof(buffer);
+            result = inflate(&stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END) {
+                break;
+            }
+            output.insert(output.end(), buffer, buffer + (sizeof(buffer) - stream.avail_out));
+            if (output.size() > maxInflatedSize) {
+                result = Z_MEM_ERROR;
+            }
+        }
+        inflateEnd(&stream);
+        return result == Z_STREAM_END;
+    }
+
+
+    void readJpegMetadata(const unsigned char* data, size_t size, ImageMetadata& metadata) {
+        std::map<int, std::pair<const unsigned char*, size_t>> iccChunks;  // by chunk number, 1-based
+        int iccChunkCount = 0;
+        size_t pos = 2;  // skip SOI
+        while (pos + 4 <= size) {
+            if (data[pos] != 0xFF) {
+                break;
+            }
+            unsigned char marker = data[pos + 1];
+            if (marker == 0xFF) {
+                pos++;
+                continue;
+            }
+            if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+                pos += 2;
+                continue;
+            }
+            if (marker == 0xDA || marker == 0xD9) {
+                // All the metadata comes before the first scan
+                break;
+            }
+
+            size_t segmentLength = readUInt16BE(data + pos + 2);
+            if (segmentLength < 2 || pos + 2 + segmentLength > size) {
+                break;
+            }
+            const unsigned char* payload = data + pos + 4;
+            size_t payloadSize = segmentLength - 2;
+            if (marker == 0xE1 && metadata.exif.empty() && startsWith(payload, payloadSize, exifPrefix, sizeof(exifPrefix))) {
+                metadata.exif.assign(payload + sizeof(exifPrefix), payload + payloadSize);
+            } else if (marker == 0xE1 && metadata.xmp.empty() && startsWith(payload, payloadSize, xmpNamespace, sizeof(xmpNamespace))) {
+                metadata.xmp.assign(payload + sizeof(xmpNamespace), payload + payloadSize);
+            } else if (marker == 0xE2 && payloadSize > iccChunkHeaderSize && startsWith(payload, payloadSize, iccSignature, sizeof(iccSignature))) {
+                iccChunks.emplace(payload[sizeof(iccSignature)], std::make_pair(payload + iccChunkHeaderSize, payloadSize - iccChunkHeaderSize));
+                iccChunkCount = payload[sizeof(iccSignature) + 1];
+            }
+            pos += 2 + segmentLength;
+        }
+
+        // A profile with a missing chunk is useless, also the last ones of a truncated file
+        if ((int) iccChunks.size() != iccChunkCount) {
+            return;
+        }
+        int expectedChunk = 1;
+        for (const auto& [chunkNumber, chunk] : iccChunks) {
+            if (chunkNumber != expectedChunk++) {
+                metadata.icc.clear();
+                return;
+            }
+            appendBytes(metadata.icc, chunk.first, chunk.second);
+        }
+    }
+
+
+    void readPngXmp(const unsigned char* chunk, size_t length, vector<unsigned char>& xmp) {
+        // keyword, 0, compression flag, compression method, language tag, 0, translated keyword, 0, text
+        if (length < sizeof(pngXmpKeyword) + 2 || std::memcmp(chunk, pngXmpKeyword, sizeof(pngXmpKeyword)) != 0) {
+            return;
+        }
+        size_t pos = sizeof(pngXmpKeyword);
+        bool compressed = chunk[pos] != 0;
+        pos += 2;
+        for (int i = 0; i < 2; ++i) {
+            const void* end = std::memchr(chunk + pos, 0, length - pos);
+            if (end == nullptr) {
+                return;
+            }
+            pos = static_cast<const unsigned char*>(end) - chunk + 1;
+        }
+        if (!compressed) {
+            xmp.assign(chunk + pos, chunk + length);
+        } else if (!inflateData(chunk + pos, length - pos, xmp)) {
+            xmp.clear();
+        }
+    }
+
+
+    void readPngMetadata(const unsigned char* data, size_t size, ImageMetadata& metadata) {
+        size_t pos = sizeof(pngSignature);
+        while (pos + 12 <= size) {
+            // length | type | data | CRC
+            size_t length = readUInt32BE(data + pos);
+            const unsigned char* type = data + pos + 4;
+            const unsigned char* chunk = data + pos + 8;
+            if (length > size - pos - 12 || std::memcmp(type, "IEND", 4) == 0) {
+                break;
+            }
+
+            if (std::memcmp(type, "eXIf", 4) == 0 && metadata.exif.empty()) {
+                metadata.exif = readExif(chunk, length);
+            } else if (std::memcmp(type, "iCCP", 4) == 0 && metadata.icc.empty()) {
+                // profile name, 0, compression method (always 0 = zlib), compressed profile
+                const void* nameEnd = std::memchr(chunk, 0, length);
+                size_t profileStart = nameEnd != nullptr ? static_cast<const unsigned char*>(nameEnd) - chunk + 2 : length;
+                if (profileStart < length && !inflateData(chunk + profileStart, length - profileStart, metadata.icc)) {
+                    metadata.icc.clear();
+                }
+            } else if (std::memcmp(type, "iTXt", 4) == 0 && metadata.xmp.empty()) {
+                readPngXmp(chunk, length, metadata.xmp);
+            }
+            pos += 12 + length;
+        }
+    }
+
+
+    void readWebpMetadata(const unsigned char* data, size_t size, ImageMetadata& metadata) {
+        size_t pos = 12;  // "RIFF" | size | "WEBP"
+        while (pos + 8 <= size) {
+            // fourcc | size | data, padded to an even size
+            size_t chunkSize = readUInt32LE(data + pos + 4);
+            if (chunkSize > size - pos - 8) {
+                break;
+            }
+            const unsigned char* chunk = data + pos + 8;
+            if (std::memcmp(data + pos, "EXIF", 4) == 0) {
+                metadata.exif = readExif(chunk, chunkSize);
+            } else if (std::memcmp(data + pos, "ICCP", 4) == 0) {
+                metadata.icc.assign(chunk, chunk + chunkSize);
+            } else if (std::memcmp(data + pos, "XMP ", 4) == 0) {
+                metadata.xmp.assign(chunk, chunk + chunkSize);
+            }
+            pos += 8 + chunkSize + (chunkSize & 1);
+        }
+    }
+
+
+    void appendJpegSegment(vector<unsigned char>& out, unsigned char marker, const void* header, size_t headerSize,
+                           const unsigned char* data, size_t size) {
+        out.push_back(0xFF);
+        out.push_back(marker);
+        appendUInt16BE(out, (unsigned int) (2 + headerSize + size));
+        appendBytes(out, header, headerSize);
+        appendBytes(out, data, size);
+    }
+
+
+    bool writeJpegMetadata(const vector<unsigned char>& encodedImage, const ImageMetadata& metadata, vector<unsigned char>& output) {
+        // Right after SOI, or after the JFIF APP0 segment, which has to come first
+        size_t insertPos = 2;
+        if (encodedImage.size() >= 6 && encodedImage[2] == 0xFF && encodedImage[3] == 0xE0) {
+            insertPos += 2 + readUInt16BE(&encodedImage[4]);
+        }
+        if (insertPos > encodedImage.size()) {
+            return false;
+        }
+
+        output.clear();
+        output.reserve(encodedImage.size() + metadata.size() + 1024);
+        output.insert(output.end(), encodedImage.begin(), encodedImage.begin() + (ptrdiff_t) insertPos);
+        // EXIF and XMP have to fit in one segment, what doesn't is dropped
+        if (!metadata.exif.empty() && sizeof(exifPrefix) + metadata.exif.size() <= maxJpegSegmentPayload) {
+            appendJpegSegment(output, 0xE1, exifPrefix, sizeof(exifPrefix), metadata.exif.data(), metadata.exif.size());
+        }
+        if (!metadata.xmp.empty() && sizeof(xmpNamespace) + metadata.xmp.size() <= maxJpegSegmentPayload) {
+            appendJpegSegment(output, 0xE1, xmpNamespace, sizeof(xmpNamespace), metadata.xmp.data(), metadata.xmp.size());
+        }
+        if (!metadata.icc.empty()) {
+            size_t chunkCapacity = maxJpegSegmentPayload - iccChunkHeaderSize;
+            size_t chunkCount = (metadata.icc.size() + chunkCapacity - 1) / chunkCapacity;
+            for (size_t i = 0; i < chunkCount && chunkCount <= 255; ++i) {
+                unsigned char header[iccChunkHeaderSize];
+                std::memcpy(header, iccSignature, sizeof(iccSignature));
+                header[sizeof(iccSignature)] = (unsigned char) (i + 1);
+                header[sizeof(iccSignature) + 1] = (unsigned char) chunkCount;
+                size_t offset = i * chunkCapacity;
+                size_t chunkSize = std::min(chunkCapacity, metadata.icc.size() - offset);
+                appendJpegSegment(output, 0xE2, header, sizeof(header), metadata.icc.data() + offset, chunkSize);
+            }
+        }
+        output.insert(output.end(), encodedImage.begin() + (ptrdiff_t) insertPos, encodedImage.end());
+        return true;
+    }
+
+
+    void appendPngChunk(vector<unsigned char>& out, const char* type, const void* header, size_t headerSize,
+                        const unsigned char* data, size_t size) {
+        appendUInt32BE(out, (unsigned int) (headerSize + size));
+        size_t typePos = out.size();
+        appendBytes(out, type, 4);
+        appendBytes(out, header, headerSize);
+        appendBytes(out, data, size);
+        uLong crc = crc32(0, out.data() + typePos, (uInt) (out.size() - typePos));
+        appendUInt32BE(out, (unsigned int) crc);
+    }
+
+
+    bool writePngMetadata(const vector<unsigned char>& encodedImage, const ImageMetadata& metadata, vector<unsigned char>& output) {
+        if (encodedImage.size() < 33 || std::memcmp(encodedImage.data() + 12, "IHDR", 4) != 0) {
+            return false;
+        }
+        // Right after IHDR, iCCP has to come before PLTE and IDAT
+        size_t insertPos = sizeof(pngSignature) + 12 + readUInt32BE(encodedImage.data() + 8);
+        if (insertPos > encodedImage.size()) {
+            return false;
+        }
+
+        output.clear();
+        output.reserve(encodedImage.size() + metadata.size() + 1024);
+        output.insert(output.end(), encodedImage.begin(), encodedImage.begin() + (ptrdiff_t) insertPos);
+        if (!metadata.icc.empty()) {
+            vector<unsigned char> compressedProfile(compressBound((uLong) metadata.icc.size()));
+            uLongf compressedSize = (uLongf) compressedProfile.size();
+            if (compress2(compressedProfile.data(), &compressedSize, metadata.icc.data(), (uLong) metadata.icc.size(), Z_BEST_COMPRESSION) == Z_OK) {
+                // profile name, 0, compression method 0
+                unsigned char header[sizeof(pngIccProfileName) + 1] = {};
+                std::memcpy(header, pngIccProfileName, sizeof(pngIccProfileName));
+                appendPngChunk(output, "iCCP", header, sizeof(header), compressedProfile.data(), compressedSize);
+            }
+        }
+        if (!metadata.exif.empty()) {
+            appendPngChunk(output, "eXIf", nullptr, 0, metadata.exif.data(), metadata.exif.size());
+        }
+        if (!metadata.xmp.empty()) {
+            // keyword, 0, not compressed, compression method, empty language tag, empty translated keyword
+            unsigned char header[sizeof(pngXmpKeyword) + 4] = {};
+            std::memcpy(header, pngXmpKeyword, sizeof(pngXmpKeyword));
+            appendPngChunk(output, "iTXt", header, sizeof(header), metadata.xmp.data(), metadata.xmp.size());
+        }
+        output.insert(output.end(), encodedImage.begin() + (ptrdiff_t) insertPos, encodedImage.end());
+        return true;
+    }
+
+
+    void appendWebpChunk(vector<unsigned char>& out, const char* fourcc, const unsigned char* data, size_t size) {
+        appendBytes(out, fourcc, 4);
+        appendUInt32LE(out, (unsigned int) size);
+        appendBytes(out, data, size);
+        if (size & 1) {
+            out.push_back(0);
+        }
+    }
+
+
+    bool writeWebpMetadata(const vector<unsigned char>& encodedImage, const ImageMetadata& metadata, vector<unsigned char>& output) {
+        const unsigned char* data = encodedImage.data();
+        size_t size = encodedImage.size();
+        if (size < 20) {
+            return false;
+        }
+
+        // Metadata needs the extended format, its VP8X header repeats the canvas size of the image chunk
+        const unsigned char* firstChunk = data + 12;
+        const unsigned char* payload = firstChunk + 8;
+        size_t payloadSize = std::min<size_t>(readUInt32LE(firstChunk + 4), size - 20);
+        unsigned char flags = 0;
+        unsigned int width = 0, height = 0;
+        if (std::memcmp(firstChunk, "VP8X", 4) == 0 && payloadSize >= 10) {
+            flags = payload[0];
+            width = readUInt24LE(payload + 4) + 1;
+            height = readUInt24LE(payload + 7) + 1;
+        } else if (std::memcmp(firstChunk, "VP8L", 4) == 0 && payloadSize >= 5 && payload[0] == 0x2F) {
+            // 14 bits width - 1, 14 bits height - 1, 1 bit alpha is used
+            unsigned int bits = readUInt32LE(payload + 1);
+            width = (bits & 0x3FFF) + 1;
+            height = ((bits >> 14) & 0x3FFF) + 1;
+            flags = (bits >> 28) & 1 ? webpAlphaFlag : 0;
+        } else if (std::memcmp(firstChunk, "VP8 ", 4) == 0 && payloadSize >= 10 && payload[3] == 0x9D && payload[4] == 0x01 && payload[5] == 0x2A) {
+            width = readUInt16LE(payload + 6) & 0x3FFF;
+            height = readUInt16LE(payload + 8) & 0x3FFF;
+        } else {
+            return false;
+        }
+        flags &= ~(webpIccFlag | webpExifFlag | webpXmpFlag);
+        flags |= (metadata.icc.empty() ? 0 : webpIccFlag) | (metadata.exif.empty() ? 0 : webpExifFlag) | (metadata.xmp.empty() ? 0 : webpXmpFlag);
+
+        output.clear();
+        output.reserve(size + metadata.size() + 64);
+        appendBytes(output, "RIFF\0\0\0\0WEBP", 12);
+        appendBytes(output, "VP8X", 4);
+        appendUInt32LE(output, 10);
+        output.push_back(flags);
+        appendUInt24LE(output, 0);
+        appendUInt24LE(output, width - 1);
+        appendUInt24LE(output, height - 1);
+        if (!metadata.icc.empty()) {
+            appendWebpChunk(output, "ICCP", metadata.icc.data(), metadata.icc.size());
+        }
+
+        // The image chunks (ALPH, VP8, VP8L, animation frames) keep their order, old metadata chunks are replaced
+        size_t pos = 12;
+        while (pos + 8 <= size) {
+            size_t chunkSize = readUInt32LE(data + pos + 4);
+            size_t paddedSize = 8 + chunkSize + (chunkSize & 1);
+            if (chunkSize > size - pos - 8) {
+                return false;
+            }
+            const unsigned char* chunk = data + pos;
+            bool isReplaced = std::memcmp(chunk, "VP8X", 4) == 0 || std::memcmp(chunk, "ICCP", 4) == 0 ||
+                              std::memcmp(chunk, "EXIF", 4) == 0 || std::memcmp(chunk, "XMP ", 4) == 0;
+            if (!isReplaced) {
+                appendBytes(output, chunk, std::min(paddedSize, size - pos));
+            }
+            pos += paddedSize;
+        }
+
+        if (!metadata.exif.empty()) {
+            appendWebpChunk(output, "EXIF", metadata.exif.data(), metadata.exif.size());
+        }
+        if (!metadata.xmp.empty()) {
+            appendWebpChunk(output, "XMP ", metadata.xmp.data(), metadata.xmp.size());
+        }
+        unsigned int riffSize = (unsigned int) (output.size() - 8);
+        for (int i = 0; i < 4; ++i) {
+            output[4 + i] = (unsigned char) (riffSize >> (8 * i));
+        }
+        return true;
+    }
+
+
+    // Offset of the orientation value in IFD0, 0 if there is none. nextIfdPos is where IFD0 links to IFD1.
+    size_t findExifOrientation(const vector<unsigned char>& exif, bool& bigEndian, size_t& nextIfdPos) {
+        if (exif.size() < 8 || exif[0] != exif[1] || (exif[0] != 'I' && exif[0] != 'M')) {
+            return 0;
+        }
+        bigEndian = exif[0] == 'M';
+        auto read16 = [&](size_t p) { return bigEndian ? readUInt16BE(&exif[p]) : readUInt16LE(&exif[p]); };
+        auto read32 = [&](size_t p) { return bigEndian ? readUInt32BE(&exif[p]) : readUInt32LE(&exif[p]); };
+
+        size_t ifdOffset = read32(4);
+        if (ifdOffset + 2 > exif.size()) {
+            return 0;
+        }
+        unsigned int entryCount = read16(ifdOffset);
+        nextIfdPos = ifdOffset + 2 + (size_t) entryCount * 12;
+        for (unsigned int i = 0; i < entryCount; ++i) {
+            // tag | type | count | value, a single SHORT sits in the first two bytes of the value
+            size_t entry = ifdOffset + 2 + i * 12;
+            if (entry + 12 > exif.size()) {
+                break;
+            }
+            if (read16(entry) == 0x0112 && read16(entry + 2) == 3) {
+                return entry + 8;
+            }
+        }
+        return 0;
+    }
+}
+
+
+ImageMetadata readImageMetadata(const unsigned char* data, size_t size) {
+    ImageMetadata metadata;
+    if (size >= 4 && data[0] == 0xFF && data[1] == 0xD8) {
+        readJpegMetadata(data, size, metadata);
+    } else if (startsWith(data, size, pngSignature, sizeof(pngSignature))) {
+        readPngMetadata(data, size, metadata);
+    } else if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        readWebpMetadata(data, size, metadata);
+    }
+    return metadata;
+}
+
+
+void limitImageMetadata(ImageMetadata& metadata, MetadataPolicy policy, size_t maxBytes) {
+    if (policy != MetadataPolicy::Keep) {
+        metadata.exif = {};
+        metadata.xmp = {};
+    }
+    if (policy == MetadataPolicy::Strip) {
+        metadata.icc = {};
+    }
+    if (maxBytes > 0) {
+        for (vector<unsigned char>* part : {&metadata.exif, &metadata.icc, &metadata.xmp}) {
+            if (part->size() > maxBytes) {
+                *part = {};
+            }
+        }
+    }
+}
+
+
+bool writeImageMetadata(const vector<unsigned char>& encodedImage, const ImageMetadata& metadata, vector<unsigned char>& output) {
+    const unsigned char* data = encodedImage.data();
+    size_t size = encodedImage.size();
+    if (size >= 4 && data[0] == 0xFF && data[1] == 0xD8) {
+        return writeJpegMetadata(encodedImage, metadata, output);
+    }
+    if (startsWith(data, size, pngSignature, sizeof(pngSignature))) {
+        return writePngMetadata(encodedImage, metadata, output);
+    }
+    if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        return writeWebpMetadata(encodedImage, metadata, output);
+    }
+    return false;
+}
+
+
+int getExifOrientation(const vector<unsigned char>& exif) {
+    bool bigEndian = false;
+    size_t nextIfdPos = 0;
+    size_t offset = findExifOrientation(exif, bigEndian, nextIfdPos);
+    if (offset == 0) {
+        return 1;
+    }
+    unsigned int orientation = bigEndian ? readUInt16BE(&exif[offset]) : readUInt16LE(&exif[offset]);
+    return orientation >= 1 && orientation <= 8 ? (int) orientation : 1;
+}
+
+
+void setExifOrientation(vector<unsigned char>& exif, int orientation) {
+    bool bigEndian = false;
+    size_t nextIfdPos = 0;
+    size_t offset = findExifOrientation(exif, bigEndian, nextIfdPos);
+    if (offset == 0) {
+        return;
+    }
+    exif[offset + (bigEndian ? 0 : 1)] = 0;
+    exif[offset + (bigEndian ? 1 : 0)] = (unsigned char) orientation;
+    // IFD1 holds the thumbnail, which would still be in the old orientation. Unlinking it is enough, its bytes stay
+    // but nothing points at them anymore.
+    if (nextIfdPos + 4 <= exif.size()) {
+        std::fill_n(exif.begin() + (ptrdiff_t) nextIfdPos, 4, 0);
+    }
+}
+
+
+std::optional<MetadataPolicy> parseMetadataPolicy(const string& name) {
+    if (name == "keep") {
+        return MetadataPolicy::Keep;
+    }
+    if (name == "icc") {
+        return MetadataPolicy::ColorProfile;
+    }
+    if (name == "strip") {
+        return MetadataPolicy::Strip;
+    }
+    return std::nullopt;
+}
+
+
+string getMetadataPolicyName(MetadataPolicy policy) {
+    switch (policy) {
+        case MetadataPolicy::ColorProfile:
+            return "icc";
+        case MetadataPolicy::Strip:
+            return "strip";
+        default:
+            return "keep";
+    }
+}
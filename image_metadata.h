@@ -0,0 +1,47 @@
+#ifndef IMAGE_DOWNSCALER_IMAGE_METADATA_H
+#define IMAGE_DOWNSCALER_IMAGE_METADATA_H
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+// The metadata worth carrying over to the rewritten image, in a format-neutral form, so it also survives a conversion
+struct ImageMetadata {
+    std::vector<unsigned char> exif;  // TIFF structure ("II*\0" / "MM\0*"), without JPEG's "Exif\0\0" prefix
+    std::vector<unsigned char> icc;  // ICC colour profile, uncompressed
+    std::vector<unsigned char> xmp;  // XMP packet
+
+    bool empty() const { return exif.empty() && icc.empty() && xmp.empty(); }
+    size_t size() const { return exif.size() + icc.size() + xmp.size(); }
+};
+
+
+enum class MetadataPolicy {
+    Keep,  // EXIF, ICC profile and XMP
+    ColorProfile,  // only the ICC profile, the colours stay right but nothing else is kept
+    Strip  // nothing
+};
+
+
+// Pulls the metadata out of the file bytes of a JPEG (APP1/APP2), PNG (eXIf/iCCP/iTXt) or WebP (EXIF/ICCP/XMP) by
+// walking the segment headers, the image data itself is never touched. Anything malformed is skipped.
+ImageMetadata readImageMetadata(const unsigned char* data, size_t size);
+// Drops what the policy doesn't keep, and every part larger than maxBytes (0 = no limit)
+void limitImageMetadata(ImageMetadata& metadata, MetadataPolicy policy, size_t maxBytes);
+// Copies encodedImage into output with the metadata spliced in where its format expects it, in one pass. Returns false
+// (and leaves output alone) if encodedImage isn't a JPEG, PNG or WebP it can parse.
+bool writeImageMetadata(const std::vector<unsigned char>& encodedImage, const ImageMetadata& metadata,
+                        std::vector<unsigned char>& output);
+
+// EXIF orientation tag, 1-8 (1 = as stored), 1 if there is none
+int getExifOrientation(const std::vector<unsigned char>& exif);
+// Only changes an orientation tag that's already there, and drops the EXIF thumbnail (IFD1) along with it
+void setExifOrientation(std::vector<unsigned char>& exif, int orientation);
+
+std::optional<MetadataPolicy> parseMetadataPolicy(const std::string& name);
+std::string getMetadataPolicyName(MetadataPolicy policy);
+
+
+#endif //IMAGE_DOWNSCALER_IMAGE_METADATA_H
@@ -0,0 +1,173 @@
+#include "image_probe.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+
+namespace {
+    int readUInt16BE(const unsigned char* p) {
+        return (p[0] << 8) | p[1];
+    }
+
+
+    int readUInt16LE(const unsigned char* p) {
+        return p[0] | (p[1] << 8);
+    }
+
+
+    int readUInt24LE(const unsigned char* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+
+
+    unsigned int readUInt32BE(const unsigned char* p) {
+        return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+
+    bool isJpegStartOfFrame(unsigned char marker) {
+        // SOF0-SOF15, except DHT (0xC4), JPG (0xC8) and DAC (0xCC) which share the range
+        return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+    }
+
+
+    std::optional<ImageHeader> probeJpegHeader(const unsigned char* data, size_t size) {
+        size_t pos = 2;  // skip SOI
+        while (pos + 4 <= size) {
+            if (data[pos] != 0xFF) {
+                return std::nullopt;
+            }
+            unsigned char marker = data[pos + 1];
+            if (marker == 0xFF) {
+                // Fill byte
+                pos++;
+                continue;
+            }
+            if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+                // Standalone markers have no length field
+                pos += 2;
+                continue;
+            }
+            if (marker == 0xDA || marker == 0xD9) {
+                // Start of scan/end of image reached without a frame header
+                return std::nullopt;
+            }
+
+            int segmentLength = readUInt16BE(data + pos + 2);
+            if (segmentLength < 2) {
+                return std::nullopt;
+            }
+            if (isJpegStartOfFrame(marker)) {
+                // FF Cn | length(2) | precision(1) | height(2) | width(2)
+                if (pos + 9 > size) {
+                    return std::nullopt;
+                }
+                ImageHeader header;
+                header.format = ImageFormat::Jpeg;
+                header.height = readUInt16BE(data + pos + 5);
+                header.width = readUInt16BE(data + pos + 7);
+                if (header.width == 0 || header.height == 0) {
+                    return std::nullopt;
+                }
+                return header;
+            }
+            pos += 2 + segmentLength;
+        }
+        return std::nullopt;
+    }
+
+
+    std::optional<ImageHeader> probePngHeader(const unsigned char* data, size_t size) {
+        // signature(8) | IHDR length(4) | "IHDR" | width(4) | height(4)
+        if (size < 24 || std::memcmp(data + 12, "IHDR", 4) != 0) {
+            return std::nullopt;
+        }
+        unsigned int width = readUInt32BE(data + 16);
+        unsigned int height = readUInt32BE(data + 20);
+        if (width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX) {
+            return std::nullopt;
+        }
+        return ImageHeader{ImageFormat::Png, (int) width, (int) height};
+    }
+
+
+    std::optional<ImageHeader> probeWebpHeader(const unsigned char* data, size_t size) {
+        // "RIFF" | file size(4) | "WEBP" | chunk FourCC(4) | chunk size(4) | chunk payload
+        if (size < 30) {
+            return std::nullopt;
+        }
+        const unsigned char* chunk = data + 12;
+        const unsigned char* payload = data + 20;
+        ImageHeader header;
+        header.format = ImageFormat::Webp;
+
+        if (std::memcmp(chunk, "VP8 ", 4) == 0) {
+            // Lossy: frame tag(3) | start code 9D 01 2A | 14 bit width | 14 bit height
+            if (payload[3] != 0x9D || payload[4] != 0x01 || payload[5] != 0x2A) {
+                return std::nullopt;
+            }
+            header.width = readUInt16LE(payload + 6) & 0x3FFF;
+            header.height = readUInt16LE(payload + 8) & 0x3FFF;
+        } else if (std::memcmp(chunk, "VP8L", 4) == 0) {
+            // Lossless: signature 0x2F | 14 bit width - 1 | 14 bit height - 1
+            if (payload[0] != 0x2F) {
+                return std::nullopt;
+            }
+            unsigned int bits = payload[1] | (payload[2] << 8) | (payload[3] << 16) | ((unsigned int) payload[4] << 24);
+            header.width = (int) (bits & 0x3FFF) + 1;
+            header.height = (int) ((bits >> 14) & 0x3FFF) + 1;
+        } else if (std::memcmp(chunk, "VP8X", 4) == 0) {
+            // Extended: flags(4) | 24 bit canvas width - 1 | 24 bit canvas height - 1
+            header.width = readUInt24LE(payload + 4) + 1;
+            header.height = readUInt24LE(payload + 7) + 1;
+        } else {
+            return std::nullopt;
+        }
+
+        if (header.width == 0 || header.height == 0) {
+            return std::nullopt;
+        }
+        return header;
+    }
+}
+
+
+std::optional<ImageHeader> probeImageHeader(const unsigned char* data, size_t size) {
+    static const unsigned char pngSignature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        return probeJpegHeader(data, size);
+    }
+    if (size >= 8 && std::memcmp(data, pngSignature, 8) == 0) {
+        return probePngHeader(data, size);
+    }
+    if (size >= 12 && std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        return probeWebpHeader(data, size);
+    }
+    return std::nullopt;
+}
+
+
+std::optional<ImageHeader> probeImageFile(const std::string& filePath) {
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    // PNG and WebP keep the dimensions in the first 30 bytes, but a JPEG frame header comes after the EXIF/ICC
+    // segments which can be up to 64 KB each, so keep reading bigger chunks until the header turns up
+    std::vector<unsigned char> buffer;
+    for (size_t readSize = 16 * 1024; readSize <= 1024 * 1024; readSize *= 4) {
+        size_t alreadyRead = buffer.size();
+        buffer.resize(readSize);
+        file.read(reinterpret_cast<char*>(buffer.data() + alreadyRead), (std::streamsize) (readSize - alreadyRead));
+        buffer.resize(alreadyRead + file.gcount());
+
+        std::optional<ImageHeader> header = probeImageHeader(buffer.data(), buffer.size());
+        if (header.has_value() || !file) {
+            return header;
+        }
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,31 @@
+#ifndef IMAGE_DOWNSCALER_IMAGE_PROBE_H
+#define IMAGE_DOWNSCALER_IMAGE_PROBE_H
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+
+enum class ImageFormat {
+    Unknown,
+    Jpeg,
+    Png,
+    Webp
+};
+
+
+struct ImageHeader {
+    ImageFormat format = ImageFormat::Unknown;
+    int width = 0;
+    int height = 0;
+};
+
+
+// Reads the image dimensions from the header only, without decoding any pixels.
+// Returns std::nullopt if the format isn't recognized or the header is truncated/corrupt.
+std::optional<ImageHeader> probeImageHeader(const unsigned char* data, size_t size);
+// Same as above, but reads only as much of the file as the header needs (usually a few KB).
+std::optional<ImageHeader> probeImageFile(const std::string& filePath);
+
+
+#endif //IMAGE_DOWNSCALER_IMAGE_PROBE_H
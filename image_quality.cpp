@@ -0,0 +1,259 @@
+#include "image_quality.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IMAGE_DOWNSCALER_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define IMAGE_DOWNSCALER_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2/SSE4.1 instructions in functions explicitly marked for them, MSVC always can
+#if defined(IMAGE_DOWNSCALER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+
+using cv::Mat;
+
+
+namespace {
+    // x264's constants for sums over the 64 pixels of a window, instead of means and variances
+    const double C1 = 0.01 * 0.01 * 255 * 255 * 64;
+    const double C2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+
+
+    // Sums over one 4x4 block of the reference (a) and the image (b)
+    struct BlockSums {
+        uint32_t sumA;
+        uint32_t sumB;
+        uint32_t sumSquares;  // a^2 + b^2
+        uint32_t sumProducts;  // a * b
+    };
+
+
+    Mat toLuma(const Mat& image) {
+        Mat gray;
+        if (image.channels() == 3) {
+            cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        } else if (image.channels() == 4) {
+            cv::cvtColor(image, gray, cv::COLOR_BGRA2GRAY);
+        } else {
+            gray = image;
+        }
+        if (gray.depth() == CV_8U) {
+            return gray;
+        }
+        Mat luma;
+        // 16-bit PNGs are brought to the 0-255 range the constants are meant for
+        gray.convertTo(luma, CV_8U, gray.depth() == CV_16U ? 1.0 / 257 : 1.0);
+        return luma;
+    }
+
+
+    // Rows blockRow * 4 to blockRow * 4 + 3 of both images, from block start on
+    void sumBlocksScalar(const uchar* const* rowsA, const uchar* const* rowsB, BlockSums* blocks, int numBlocks, int start = 0) {
+        for (int block = start; block < numBlocks; ++block) {
+            BlockSums sums{};
+            for (int y = 0; y < 4; ++y) {
+                for (int x = block * 4; x < block * 4 + 4; ++x) {
+                    uint32_t a = rowsA[y][x];
+                    uint32_t b = rowsB[y][x];
+                    sums.sumA += a;
+                    sums.sumB += b;
+                    sums.sumSquares += a * a + b * b;
+                    sums.sumProducts += a * b;
+                }
+            }
+            blocks[block] = sums;
+        }
+    }
+
+
+#ifdef IMAGE_DOWNSCALER_X86
+    // ---- SSE4.1 ----
+    // Pixels are widened to 16 bits and multiplied with madd, which also adds neighbouring pairs; one hadd per sum then
+    // leaves the sum of every 4 pixels of a row, added up over the 4 rows of the block.
+
+    TARGET_SSE41 void sumBlocksSse41(const uchar* const* rowsA, const uchar* const* rowsB, BlockSums* blocks, int numBlocks) {
+        const __m128i ones = _mm_set1_epi16(1);
+        int block = 0;
+        for (; block + 2 <= numBlocks; block += 2) {
+            __m128i sumA = _mm_setzero_si128(), sumB = _mm_setzero_si128();
+            __m128i sumSquares = _mm_setzero_si128(), sumProducts = _mm_setzero_si128();
+            for (int y = 0; y < 4; ++y) {
+                __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rowsA[y] + block * 4)));
+                __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rowsB[y] + block * 4)));
+                sumA = _mm_add_epi32(sumA, _mm_madd_epi16(a, ones));
+                sumB = _mm_add_epi32(sumB, _mm_madd_epi16(b, ones));
+                sumSquares = _mm_add_epi32(sumSquares, _mm_add_epi32(_mm_madd_epi16(a, a), _mm_madd_epi16(b, b)));
+                sumProducts = _mm_add_epi32(sumProducts, _mm_madd_epi16(a, b));
+            }
+            // [a0, a1, b0, b1] and [squares0, squares1, products0, products1]
+            alignas(16) uint32_t sums[2][4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(sums[0]), _mm_hadd_epi32(sumA, sumB));
+            _mm_store_si128(reinterpret_cast<__m128i*>(sums[1]), _mm_hadd_epi32(sumSquares, sumProducts));
+            for (int i = 0; i < 2; ++i) {
+                blocks[block + i] = {sums[0][i], sums[0][2 + i], sums[1][i], sums[1][2 + i]};
+            }
+        }
+        sumBlocksScalar(rowsA, rowsB, blocks, numBlocks, block);
+    }
+
+
+    // ---- AVX2 ----
+    // Same as SSE4.1 for 4 blocks at once; hadd works within each 128-bit half, blocks 0-1 end up in the low one
+
+    TARGET_AVX2 void sumBlocksAvx2(const uchar* const* rowsA, const uchar* const* rowsB, BlockSums* blocks, int numBlocks) {
+        const __m256i ones = _mm256_set1_epi16(1);
+        int block = 0;
+        for (; block + 4 <= numBlocks; block += 4) {
+            __m256i sumA = _mm256_setzero_si256(), sumB = _mm256_setzero_si256();
+            __m256i sumSquares = _mm256_setzero_si256(), sumProducts = _mm256_setzero_si256();
+            for (int y = 0; y < 4; ++y) {
+                __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowsA[y] + block * 4)));
+                __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowsB[y] + block * 4)));
+                sumA = _mm256_add_epi32(sumA, _mm256_madd_epi16(a, ones));
+                sumB = _mm256_add_epi32(sumB, _mm256_madd_epi16(b, ones));
+                sumSquares = _mm256_add_epi32(sumSquares, _mm256_add_epi32(_mm256_madd_epi16(a, a), _mm256_madd_epi16(b, b)));
+                sumProducts = _mm256_add_epi32(sumProducts, _mm256_madd_epi16(a, b));
+            }
+            alignas(32) uint32_t sums[2][8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(sums[0]), _mm256_hadd_epi32(sumA, sumB));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(sums[1]), _mm256_hadd_epi32(sumSquares, sumProducts));
+            for (int i = 0; i < 4; ++i) {
+                int lane = (i / 2) * 4 + i % 2;
+                blocks[block + i] = {sums[0][lane], sums[0][lane + 2], sums[1][lane], sums[1][lane + 2]};
+            }
+        }
+        sumBlocksScalar(rowsA, rowsB, blocks, numBlocks, block);
+    }
+#endif
+
+
+#ifdef IMAGE_DOWNSCALER_NEON
+    // ---- NEON ----
+    // 2 blocks at once, the low half of every vector belongs to the first one
+
+    void sumBlocksNeon(const uchar* const* rowsA, const uchar* const* rowsB, BlockSums* blocks, int numBlocks) {
+        int block = 0;
+        for (; block + 2 <= numBlocks; block += 2) {
+            uint16x8_t sumA = vdupq_n_u16(0), sumB = vdupq_n_u16(0);
+            uint32x4_t squaresLow = vdupq_n_u32(0), squaresHigh = vdupq_n_u32(0);
+            uint32x4_t productsLow = vdupq_n_u32(0), productsHigh = vdupq_n_u32(0);
+            for (int y = 0; y < 4; ++y) {
+                uint16x8_t a = vmovl_u8(vld1_u8(rowsA[y] + block * 4));
+                uint16x8_t b = vmovl_u8(vld1_u8(rowsB[y] + block * 4));
+                sumA = vaddq_u16(sumA, a);
+                sumB = vaddq_u16(sumB, b);
+                squaresLow = vmlal_u16(vmlal_u16(squaresLow, vget_low_u16(a), vget_low_u16(a)), vget_low_u16(b), vget_low_u16(b));
+                squaresHigh = vmlal_u16(vmlal_u16(squaresHigh, vget_high_u16(a), vget_high_u16(a)), vget_high_u16(b), vget_high_u16(b));
+                productsLow = vmlal_u16(productsLow, vget_low_u16(a), vget_low_u16(b));
+                productsHigh = vmlal_u16(productsHigh, vget_high_u16(a), vget_high_u16(b));
+            }
+            blocks[block] = {vaddv_u16(vget_low_u16(sumA)), vaddv_u16(vget_low_u16(sumB)), vaddvq_u32(squaresLow),
+                             vaddvq_u32(productsLow)};
+            blocks[block + 1] = {vaddv_u16(vget_high_u16(sumA)), vaddv_u16(vget_high_u16(sumB)), vaddvq_u32(squaresHigh),
+                                 vaddvq_u32(productsHigh)};
+        }
+        sumBlocksScalar(rowsA, rowsB, blocks, numBlocks, block);
+    }
+#endif
+
+
+    void sumBlocks(SimdLevel simdLevel, const uchar* const* rowsA, const uchar* const* rowsB, BlockSums* blocks, int numBlocks) {
+#ifdef IMAGE_DOWNSCALER_X86
+        if (simdLevel == SimdLevel::Avx2) {
+            sumBlocksAvx2(rowsA, rowsB, blocks, numBlocks);
+            return;
+        }
+        if (simdLevel == SimdLevel::Sse41) {
+            sumBlocksSse41(rowsA, rowsB, blocks, numBlocks);
+            return;
+        }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+        if (simdLevel == SimdLevel::Neon) {
+            sumBlocksNeon(rowsA, rowsB, blocks, numBlocks);
+            return;
+        }
+#endif
+        sumBlocksScalar(rowsA, rowsB, blocks, numBlocks);
+    }
+
+
+    // SSIM of the 8x8 window made of the 4 blocks
+    double windowSsim(const BlockSums& topLeft, const BlockSums& topRight, const BlockSums& bottomLeft, const BlockSums& bottomRight) {
+        double sumA = (double) topLeft.sumA + topRight.sumA + bottomLeft.sumA + bottomRight.sumA;
+        double sumB = (double) topLeft.sumB + topRight.sumB + bottomLeft.sumB + bottomRight.sumB;
+        double sumSquares = (double) topLeft.sumSquares + topRight.sumSquares + bottomLeft.sumSquares + bottomRight.sumSquares;
+        double sumProducts = (double) topLeft.sumProducts + topRight.sumProducts + bottomLeft.sumProducts + bottomRight.sumProducts;
+        double variances = sumSquares * 64 - sumA * sumA - sumB * sumB;
+        double covariance = sumProducts * 64 - sumA * sumB;
+        return (2 * sumA * sumB + C1) * (2 * covariance + C2) / ((sumA * sumA + sumB * sumB + C1) * (variances + C2));
+    }
+}
+
+
+SsimReference::SsimReference(const Mat& image) : luma(toLuma(image)) {}
+
+
+std::optional<QualityScores> measureQuality(const SsimReference& reference, const Mat& image, SimdLevel simdLevel) {
+    Mat luma = toLuma(image);
+    if (luma.rows != reference.luma.rows || luma.cols != reference.luma.cols) {
+        return std::nullopt;
+    }
+
+    QualityScores scores;
+    int numBlocksX = luma.cols / 4;
+    int numBlocksY = luma.rows / 4;
+    if (numBlocksX < 2 || numBlocksY < 2) {
+        return scores;
+    }
+
+    // Only two rows of blocks are kept, every row of windows needs the one above and the current one
+    std::vector<BlockSums> previousRow(numBlocksX), currentRow(numBlocksX);
+    double ssimSum = 0;
+    uint64_t squaredErrorSum = 0;
+    for (int blockY = 0; blockY < numBlocksY; ++blockY) {
+        const uchar* rowsA[4];
+        const uchar* rowsB[4];
+        for (int y = 0; y < 4; ++y) {
+            rowsA[y] = reference.luma.ptr<uchar>(blockY * 4 + y);
+            rowsB[y] = luma.ptr<uchar>(blockY * 4 + y);
+        }
+        sumBlocks(simdLevel, rowsA, rowsB, currentRow.data(), numBlocksX);
+
+        // (a - b)^2 = a^2 + b^2 - 2ab, so the block sums give the PSNR for free
+        for (const BlockSums& block : currentRow) {
+            squaredErrorSum += block.sumSquares - 2 * (uint64_t) block.sumProducts;
+        }
+        if (blockY > 0) {
+            for (int blockX = 0; blockX + 1 < numBlocksX; ++blockX) {
+                ssimSum += windowSsim(previousRow[blockX], previousRow[blockX + 1], currentRow[blockX], currentRow[blockX + 1]);
+            }
+        }
+        std::swap(previousRow, currentRow);
+    }
+
+    scores.ssim = ssimSum / ((double) (numBlocksX - 1) * (numBlocksY - 1));
+    if (squaredErrorSum > 0) {
+        double meanSquaredError = (double) squaredErrorSum / ((double) numBlocksX * numBlocksY * 16);
+        scores.psnr = std::min(maxPsnr, 10 * std::log10(255.0 * 255.0 / meanSquaredError));
+    }
+    return scores;
+}
+
+
+double computeSsim(const SsimReference& reference, const Mat& image) {
+    std::optional<QualityScores> scores = measureQuality(reference, image);
+    return scores.has_value() ? scores->ssim : 0;
+}
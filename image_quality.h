@@ -0,0 +1,41 @@
+#ifndef IMAGE_DOWNSCALER_IMAGE_QUALITY_H
+#define IMAGE_DOWNSCALER_IMAGE_QUALITY_H
+
+#include <optional>
+#include <opencv2/opencv.hpp>
+#include "cpu_features.h"
+
+
+constexpr double maxPsnr = 100;  // reported for identical images instead of infinity
+// Part of the result cache's settings key: raised whenever measureQuality starts scoring the same images differently,
+// so the outputs --min-ssim and the quality search accepted under the old scores are checked again
+constexpr int qualityMetricVersion = 2;
+
+
+// Luma of the image the encoded candidates are compared against. It only depends on the source image, so it's
+// converted once and reused for every candidate.
+struct SsimReference {
+    explicit SsimReference(const cv::Mat& image);
+
+    cv::Mat luma;  // CV_8U
+};
+
+
+struct QualityScores {
+    double ssim = 1;  // mean SSIM, 1 = identical
+    double psnr = maxPsnr;  // dB
+};
+
+
+// SSIM and PSNR between the luma of the reference and the image, both from one pass over the pixels. SSIM uses 8x8
+// windows on a 4 pixel grid (each overlapping its neighbours by half, as x264 measures it) instead of a Gaussian window
+// around every pixel: every window is put together from four 4x4 block sums, so the pixels are only read once and the
+// per-window math runs for 1/16 of the pixels. The last 1-3 rows and columns that don't fill a block are left out.
+// Images smaller than 8x8 count as identical. Nothing if the sizes don't match.
+std::optional<QualityScores> measureQuality(const SsimReference& reference, const cv::Mat& image,
+                                            SimdLevel simdLevel = detectSimdLevel());
+// Just the SSIM of measureQuality, 0 if the sizes don't match.
+double computeSsim(const SsimReference& reference, const cv::Mat& image);
+
+
+#endif //IMAGE_DOWNSCALER_IMAGE_QUALITY_H
@@ -1,66 +1,151 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <iostream>
 #include <unordered_map>
-#include <sstream>
 #include <vector>
 #include <filesystem>
+#include <format>
 #include <thread>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <mutex>
-#include <format>
-#include <fstream>
+#include <csignal>
+#include <condition_variable>
+#include <queue>
+#include <unordered_set>
+#include <opencv2/opencv.hpp>
+#include "directory_scanner.h"
+#include "directory_watcher.h"
+#include "image_quality.h"
+#include "downscaler.h"
+#include "mat_pool.h"
+#include "memory_budget.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "resampler.h"
+#include "result_cache.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+#ifdef _WIN32
 #include <windows.h>
 #include <shlobj.h>
-#include <opencv2/opencv.hpp>
+#endif
 
 
 namespace fs = std::filesystem;
-using std::string;
-using std::vector;
-using cv::Mat;
 
 
-void core();
-void coutPlus(const string& text, const string& color="DEFAULT", bool endLine=true);
-void cerrPlus(const string& text);
-void coutPlusPlus(const vector<string>& texts, const vector<string>& colors, bool endLine=true, const vector<int>& paddings={}, const vector<string>& alignments={});
-string getColorEscapeSequence(const string& color);
-void setConsoleTextColor(int colorCode);
+struct ScheduledImage {
+    string path;
+    size_t peakBytes;  // estimateImageMemory, 0 if the image won't be decoded
+    bool isKnownOutdated;  // the scan found it isn't up to date, the task doesn't look it up again
+
+    bool operator<(const ScheduledImage& other) const {
+        return peakBytes < other.peakBytes;
+    }
+};
+
+
+// Images the scan found that haven't started yet, at most scheduleWindowSize of them; the scan waits while it's full
+struct ScheduleWindow {
+    std::mutex mtx;
+    std::condition_variable cvNotFull;
+    std::priority_queue<ScheduledImage> images;  // largest on top
+};
+
+
+// Images of the watch mode that were submitted to the pool and haven't finished yet
+struct WatchQueue {
+    std::mutex mtx;
+    std::unordered_set<string> running;
+    // Changed again while being processed (our own rename of the result, mostly), each with its first new event
+    std::unordered_map<string, StatsClock::time_point> changedWhileRunning;
+    DurationStats latency;  // first event to done, images that needed no work aren't counted
+    // The rescan after missed events runs on the pool, the images it finds are handed to the watch loop here
+    vector<string> rescannedImages;
+    bool isRescanning = false;
+    bool isRescanRequested = false;  // more events were missed while it was running, it has to start over
+};
+
+
+int core();
+int processRoots(const vector<string>& roots);
+void processRoot(const string& root);
+std::unique_ptr<ResultCache> openResultCache(const string& root);
+void watchRoots(DirectoryWatcher& watcher, const vector<string>& roots);
+void startRescan(ThreadPool& pool, DirectoryWatcher& watcher, WatchQueue& queue, const vector<string>& roots);
+void submitWatchedImage(ThreadPool& pool, MemoryBudget& memoryBudget, WatchQueue& queue, const string& imagePath,
+                        StatsClock::time_point firstEvent);
+void printWatchStats(WatchQueue& queue, size_t numSettling);
+void stopWatching(int signal);
+bool parseArguments(int argc, char* argv[]);
+std::optional<int> parseIntegerArgument(const string& option, const string& value, int minValue, int maxValue);
+std::optional<double> parseDecimalArgument(const string& option, const string& value, double minValue, double maxValue);
+void printUsage();
+unsigned int getNumWorkerThreads();
+unsigned int getNumScanThreads();
 string selectFolder();
+string getEncoderNames();
 void createBackup(const string& dir);
-void processDirectory(const string& directoryPath);
-void processTask(const string& imagePath, int taskId);
-void runTasks(const vector<string>& imagePaths);
-std::tuple<std::optional<Mat>, int, int, int, int> resizeImage(const Mat& image);
-std::optional<Mat> readImage(const string& imagePath);
-void saveImage(const string& outputFileName, const Mat& image, const vector<int>& compressionParams={});
-vector<int> getCompressionParamsForImage(const string& imageType);
-int getFileSize(const string& filePath);
-double getFileSizeInKB(const string& filePath);
+void scheduleImage(ThreadPool& pool, ScheduleWindow& window, MemoryBudget& memoryBudget, ScheduledImage image);
+void runImageTask(const string& imagePath, ThreadPool& pool, bool isKnownOutdated);
+size_t getMemoryBudget();
 string getRelativePath(const string& initialPath, const string& filePath);
-string getFileExtension(const string& filePath);
 void setMaxImageLength();
 void setImageCompressionLevel();
 void setConvertImageToJPEG();
 std::optional<bool> answerYesNo(const string& answer);
-string toLowerCase(const string& str);
-bool isStringInList(const string& element, const vector<string>& list);
-void printDownscaledImageStats(const string& imagePath, const double& oldImageSize, int oldWidth, int oldHeight, int newWidth, int newHeight);
-
 
-std::mutex mtx;
-std::condition_variable cvThreads;
-int activeThreads = 0;
-int maxImageLength = 1920;
-int imageCompression = 3;  // [0(no compression, highest image quality), 10(max compression, lowest image quality)]
-bool convertToJPEG = false; // should all image types be converted to JPEG?
 
+std::atomic<int> nextTaskId = 0;
+vector<string> inputRoots;  // directories from the command line, empty = ask for one interactively
+bool showHelp = false;
+unsigned int numWorkerThreads = 0;  // 0 = use std::thread::hardware_concurrency()
+unsigned int numScanThreads = 0;  // 0 = pick from std::thread::hardware_concurrency()
+bool usePipeline = false;  // process images in separate read/decode/resize/encode stages instead of one task per image
+PipelineConfig pipelineConfig;
+std::optional<size_t> memoryBudgetBytes;  // peak memory of the images processed at once, unset = 3/4 of the memory limit
+size_t matPoolBytes = 256 * 1024 * 1024;  // free image buffers kept for reuse, 0 = let OpenCV allocate every one
+string statsFilePath;  // empty = don't write the statistics to a file
+bool useResultCache = true;  // skip images an earlier run already processed with the same settings
+string cacheFilePath;  // empty = .image-downscaler-cache in every input directory
+int progressIntervalSeconds = 10;  // 0 = don't report the progress
+bool watchMode = false;  // after the first pass, keep processing the images that are added to the directories
+std::atomic<DirectoryWatcher*> activeWatcher = nullptr;  // for the signal handler
+
+// A watched image is submitted once no event came for it for this long, so an image that's written several times in
+// a row, or written and then renamed, is processed once, and still well within a second of its upload
+const auto watchSettleTime = std::chrono::milliseconds(100);
+// Images the task mode orders largest first, the scan runs at most this far ahead of the processing
+const size_t scheduleWindowSize = 4096;
+// The journal keeps the cache safe in between, saving the index only keeps the journal from growing without end
+const auto watchIndexSaveInterval = std::chrono::hours(1);
+
+
+int main(int argc, char* argv[]) {
+    initConsole();
+    if (!parseArguments(argc, argv)) {
+        cerrPlus("Run with --help to see all options.");
+        return 2;
+    }
+    if (showHelp) {
+        printUsage();
+        return 0;
+    }
 
-int main() {
-    core();
-    return 0;
+    if (inputRoots.empty()) {
+        // Nothing on the command line, ask for the directory and the settings
+        return core();
+    }
+    return processRoots(inputRoots);
 }
 
 
-void core() {
+int core() {
     const string DIRECTORY = selectFolder();
     setMaxImageLength();
     setImageCompressionLevel();
@@ -68,20 +153,719 @@ void core() {
 
     createBackup(DIRECTORY);
 
-    unsigned int numThreads = std::thread::hardware_concurrency();
-    coutPlus("Number of threads supported: " + std::to_string(numThreads), "yellow");
+    int exitCode = processRoots({DIRECTORY});
 
-    processDirectory(DIRECTORY);
+#ifdef _WIN32
+    // Keep the console window open when started from the explorer
+    system("pause");
+#endif
+    return exitCode;
+}
 
-    // Wait until all tasks are completed
-    std::unique_lock<std::mutex> lock(mtx);
-    cvThreads.wait(lock, [] { return activeThreads == 0; });
 
+// Returns the exit code: 0 if every image was processed (or skipped), 1 if some failed, 2 if an input is invalid.
+int processRoots(const vector<string>& roots) {
+    for (const string& root : roots) {
+        if (!fs::is_directory(root)) {
+            cerrPlus("Not a directory: " + root);
+            return 2;
+        }
+    }
 
-    // TODO print statistics (how many images edited, how much space saved, how much space saved per image on average,
-    //  how much time it took for all images, how much time it took per image, etc...
+    if (matPoolBytes > 0) {
+        installMatPool(matPoolBytes);
+    }
 
-    system("pause");
+    coutPlus("Resampling filter: " + getResampleFilterName(resampleFilter) + " (" + getSimdLevelName(detectSimdLevel()) + ")", "yellow");
+    coutPlus("Encoder: " + getEncoderNames(), "yellow");
+    if (dryRun) {
+        coutPlus("Dry run, no image will be changed.", "yellow");
+    } else if (usePipeline) {
+        coutPlus("Processing images in pipeline mode.", "yellow");
+    } else {
+        coutPlus("Number of worker threads: " + std::to_string(getNumWorkerThreads()), "yellow");
+        size_t budget = getMemoryBudget();
+        coutPlus("Memory budget: " + (budget > 0 ? std::to_string(budget / 1024 / 1024) + " MB" : string("unlimited")), "yellow");
+    }
+
+    // Watched before the first pass starts, so images that arrive during it aren't missed
+    std::unique_ptr<DirectoryWatcher> watcher;
+    if (watchMode) {
+        watcher = std::make_unique<DirectoryWatcher>();
+        if (!watcher->isOpen()) {
+            cerrPlus("Can't watch the directories, watching needs inotify (Linux)");
+            return 2;
+        }
+        for (const string& root : roots) {
+            if (!watcher->addTree(root)) {
+                return 2;
+            }
+        }
+    }
+
+    StatsClock::time_point startTime = StatsClock::now();
+    for (const string& root : roots) {
+        if (roots.size() > 1) {
+            coutPlus("Processing " + root, "blue");
+        }
+        processRoot(root);
+    }
+    if (watcher != nullptr) {
+        watchRoots(*watcher, roots);
+    }
+
+    double wallSeconds = std::chrono::duration<double>(StatsClock::now() - startTime).count();
+    RunStats stats = collectRunStats();
+    printRunStats(stats, wallSeconds);
+    if (!statsFilePath.empty() && writeRunStats(statsFilePath, stats, wallSeconds)) {
+        coutPlus("Statistics written to " + statsFilePath, "yellow");
+    }
+    return stats.outcomes[(size_t) ImageOutcome::Failed] > 0 ? 1 : 0;
+}
+
+
+void processRoot(const string& root) {
+    std::unique_ptr<ResultCache> cache = openResultCache(root);
+    if (!renditions.empty()) {
+        loadRenditionList(root);
+    }
+
+    std::unique_ptr<ProgressReporter> progress;
+    if (progressIntervalSeconds > 0) {
+        progress = std::make_unique<ProgressReporter>(progressIntervalSeconds);
+    }
+
+    if (usePipeline && !dryRun) {
+        Pipeline pipeline(pipelineConfig);
+        // The scan runs while the first images are already written, converted ones show up in it as new files
+        size_t numImages = scanDirectory(root, getNumScanThreads(), [&pipeline](const string& imagePath) {
+            if (!isWrittenOutput(imagePath) && !isRenditionPath(imagePath)) {
+                pipeline.submit(imagePath);
+            }
+        });
+        if (progress != nullptr) {
+            progress->setTotal(numImages);
+        }
+
+        // Wait until all images went through every stage
+        pipeline.finish();
+    } else {
+        ThreadPool pool(getNumWorkerThreads());
+        MemoryBudget memoryBudget(getMemoryBudget());
+        ScheduleWindow window;
+        std::atomic<size_t> numImages = 0;
+        // The scan runs while the first images are already processed, converted ones show up in it as new files
+        scanDirectory(root, getNumScanThreads(), [&pool, &window, &memoryBudget, &numImages](const string& imagePath) {
+            if (isWrittenOutput(imagePath) || isRenditionPath(imagePath)) {
+                return;
+            }
+            // Up to date images are skipped right away, their headers don't need to be read
+            bool needsEstimate = !dryRun && (resultCache == nullptr || !resultCache->isUpToDate(imagePath));
+            size_t peakBytes = needsEstimate ? estimateImageMemory(imagePath) : 0;
+            scheduleImage(pool, window, memoryBudget, {imagePath, peakBytes, needsEstimate && resultCache != nullptr});
+            numImages++;
+        });
+
+        if (progress != nullptr) {
+            progress->setTotal(numImages);
+        }
+
+        // Wait until all tasks are completed
+        pool.waitIdle();
+        pool.shutdown();
+    }
+
+    if (cache != nullptr) {
+        // A dry run doesn't write anything, not even the index
+        if (!dryRun) {
+            cache->save();
+        }
+        resultCache = nullptr;
+    }
+}
+
+
+
+// Also makes it the resultCache. Null if the cache is off.
+std::unique_ptr<ResultCache> openResultCache(const string& root) {
+    if (!useResultCache) {
+        return nullptr;
+    }
+    // Created after the settings are final, the cache entries are only valid for the settings they were made with
+    string indexPath = cacheFilePath.empty() ? (fs::path(root) / ".image-downscaler-cache").string() : cacheFilePath;
+    // Paths in the index are relative to its own directory, so one --cache-file can serve several roots
+    auto cache = std::make_unique<ResultCache>(fs::absolute(indexPath).parent_path().string(), indexPath);
+    cache->load();
+    resultCache = cache.get();
+    coutPlus("Result cache: " + indexPath + " (" + std::to_string(cache->size()) + " images)", "yellow");
+    return cache;
+}
+
+
+// Processes the images added to the roots until SIGINT or SIGTERM, on one pool that stays up the whole time. Events are
+// collected until they've settled and then submitted together; in between, the thread only sleeps in the watcher.
+void watchRoots(DirectoryWatcher& watcher, const vector<string>& roots) {
+    // One cache for all roots, parseArguments made sure it's a shared --cache-file if there are several
+    std::unique_ptr<ResultCache> cache = openResultCache(roots.front());
+    ThreadPool pool(getNumWorkerThreads());
+    MemoryBudget memoryBudget(getMemoryBudget());
+    WatchQueue queue;
+
+    activeWatcher = &watcher;
+    std::signal(SIGINT, stopWatching);
+    std::signal(SIGTERM, stopWatching);
+    coutPlus("Watching for new images, press Ctrl+C to stop.", "yellow");
+
+    // path -> first and last event, not submitted yet
+    std::unordered_map<string, std::pair<StatsClock::time_point, StatsClock::time_point>> settling;
+    auto reportInterval = std::chrono::seconds(progressIntervalSeconds);
+    StatsClock::time_point lastReport = StatsClock::now();
+    StatsClock::time_point lastIndexSave = StatsClock::now();
+    bool hasUnreportedWork = false;
+    while (true) {
+        // Without anything waiting or anything new to report, it sleeps until the next event
+        int timeoutMs = -1;
+        if (!settling.empty()) {
+            timeoutMs = (int) watchSettleTime.count();
+        } else if (hasUnreportedWork && progressIntervalSeconds > 0) {
+            auto untilReport = std::chrono::duration_cast<std::chrono::milliseconds>(lastReport + reportInterval - StatsClock::now());
+            timeoutMs = (int) std::max<int64_t>(untilReport.count(), 0);
+        }
+        WatchEvents events = watcher.wait(timeoutMs);
+        if (events.stopped) {
+            break;
+        }
+
+        if (events.overflowed) {
+            startRescan(pool, watcher, queue, roots);
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            std::move(queue.rescannedImages.begin(), queue.rescannedImages.end(), std::back_inserter(events.images));
+            queue.rescannedImages.clear();
+        }
+        StatsClock::time_point now = StatsClock::now();
+        for (string& imagePath : events.images) {
+            if (isRenditionPath(imagePath)) {
+                continue;
+            }
+            auto [it, isNew] = settling.try_emplace(std::move(imagePath), now, now);
+            it->second.second = now;
+        }
+
+        for (auto it = settling.begin(); it != settling.end();) {
+            if (now - it->second.second >= watchSettleTime) {
+                submitWatchedImage(pool, memoryBudget, queue, it->first, it->second.first);
+                hasUnreportedWork = true;
+                it = settling.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (hasUnreportedWork && progressIntervalSeconds > 0 && now - lastReport >= reportInterval) {
+            printWatchStats(queue, settling.size());
+            lastReport = now;
+            // Keeps reporting while images are still being processed
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            hasUnreportedWork = !queue.running.empty();
+        }
+        if (cache != nullptr && now - lastIndexSave >= watchIndexSaveInterval) {
+            cache->save();
+            lastIndexSave = now;
+        }
+    }
+
+    // Images that were still settling are left to the first pass of the next run
+    coutPlus("Stopping, waiting for the images in progress...", "yellow");
+    pool.waitIdle();
+    pool.shutdown();
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    activeWatcher = nullptr;
+    printWatchStats(queue, 0);
+    if (cache != nullptr) {
+        cache->save();
+        resultCache = nullptr;
+    }
+}
+
+
+// Scans the roots again on the pool after the kernel dropped events, the watch loop keeps collecting events meanwhile.
+// Images that didn't change are only stat'ed later, the cache skips them. The found images settle like any other.
+void startRescan(ThreadPool& pool, DirectoryWatcher& watcher, WatchQueue& queue, const vector<string>& roots) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        if (queue.isRescanning) {
+            // The running scan may already be past the directories that lost events
+            queue.isRescanRequested = true;
+            return;
+        }
+        queue.isRescanning = true;
+    }
+    cerrPlus("Missed some file events, scanning the directories again");
+
+    pool.submit([&watcher, &queue, &roots] {
+        while (true) {
+            for (const string& root : roots) {
+                scanDirectory(root, getNumScanThreads(), [&queue](const string& imagePath) {
+                    std::lock_guard<std::mutex> lock(queue.mtx);
+                    queue.rescannedImages.push_back(imagePath);
+                });
+            }
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            if (!queue.isRescanRequested) {
+                queue.isRescanning = false;
+                break;
+            }
+            queue.isRescanRequested = false;
+        }
+        watcher.wake();
+    });
+}
+
+
+void submitWatchedImage(ThreadPool& pool, MemoryBudget& memoryBudget, WatchQueue& queue, const string& imagePath,
+                        StatsClock::time_point firstEvent) {
+    {
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        // Processed again after the running task, it may have read the image before this change
+        if (!queue.running.insert(imagePath).second) {
+            queue.changedWhileRunning.try_emplace(imagePath, firstEvent);
+            return;
+        }
+    }
+
+    pool.submit([&pool, &memoryBudget, &queue, imagePath, firstEvent] {
+        // Checked before the header is probed: every image we write comes back as an event, and is up to date by then.
+        // An image that's already gone again was a temporary file of whoever wrote it.
+        std::error_code error;
+        bool needsWork = fs::is_regular_file(imagePath, error) && !isImageUpToDate(imagePath, StatsClock::now());
+        if (needsWork) {
+            MemoryReservation reservation(memoryBudget, estimateImageMemory(imagePath));
+            runImageTask(imagePath, pool, true);
+        }
+
+        std::optional<StatsClock::time_point> nextFirstEvent;
+        {
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            if (needsWork) {
+                queue.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(StatsClock::now() - firstEvent).count(), 0);
+            }
+            queue.running.erase(imagePath);
+            auto changed = queue.changedWhileRunning.find(imagePath);
+            if (changed != queue.changedWhileRunning.end()) {
+                nextFirstEvent = changed->second;
+                queue.changedWhileRunning.erase(changed);
+            }
+        }
+        if (nextFirstEvent.has_value()) {
+            submitWatchedImage(pool, memoryBudget, queue, imagePath, nextFirstEvent.value());
+        }
+    });
+}
+
+
+void printWatchStats(WatchQueue& queue, size_t numSettling) {
+    std::lock_guard<std::mutex> lock(queue.mtx);
+    coutPlus(std::format("Watching: {} settling, {} queued or running, {} processed, latency p50 {:.0f} ms, p99 {:.0f} ms, max {:.0f} ms",
+                         numSettling, queue.running.size(), queue.latency.count, queue.latency.getPercentileMs(0.5),
+                         queue.latency.getPercentileMs(0.99), queue.latency.maxNs / 1e6), "yellow");
+}
+
+
+void stopWatching(int) {
+    DirectoryWatcher* watcher = activeWatcher;
+    if (watcher != nullptr) {
+        watcher->requestStop();
+    }
+}
+
+bool parseArguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+
+        auto readValue = [&]() -> std::optional<string> {
+            if (i + 1 >= argc) {
+                cerrPlus("Missing value for " + arg);
+                return std::nullopt;
+            }
+            return string(argv[++i]);
+        };
+        auto readInteger = [&](int minValue, int maxValue) -> std::optional<int> {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) {
+                return std::nullopt;
+            }
+            return parseIntegerArgument(arg, value.value(), minValue, maxValue);
+        };
+
+        if (arg == "--help" || arg == "-h") {
+            showHelp = true;
+        } else if (arg == "--max-length" || arg == "-m") {
+            std::optional<int> value = readInteger(1, 100000);
+            if (!value.has_value()) return false;
+            maxImageLength = value.value();
+        } else if (arg == "--compression" || arg == "-c") {
+            std::optional<int> value = readInteger(0, 10);
+            if (!value.has_value()) return false;
+            imageCompression = value.value();
+        } else if (arg == "--quality") {
+            std::optional<int> value = readInteger(1, 100);
+            if (!value.has_value()) return false;
+            imageQuality = value.value();
+        } else if (arg == "--format" || arg == "-f") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            string format = toLowerCase(value.value());
+            outputFormat.clear();
+            autoOutputFormat = format == "auto";
+            if (format == "jpg" || format == "jpeg") {
+                outputFormat = ".jpg";
+            } else if (format == "png" || format == "webp") {
+                outputFormat = "." + format;
+            } else if (format != "keep" && format != "auto") {
+                cerrPlus("Unknown format: " + format + " (expected keep, auto, jpg, png or webp)");
+                return false;
+            }
+        } else if (arg == "--threads" || arg == "-t") {
+            std::optional<int> value = readInteger(1, 1024);
+            if (!value.has_value()) return false;
+            numWorkerThreads = value.value();
+        } else if (arg == "--scan-threads") {
+            std::optional<int> value = readInteger(1, 256);
+            if (!value.has_value()) return false;
+            numScanThreads = value.value();
+        } else if (arg == "--dry-run" || arg == "-n") {
+            dryRun = true;
+        } else if (arg == "--pipeline") {
+            usePipeline = true;
+        } else if (arg == "--readers" || arg == "--decoders" || arg == "--resizers" || arg == "--encoders") {
+            std::optional<int> value = readInteger(1, 1024);
+            if (!value.has_value()) return false;
+            if (arg == "--readers") pipelineConfig.readers = value.value();
+            if (arg == "--decoders") pipelineConfig.decoders = value.value();
+            if (arg == "--resizers") pipelineConfig.resizers = value.value();
+            if (arg == "--encoders") pipelineConfig.encoders = value.value();
+        } else if (arg == "--queue-mb") {
+            std::optional<int> value = readInteger(1, 1024 * 1024);
+            if (!value.has_value()) return false;
+            // Every queue between two stages holds at most this many MB, so the total stays under ~3x this value
+            pipelineConfig.queueBytes = (size_t) value.value() * 1024 * 1024;
+        } else if (arg == "--memory-mb") {
+            std::optional<int> value = readInteger(0, 1024 * 1024 * 1024);
+            if (!value.has_value()) return false;
+            memoryBudgetBytes = (size_t) value.value() * 1024 * 1024;
+        } else if (arg == "--pool-mb") {
+            std::optional<int> value = readInteger(0, 1024 * 1024);
+            if (!value.has_value()) return false;
+            matPoolBytes = (size_t) value.value() * 1024 * 1024;
+        } else if (arg == "--policy") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            string policy = toLowerCase(value.value());
+            if (policy == "resize-only") {
+                processingPolicy = ProcessingPolicy::ResizeOnly;
+            } else if (policy == "recompress-if-smaller") {
+                processingPolicy = ProcessingPolicy::RecompressIfSmaller;
+            } else if (policy == "always") {
+                processingPolicy = ProcessingPolicy::Always;
+            } else {
+                cerrPlus("Unknown policy: " + policy + " (expected resize-only, recompress-if-smaller or always)");
+                return false;
+            }
+        } else if (arg == "--encoder") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            string backendName = toLowerCase(value.value());
+            std::optional<EncoderBackend> backend = parseEncoderBackend(backendName);
+            if (backend.has_value()) {
+                encoderBackend = backend.value();
+            } else {
+                cerrPlus("Unknown encoder: " + backendName + " (expected native or opencv)");
+                return false;
+            }
+        } else if (arg == "--progressive") {
+            progressiveJpeg = true;
+        } else if (arg == "--chroma") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            if (value.value() == "420") {
+                jpegSamplingFactor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_420;
+            } else if (value.value() == "422") {
+                jpegSamplingFactor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_422;
+            } else if (value.value() == "444") {
+                jpegSamplingFactor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_444;
+            } else {
+                cerrPlus("Unknown chroma subsampling: " + value.value() + " (expected 420, 422 or 444)");
+                return false;
+            }
+        } else if (arg == "--metadata") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            string policyName = toLowerCase(value.value());
+            std::optional<MetadataPolicy> policy = parseMetadataPolicy(policyName);
+            if (policy.has_value()) {
+                metadataPolicy = policy.value();
+            } else {
+                cerrPlus("Unknown metadata policy: " + policyName + " (expected keep, icc or strip)");
+                return false;
+            }
+        } else if (arg == "--max-metadata-kb") {
+            std::optional<int> value = readInteger(1, 1024 * 1024);
+            if (!value.has_value()) return false;
+            maxMetadataBytes = (size_t) value.value() * 1024;
+        } else if (arg == "--target-size") {
+            std::optional<int> value = readInteger(1, 1024 * 1024);
+            if (!value.has_value()) return false;
+            qualitySearch.maxBytes = (size_t) value.value() * 1024;
+        } else if (arg == "--min-ssim") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            std::optional<double> minSsim = parseDecimalArgument(arg, value.value(), 0, 1);
+            if (!minSsim.has_value()) return false;
+            qualitySearch.minSsim = minSsim.value();
+        } else if (arg == "--verify") {
+            qualityGuard.enabled = true;
+        } else if (arg == "--verify-min-ssim" || arg == "--verify-min-psnr") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            std::optional<double> minScore = parseDecimalArgument(arg, value.value(), 0, arg == "--verify-min-ssim" ? 1 : maxPsnr);
+            if (!minScore.has_value()) return false;
+            if (arg == "--verify-min-ssim") qualityGuard.minSsim = minScore.value();
+            if (arg == "--verify-min-psnr") qualityGuard.minPsnr = minScore.value();
+            qualityGuard.enabled = true;
+        } else if (arg == "--min-quality") {
+            std::optional<int> value = readInteger(1, 100);
+            if (!value.has_value()) return false;
+            qualitySearch.minQuality = value.value();
+        } else if (arg == "--fsync") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            string policyName = toLowerCase(value.value());
+            std::optional<FsyncPolicy> policy = parseFsyncPolicy(policyName);
+            if (policy.has_value()) {
+                fsyncPolicy = policy.value();
+            } else {
+                cerrPlus("Unknown fsync policy: " + policyName + " (expected none, file or full)");
+                return false;
+            }
+        } else if (arg == "--keep-times") {
+            preserveTimestamps = true;
+        } else if (arg == "--stats-file") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            statsFilePath = value.value();
+        } else if (arg == "--no-cache") {
+            useResultCache = false;
+        } else if (arg == "--cache-file") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            cacheFilePath = value.value();
+        } else if (arg == "--watch") {
+            watchMode = true;
+        } else if (arg == "--progress") {
+            std::optional<int> value = readInteger(0, 86400);
+            if (!value.has_value()) return false;
+            progressIntervalSeconds = value.value();
+        } else if (arg == "--quiet" || arg == "-q") {
+            quietOutput = true;
+        } else if (arg == "--no-color") {
+            colorOutput = false;
+        } else if (arg == "--filter") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            string filterName = toLowerCase(value.value());
+            std::optional<ResampleFilter> filter = parseResampleFilter(filterName);
+            if (filter.has_value()) {
+                resampleFilter = filter.value();
+            } else {
+                cerrPlus("Unknown resampling filter: " + filterName + " (expected area, bilinear, bicubic or lanczos3)");
+                return false;
+            }
+        } else if (arg == "--stream-above-mp") {
+            std::optional<int> value = readInteger(0, 1000000);
+            if (!value.has_value()) return false;
+            streamAboveMegapixels = value.value();
+        } else if (arg == "--renditions") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            std::optional<vector<Rendition>> parsedRenditions = parseRenditions(value.value());
+            if (!parsedRenditions.has_value()) {
+                cerrPlus("Invalid renditions: " + value.value() + " (expected SIZE[:FORMAT[:QUALITY]],... e.g. 1280,256:webp:70)");
+                return false;
+            }
+            renditions = parsedRenditions.value();
+        } else if (arg == "--rendition-name") {
+            std::optional<string> value = readValue();
+            if (!value.has_value()) return false;
+            // Without both, renditions would overwrite each other or the renditions of other images
+            if (value->find("{name}") == string::npos || value->find("{size}") == string::npos) {
+                cerrPlus("The rendition name has to contain {name} and {size}: " + value.value());
+                return false;
+            }
+            // The pattern is part of the result cache's settings key, whose fields are separated by spaces
+            if (std::any_of(value->begin(), value->end(), [](unsigned char c) { return std::isspace(c); })) {
+                cerrPlus("The rendition name can't contain spaces: " + value.value());
+                return false;
+            }
+            renditionNamePattern = value.value();
+        } else if (!arg.empty() && arg[0] == '-') {
+            cerrPlus("Unknown argument: " + arg);
+            return false;
+        } else {
+            inputRoots.push_back(arg);
+        }
+    }
+
+    if (watchMode) {
+        // Without the cache every image we write would come back as an event and be recompressed again
+        if (!useResultCache || dryRun) {
+            cerrPlus("--watch can't be combined with --no-cache or --dry-run");
+            return false;
+        }
+        if (inputRoots.size() > 1 && cacheFilePath.empty()) {
+            cerrPlus("--watch with several directories needs one --cache-file for all of them");
+            return false;
+        }
+    }
+    if (!renditions.empty()) {
+        if (usePipeline) {
+            cerrPlus("--renditions can't be combined with --pipeline");
+            return false;
+        }
+        if (autoOutputFormat) {
+            cerrPlus("--renditions can't be combined with --format auto, give the renditions their formats instead");
+            return false;
+        }
+        // Decoding (and streaming) stops at the largest rendition
+        maxImageLength = renditions.front().maxLength;
+    }
+    return true;
+}
+
+
+std::optional<int> parseIntegerArgument(const string& option, const string& value, int minValue, int maxValue) {
+    int result = 0;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc() || end != value.data() + value.size() || result < minValue || result > maxValue) {
+        cerrPlus(std::format("Invalid value for {}: {} (expected {}-{})", option, value, minValue, maxValue));
+        return std::nullopt;
+    }
+    return result;
+}
+
+
+std::optional<double> parseDecimalArgument(const string& option, const string& value, double minValue, double maxValue) {
+    double result = 0;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc() || end != value.data() + value.size() || result < minValue || result > maxValue) {
+        cerrPlus(std::format("Invalid value for {}: {} (expected {}-{})", option, value, minValue, maxValue));
+        return std::nullopt;
+    }
+    return result;
+}
+
+
+// "native (turbojpeg, libpng, opencv for the rest)" or "opencv"
+string getEncoderNames() {
+    const vector<const ImageEncoder*>& encoders = getImageEncoders();
+    if (encoderBackend == EncoderBackend::OpenCV || encoders.size() == 1) {
+        return "opencv";
+    }
+    string names;
+    for (size_t i = 1; i < encoders.size(); ++i) {
+        names += encoders[i]->getName() + ", ";
+    }
+    return "native (" + names + "opencv for the rest)";
+}
+
+
+void printUsage() {
+    std::cout <<
+R"(Usage: image-downscaler [options] [directory...]
+
+Downscales and recompresses every JPEG, PNG and WebP image in the given directories (and their subdirectories),
+in place. Without a directory, asks for one and for the settings interactively.
+
+Options:
+  -m, --max-length N      longest side of the output images in pixels (default 1920)
+  -c, --compression N     0 (no compression, best quality) to 10 (max compression, worst quality) (default 3)
+      --quality N         JPEG and WebP quality 1-100, overrides --compression for those formats
+  -f, --format FORMAT     keep, auto, jpg, png or webp (default keep); converted images replace the
+                          originals; auto picks JPEG, lossy or lossless WebP or PNG for every image
+                          from its pixels
+      --filter FILTER     area, bilinear, bicubic or lanczos3 (default area)
+      --renditions SPEC   write these sizes next to every image instead of replacing it, decoded once:
+                          SIZE[:FORMAT[:QUALITY]],... e.g. 2560,1280,640:webp,256:jpg:60
+                          (--max-length is the largest size)
+      --rendition-name P  file name of the renditions, with {name}, {size} and {ext}
+                          (default {name}-{size}{ext})
+      --stream-above-mp N decode images of more than N megapixels row by row straight into the
+                          downscaler, 0 = never (default 50; needs the libjpeg/libpng build options)
+      --encoder ENCODER   native or opencv (default native): native encodes with TurboJPEG, libwebp and
+                          libpng directly if they were built in, opencv always uses OpenCV
+      --progressive       write progressive JPEGs
+      --chroma MODE       JPEG chroma subsampling: 420, 422 or 444 (default 420)
+      --metadata MODE     keep (EXIF, ICC profile and XMP), icc (only the colour profile) or strip
+                          (default keep); the EXIF orientation is applied to the pixels either way
+      --max-metadata-kb N drop any EXIF block, ICC profile or XMP packet larger than N KB
+      --policy POLICY     resize-only, recompress-if-smaller or always (default recompress-if-smaller);
+                          recompress-if-smaller keeps the original of an image that isn't downscaled
+                          if re-encoding doesn't make it smaller
+      --target-size KB    lower the JPEG/WebP quality until the image fits in KB (as far as --min-quality)
+      --min-ssim X        lower the JPEG/WebP quality only as long as the SSIM to the downscaled image
+                          stays at least X (0-1, e.g. 0.95); with --target-size, this floor wins
+      --min-quality N     the lowest quality --target-size and --min-ssim may pick (default 40)
+      --verify            decode every JPEG/WebP output again and report its SSIM and PSNR
+      --verify-min-ssim X, --verify-min-psnr DB
+                          verify, and encode an output that scores lower again at a higher quality;
+                          if it doesn't get there even at 100, the original is kept
+  -t, --threads N         worker threads (default: one per CPU core)
+      --scan-threads N    threads listing the directories (default: half the cores, 2-8)
+      --memory-mb N       memory the images processed at once may need together, 0 = no limit
+                          (default 3/4 of the cgroup limit or of the physical memory)
+  -n, --dry-run           only report what would be done, don't change any file
+      --fsync MODE        none, file or full (also the directory) - how hard to make sure a written image
+                          is on disk before the original is gone (default file)
+      --keep-times        give rewritten images the timestamps of the originals
+      --pipeline          run read, decode, resize and encode as separate stages
+      --readers N, --decoders N, --resizers N, --encoders N
+                          threads per pipeline stage
+      --queue-mb N        memory limit of every queue between two pipeline stages (default 256)
+      --pool-mb N         freed image buffers kept for the next images, 0 = off (default 256)
+      --no-cache          process every image, even if an earlier run already did
+      --cache-file PATH   where to keep the index of processed images
+                          (default: .image-downscaler-cache in every directory)
+      --stats-file PATH   write the run statistics as JSON (.json) or CSV
+      --progress N        print the progress, rate and time left every N seconds, 0 = off (default 10)
+      --watch             after the first pass, keep processing new images as they're added, until
+                          Ctrl+C or SIGTERM (Linux only)
+  -q, --quiet             don't print a line for every image
+      --no-color          don't color the output (also off when it isn't a terminal or NO_COLOR is set)
+  -h, --help              show this help
+
+Exit code: 0 on success, 1 if some images failed, 2 on invalid arguments.
+)";
+}
+
+
+unsigned int getNumWorkerThreads() {
+    if (numWorkerThreads > 0) {
+        return numWorkerThreads;
+    }
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    return hardwareThreads > 0 ? hardwareThreads : 1;
+}
+
+
+unsigned int getNumScanThreads() {
+    if (numScanThreads > 0) {
+        return numScanThreads;
+    }
+    // Listing is mostly waiting on the disk (or the network), a few threads keep several requests in flight
+    // without fighting the workers for the CPU
+    return std::clamp(std::thread::hardware_concurrency() / 2, 2u, 8u);
 }
 
 
@@ -176,10 +960,10 @@ void setConvertImageToJPEG() {
     string answer;
     std::cin >> answer;
     if (answerYesNo(answer) == true) {
-        convertToJPEG = true;
+        outputFormat = ".jpg";
         coutPlus("All images will be converted to JPEG.", "yellow");
     } else if (answerYesNo(answer) == false) {
-        convertToJPEG = false;
+        outputFormat.clear();
         coutPlus("Images will NOT be converted to JPEG.", "yellow");
     } else {
         coutPlus("Invalid answer.", "red");
@@ -203,163 +987,55 @@ std::optional<bool> answerYesNo(const string& answer) {
 }
 
 
-string toLowerCase(const string& str) {
-    string result = str;
-    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) {
-        return std::tolower(c);
-    });
-    return result;
-}
-
-
-bool isStringInList(const string& element, const vector<string>& list) {
-    return std::find(list.begin(), list.end(), element) != list.end();
-}
-
-
-void processTask(const string& imagePath, int taskId) {
-    double oldImageSize = getFileSizeInKB(imagePath);
-//    {
-//        std::unique_lock<std::mutex> lock(mtx);
-//        std::cout << "Processing Task " << taskId << " on Thread " << std::this_thread::get_id() << std::endl;
-//    }
-
-    std::optional<Mat> readResult = readImage(imagePath);
-    if (!readResult.has_value()) {
-        return;
-    }
-    Mat img = readResult.value();
-
-    auto resizeResult = resizeImage(img);
-    if (get<0>(resizeResult).has_value()) {
-        img = get<0>(resizeResult).value();
-    }
-
-    string fileExtension;
-    if (convertToJPEG == true) {
-        fileExtension = ".jpg";
-    } else {
-        fileExtension = getFileExtension(imagePath);
-    }
-    vector<int> compressionParams;
-    compressionParams = getCompressionParamsForImage(fileExtension);
-
-    // TODO compress image and compare size to resized image, if compressed size is smaller, save resized&compressed image, otherwise save just resized image.
-    saveImage(imagePath, img, compressionParams);
-
+// Largest images first: started early they overlap with the rest of the work, started last they'd run alone at the end
+// of the run while the other cores idle. The order only covers the window of images the scan has found ahead of the
+// processing, so the first images start as soon as they're listed. Every task takes whichever image is largest in the
+// window when it starts (the pool's deques would reorder fixed ones), and waits until its memory estimate fits into the
+// budget. Renditions encode their sizes as subtasks on the same pool. Called by the scan threads.
+void scheduleImage(ThreadPool& pool, ScheduleWindow& window, MemoryBudget& memoryBudget, ScheduledImage image) {
     {
-        std::lock_guard<std::mutex> lock(mtx);
-        activeThreads--;
+        std::unique_lock<std::mutex> lock(window.mtx);
+        window.cvNotFull.wait(lock, [&window] { return window.images.size() < scheduleWindowSize; });
+        window.images.push(std::move(image));
     }
-
-    cvThreads.notify_all();
-
-    printDownscaledImageStats(imagePath, oldImageSize,get<1>(resizeResult), get<2>(resizeResult), get<3>(resizeResult), get<4>(resizeResult));
-}
-
-
-void printDownscaledImageStats(const string& imagePath, const double& oldImageSize, int oldWidth, int oldHeight, int newWidth, int newHeight) {
-    double newImageSize = getFileSizeInKB(imagePath);
-    std::ostringstream oss1;
-    oss1 << std::fixed << std::setprecision(2) << newImageSize;
-    string strNewImageSize = oss1.str();
-    std::ostringstream oss2;
-    oss2 << std::fixed << std::setprecision(2) << oldImageSize;
-    string strOldImageSize = oss2.str();
-
-    string msg = std::format("{}", imagePath);
-    vector<string> texts;
-    vector<string> colors;
-    vector<int> paddings = {26, 34, 0};
-    vector<string> alignments = {"left", "left", "left"};
-    string fileSizeDiff;
-    string fileSizeDiffColor;
-
-    if (oldImageSize > newImageSize) {
-        fileSizeDiff = std::format("{}kB > {}kB", strOldImageSize, strNewImageSize);
-        fileSizeDiffColor = "green";
-    } else {
-        fileSizeDiff = std::format("{}kB < {}kB", strOldImageSize, strNewImageSize);
-        fileSizeDiffColor = "red";
-    }
-
-    string oldDimensions = std::format("[{}x{}]", oldWidth, oldHeight);
-    string newDimensions = std::format("[{}x{}]", newWidth, newHeight);
-
-    if (newWidth == -1) {
-        string notDownscaled = std::format("{} (not downscaled)", oldDimensions);
-        texts = {fileSizeDiff, notDownscaled, msg};
-        colors = {fileSizeDiffColor, "yellow", "light-yellow"};
-    } else {
-        string downscaled = std::format("{} => {}", oldDimensions, newDimensions);
-        texts = {fileSizeDiff, downscaled, msg};
-        colors = {fileSizeDiffColor, "blue", "light-yellow"};
-    }
-
-    coutPlusPlus(texts, colors, true, paddings, alignments);
-}
-
-
-string getFileExtension(const string& filePath) {
-    fs::path path(filePath);
-    return path.extension().string();
-}
-
-
-int getFileSize(const string& filePath) {
-    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
-    if (!file)
-        return -1; // Error opening the file
-
-    std::streampos fileSize = file.tellg();
-    file.close();
-    return (int) fileSize;
-}
-
-
-double getFileSizeInKB(const string& filePath) {
-    std::streampos fileSize = getFileSize(filePath);
-    if (fileSize == -1) {
-        cerrPlus("Failed to get image file size.");
-    }
-    double sizeKB = (double) fileSize / 1024.0;
-
-    return sizeKB;
+    pool.submit([&pool, &window, &memoryBudget] {
+        std::unique_lock<std::mutex> lock(window.mtx);
+        ScheduledImage image = window.images.top();
+        window.images.pop();
+        lock.unlock();
+        window.cvNotFull.notify_one();
+
+        MemoryReservation reservation(memoryBudget, image.peakBytes);
+        runImageTask(image.path, pool, image.isKnownOutdated);
+    });
 }
 
 
-void runTasks(const vector<string>& imagePaths) {
-    unsigned int numTasks = imagePaths.size();
-    for (int i = 0; i < numTasks; ++i) {
-        // Wait until a thread is available
-        std::unique_lock<std::mutex> lock(mtx);
-        cvThreads.wait(lock, [] { return activeThreads < std::thread::hardware_concurrency(); });
-
-        activeThreads++;
-
-        std::thread t(processTask, imagePaths[i], i);
-        t.detach();
+void runImageTask(const string& imagePath, ThreadPool& pool, bool isKnownOutdated) {
+    int taskId = nextTaskId++;
+    try {
+        if (renditions.empty()) {
+            processTask(imagePath, taskId, isKnownOutdated);
+        } else {
+            processRenditionsTask(imagePath, pool, isKnownOutdated);
+        }
+    } catch (const std::exception& e) {
+        recordImage(ImageOutcome::Failed, StatsClock::now());
+        cerrPlus("Failed to process the image: " + imagePath + " (" + e.what() + ")");
+    } catch (...) {
+        // Not left to the pool, the watch loop's bookkeeping after the task has to run too
+        recordImage(ImageOutcome::Failed, StatsClock::now());
+        cerrPlus("Failed to process the image: " + imagePath);
     }
 }
 
 
-void processDirectory(const string& directoryPath) {
-    vector<string> imagePaths;
-    for (const auto& entry : fs::directory_iterator(directoryPath)) {
-        if (fs::is_directory(entry)) {
-            // Process subdirectory recursively
-            processDirectory(entry.path().string());
-        } else if (fs::is_regular_file(entry)) {
-            const string& filePath = entry.path().string();
-            const string& fileExtension = entry.path().extension().string();
-
-            std::vector<string> supportedExtensions = {".jpg", ".jpeg", ".png", "webp"};
-            if (isStringInList(toLowerCase(fileExtension), supportedExtensions)) {
-                imagePaths.push_back(filePath);
-            }
-        }
+size_t getMemoryBudget() {
+    if (memoryBudgetBytes.has_value()) {
+        return memoryBudgetBytes.value();
     }
-    runTasks(imagePaths);
+    // The rest is headroom for the buffer pool, the encoders' own allocations and estimates that were too low
+    return detectMemoryLimit() / 4 * 3;
 }
 
 
@@ -373,90 +1049,12 @@ string getRelativePath(const string& initialPath, const string& filePath) {
 }
 
 
-std::optional<Mat> readImage(const string& imagePath) {
-    Mat image = cv::imread(imagePath);
-
-    if (image.empty()) {
-        cerrPlus("Failed to load the image: " + imagePath);
-        return std::nullopt;
-    }
-    return image;
-}
-
-
-void saveImage(const string& outputFileName, const Mat& image, const vector<int>& compressionParams) {
-    if (convertToJPEG == true && compressionParams.empty() == false) {
-        // TODO outputFileName = outputFileName(without_previous_extension).jpg
-        // TODO delete original image (separate function)
-    }
-    if (compressionParams.empty()) {
-        imwrite(outputFileName, image);
-        return;
-    } else {
-        imwrite(outputFileName, image, compressionParams);
-        return;
-    }
-}
-
-
-vector<int> getCompressionParamsForImage(const string& imageType) {
-    vector<int> compressionParams;
-    if (imageType == ".jpg" || imageType == ".jpeg") {
-        compressionParams.push_back(cv::IMWRITE_JPEG_QUALITY);
-        int imgQuality = 100 - (imageCompression * 10);
-        // Set the desired compression level [0(max compression/lowest image quality), 100(no compression/highest image quality)]
-        compressionParams.push_back(imgQuality);
-    } else if (imageType == ".png") {
-        compressionParams.push_back(cv::IMWRITE_PNG_COMPRESSION);
-        int imgCompression =  static_cast<int>(imageCompression * 9 / 10.0);
-        // Set the desired compression level [0(no compression/highest image quality), 9(max compression/lowest image quality)]
-        compressionParams.push_back(imgCompression);
-    } else if (imageType == ".webp") {
-        compressionParams.push_back(cv::IMWRITE_WEBP_QUALITY);
-        int imgQuality = 100 - (imageCompression * 10);
-        // Set the desired compression level [0(max compression/lowest image quality), 100(no compression/highest image quality)]
-        compressionParams.push_back(imgQuality);
-    }
-//    } else if (imageType == ".tiff") {
-//        compressionParams.push_back(cv::IMWRITE_TIFF_COMPRESSION);
-//        int imgCompression = -1;  // TODO - different types of compression for .tiff
-////      Set the desired compression level [0(no compression/best image quality), 9(max compression/worst image quality)]
-//        compressionParams.push_back(imgCompression);
-//    }
-
-    return compressionParams;
-}
-
-
-std::tuple<std::optional<Mat>, int, int, int, int> resizeImage(const Mat& image) {
-    int width = image.cols;
-    int height = image.rows;
-
-    if (width <= maxImageLength && height <= maxImageLength) {
-        return make_tuple(std::nullopt, width, height, -1, -1);
-    }
-
-    int newWidth, newHeight;
-    if (width > height) {
-        newWidth = maxImageLength;
-        newHeight = maxImageLength * height / width;
-    } else {
-        newWidth = maxImageLength * width / height;
-        newHeight = maxImageLength;
-    }
-
-    Mat resizedImage;
-    resize(image, resizedImage, cv::Size(newWidth, newHeight));
-
-    return std::make_tuple(resizedImage, width, height, newWidth, newHeight);
-}
-
-
 void createBackup(const string& dir) {
     // TODO
 }
 
 
+#ifdef _WIN32
 string selectFolder() {
     coutPlus("Select a directory with images...", "blue");
 
@@ -480,94 +1078,21 @@ string selectFolder() {
         CoTaskMemFree(pItemIdList);
     } else {
         coutPlus("Directory selection canceled", "red");
-        selectFolder();
+        return selectFolder();
     }
 
     return szPath;
 }
-
-
-void coutPlusPlus(const vector<string>& texts, const vector<string>& colors, bool endLine, const vector<int>& paddings, const vector<string>& alignments) {
-    {
-        std::lock_guard<std::mutex> lock(mtx);
-
-        if (paddings.empty()) {
-            for (size_t i = 0; i < texts.size(); ++i) {
-                setConsoleTextColor(stoi(getColorEscapeSequence(colors[i])));
-                std::cout << texts[i];
-                setConsoleTextColor(stoi(getColorEscapeSequence("DEFAULT")));
-            }
-        }
-        else {
-            for (size_t i = 0; i < texts.size(); ++i) {
-                std::cout << std::setfill('.') << std::setw(paddings[i]);
-                if (alignments[i] == "left") std::cout << std::left;
-                if (alignments[i] == "right") std::cout << std::right;
-                setConsoleTextColor(stoi(getColorEscapeSequence(colors[i])));
-                std::cout << texts[i];
-                setConsoleTextColor(stoi(getColorEscapeSequence("DEFAULT")));
-            }
-        }
-        if (endLine) {
-            std::cout << std::endl;
-        }
-    }
-}
-
-
-void coutPlus(const string& text, const string& color, bool endLine) {
-    {
-        std::lock_guard<std::mutex> lock(mtx);
-
-        setConsoleTextColor(stoi(getColorEscapeSequence(color)));
-        std::cout << text;
-        if (endLine) {
-            std::cout << std::endl;
-        }
-        setConsoleTextColor(stoi(getColorEscapeSequence("DEFAULT")));
-    }
-}
-
-
-void cerrPlus(const string& text) {
-    {
-        std::lock_guard<std::mutex> lock(mtx);
-        setConsoleTextColor(stoi(getColorEscapeSequence("DEFAULT")));
-        std::cerr << text << std::endl;
+#else
+string selectFolder() {
+    coutPlus("Enter the directory with images:\n>> ", "blue", false);
+    string directory;
+    std::getline(std::cin >> std::ws, directory);
+    if (!fs::is_directory(directory)) {
+        coutPlus("Not a directory: " + directory, "red");
+        return selectFolder();
     }
+    coutPlus("Selected directory: " + directory, "yellow");
+    return directory;
 }
-
-
-void setConsoleTextColor(int colorCode) {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    SetConsoleTextAttribute(hConsole, colorCode);
-}
-
-
-string getColorEscapeSequence(const string& color) {
-    static std::unordered_map<string, int> colorMap = {
-            {"DEFAULT", FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE},
-            {"red", FOREGROUND_RED | FOREGROUND_INTENSITY},
-            {"green", FOREGROUND_GREEN | FOREGROUND_INTENSITY},
-            {"blue", FOREGROUND_BLUE | FOREGROUND_INTENSITY},
-            {"yellow", FOREGROUND_RED | FOREGROUND_GREEN},
-            {"light-yellow", FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY},
-            {"pink", FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY},
-            {"light-blue", FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY}
-    };
-
-    auto it = colorMap.find(color);
-    if (it != colorMap.end()) {
-        int colorCode = it->second;
-        return std::to_string(colorCode);
-    }
-
-    // Return default color if color is not found
-    auto defaultColor = colorMap.find("DEFAULT");
-    if (defaultColor != colorMap.end()) {
-        int defaultColorCode = defaultColor->second;
-        return std::to_string(defaultColorCode);
-    }
-
-    return "";
-}
\ No newline at end of file
+#endif
\ No newline at end of file
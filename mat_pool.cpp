@@ -0,0 +1,108 @@
+#include "mat_pool.h"
+#include <bit>
+
+
+namespace {
+    const size_t minPooledSize = 256 * 1024;
+
+
+    // Rounds up to the next of 8 steps between two powers of two, so at most 1/8 of a block is wasted
+    size_t getSizeClass(size_t size) {
+        if (size < minPooledSize) {
+            return 0;
+        }
+        size_t step = std::bit_floor(size) / 8;
+        return (size + step - 1) / step * step;
+    }
+}
+
+
+MatPool::MatPool(size_t maxCachedBytes) : maxCachedBytes(maxCachedBytes) {}
+
+
+cv::UMatData* MatPool::allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag,
+                                cv::UMatUsageFlags) const {
+    // Same layout as OpenCV's default allocator: continuous rows, or the caller's steps for user data
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step != nullptr) {
+            if (data != nullptr && step[i] != CV_AUTOSTEP) {
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+
+    auto* umatData = new cv::UMatData(this);
+    umatData->data = umatData->origdata = data != nullptr ? static_cast<uchar*>(data) : static_cast<uchar*>(takeBlock(total));
+    umatData->size = total;
+    if (data != nullptr) {
+        umatData->flags |= cv::UMatData::USER_ALLOCATED;
+    }
+    return umatData;
+}
+
+
+bool MatPool::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+
+void MatPool::deallocate(cv::UMatData* data) const {
+    if (data == nullptr) {
+        return;
+    }
+    if (!(data->flags & cv::UMatData::USER_ALLOCATED)) {
+        returnBlock(data->origdata, data->size);
+        data->origdata = nullptr;
+    }
+    delete data;
+}
+
+
+size_t MatPool::getCachedBytes() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return cachedBytes;
+}
+
+
+void* MatPool::takeBlock(size_t size) const {
+    size_t sizeClass = getSizeClass(size);
+    if (sizeClass == 0) {
+        return cv::fastMalloc(size);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = freeBlocks.find(sizeClass);
+        if (it != freeBlocks.end() && !it->second.empty()) {
+            void* block = it->second.back();
+            it->second.pop_back();
+            cachedBytes -= sizeClass;
+            return block;
+        }
+    }
+    return cv::fastMalloc(sizeClass);
+}
+
+
+void MatPool::returnBlock(void* block, size_t size) const {
+    size_t sizeClass = getSizeClass(size);
+    if (sizeClass != 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (cachedBytes + sizeClass <= maxCachedBytes) {
+            freeBlocks[sizeClass].push_back(block);
+            cachedBytes += sizeClass;
+            return;
+        }
+    }
+    cv::fastFree(block);
+}
+
+
+void installMatPool(size_t maxCachedBytes) {
+    // Never deleted, Mats in static storage may still be freed after main returns
+    static MatPool* pool = new MatPool(maxCachedBytes);
+    cv::Mat::setDefaultAllocator(pool);
+}
@@ -0,0 +1,43 @@
+#ifndef IMAGE_DOWNSCALER_MAT_POOL_H
+#define IMAGE_DOWNSCALER_MAT_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+// Mat allocator that keeps freed pixel buffers for the next image instead of handing them back to the system. Every
+// image allocates a few buffers of several MB (decoded, rotated, resized); the C allocator returns blocks that large to
+// the OS right away, so without the pool each one costs an mmap, page faults on first touch and an munmap, and long runs
+// fragment the heap. Sizes are rounded up to classes 1/8 of a power of two apart, so similar (not only identical) image
+// sizes share buffers. Small buffers go straight to the system allocator. Shared by all threads.
+class MatPool : public cv::MatAllocator {
+public:
+    explicit MatPool(size_t maxCachedBytes);
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    size_t getCachedBytes() const;
+
+private:
+    void* takeBlock(size_t size) const;
+    void returnBlock(void* block, size_t size) const;
+
+    const size_t maxCachedBytes;
+    mutable std::mutex mtx;
+    mutable std::unordered_map<size_t, std::vector<void*>> freeBlocks;  // by size class
+    mutable size_t cachedBytes = 0;
+};
+
+
+// Makes a MatPool holding at most maxCachedBytes of free buffers the allocator of every Mat created from now on.
+// The pool lives until the process exits.
+void installMatPool(size_t maxCachedBytes);
+
+
+#endif //IMAGE_DOWNSCALER_MAT_POOL_H
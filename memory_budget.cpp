@@ -0,0 +1,138 @@
+#include "memory_budget.h"
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace {
+    // A limit file holds a number of bytes, or "max" if there is no limit
+    std::optional<size_t> readLimitFile(const std::string& filePath) {
+        std::ifstream file(filePath);
+        std::string value;
+        if (!(file >> value) || value == "max") {
+            return std::nullopt;
+        }
+        try {
+            return (size_t) std::stoull(value);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+    }
+
+
+    std::optional<size_t> getCgroupLimit() {
+#ifdef _WIN32
+        return std::nullopt;
+#else
+        // /proc/self/cgroup has "0::/path" for cgroup v2 and "N:...,memory,...:/path" for the v1 memory controller.
+        // The path is relative to the mounted hierarchy; inside a container the container's own cgroup is usually
+        // mounted at the root instead, so the root is tried as well.
+        std::ifstream cgroupFile("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(cgroupFile, line)) {
+            size_t firstColon = line.find(':');
+            size_t secondColon = line.find(':', firstColon + 1);
+            if (firstColon == std::string::npos || secondColon == std::string::npos) {
+                continue;
+            }
+            std::string controllers = "," + line.substr(firstColon + 1, secondColon - firstColon - 1) + ",";
+            std::string cgroupPath = line.substr(secondColon + 1);
+
+            std::optional<size_t> limit;
+            if (controllers == ",,") {
+                limit = readLimitFile("/sys/fs/cgroup" + cgroupPath + "/memory.max");
+                if (!limit.has_value()) {
+                    limit = readLimitFile("/sys/fs/cgroup/memory.max");
+                }
+            } else if (controllers.find(",memory,") != std::string::npos) {
+                // v1 reports "no limit" as a huge number, the comparison with the physical memory takes care of it
+                limit = readLimitFile("/sys/fs/cgroup/memory" + cgroupPath + "/memory.limit_in_bytes");
+                if (!limit.has_value()) {
+                    limit = readLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+                }
+            }
+            if (limit.has_value()) {
+                return limit;
+            }
+        }
+        return std::nullopt;
+#endif
+    }
+
+
+    size_t getPhysicalMemory() {
+#ifdef _WIN32
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+        if (!GlobalMemoryStatusEx(&status)) {
+            return 0;
+        }
+        return (size_t) status.ullTotalPhys;
+#else
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGESIZE);
+        if (pages <= 0 || pageSize <= 0) {
+            return 0;
+        }
+        return (size_t) pages * (size_t) pageSize;
+#endif
+    }
+}
+
+
+MemoryBudget::MemoryBudget(size_t limitBytes) : limitBytes(limitBytes) {}
+
+
+void MemoryBudget::acquire(size_t bytes) {
+    if (limitBytes == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    cvReleased.wait(lock, [&] { return usedBytes == 0 || usedBytes + bytes <= limitBytes; });
+    usedBytes += bytes;
+}
+
+
+void MemoryBudget::release(size_t bytes) {
+    if (limitBytes == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        usedBytes -= std::min(bytes, usedBytes);
+    }
+    // Every waiting task checks again, one release can make room for several smaller ones
+    cvReleased.notify_all();
+}
+
+
+size_t MemoryBudget::getLimit() const {
+    return limitBytes;
+}
+
+
+MemoryReservation::MemoryReservation(MemoryBudget& budget, size_t bytes) : budget(budget), bytes(bytes) {
+    budget.acquire(bytes);
+}
+
+
+MemoryReservation::~MemoryReservation() {
+    budget.release(bytes);
+}
+
+
+size_t detectMemoryLimit() {
+    size_t physicalMemory = getPhysicalMemory();
+    std::optional<size_t> cgroupLimit = getCgroupLimit();
+    if (cgroupLimit.has_value() && (physicalMemory == 0 || cgroupLimit.value() < physicalMemory)) {
+        return cgroupLimit.value();
+    }
+    return physicalMemory;
+}
@@ -0,0 +1,48 @@
+#ifndef IMAGE_DOWNSCALER_MEMORY_BUDGET_H
+#define IMAGE_DOWNSCALER_MEMORY_BUDGET_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+
+// Bytes the running tasks are expected to need at their peak. acquire() waits until a task's estimate fits next to the
+// ones already running, so a few huge images run with less concurrency instead of getting the process OOM-killed. A
+// task larger than the whole budget still runs, alone. Shared by all worker threads.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limitBytes);  // 0 = no limit
+
+    void acquire(size_t bytes);
+    void release(size_t bytes);
+    size_t getLimit() const;
+
+private:
+    const size_t limitBytes;
+    size_t usedBytes = 0;
+    std::mutex mtx;
+    std::condition_variable cvReleased;
+};
+
+
+// Holds a task's share of a MemoryBudget for as long as it lives, so the share goes back however the task ends
+class MemoryReservation {
+public:
+    MemoryReservation(MemoryBudget& budget, size_t bytes);  // waits like MemoryBudget::acquire()
+    ~MemoryReservation();
+
+    MemoryReservation(const MemoryReservation&) = delete;
+    MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+private:
+    MemoryBudget& budget;
+    size_t bytes;
+};
+
+
+// Memory this process may use: the cgroup (v2 or v1) limit if it has one below the physical memory, otherwise the
+// physical memory. 0 if neither can be found out.
+size_t detectMemoryLimit();
+
+
+#endif //IMAGE_DOWNSCALER_MEMORY_BUDGET_H
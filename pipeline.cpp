@@ -0,0 +1,218 @@
+#include "pipeline.h"
+#include "downscaler.h"
+
+
+namespace {
+    const size_t maxFreeFileBuffers = 8;  // the queues hold the rest, a buffer that doesn't fit here is freed
+
+
+    unsigned int getDefaultStageThreads(unsigned int divisor) {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        if (hardwareThreads == 0) {
+            hardwareThreads = 1;
+        }
+        return std::max(1u, hardwareThreads / divisor);
+    }
+}
+
+
+Pipeline::Pipeline(const PipelineConfig& config)
+        : pathQueue(4096),  // paths are cheap, this one is limited by count
+          rawQueue(config.queueBytes),
+          decodedQueue(config.queueBytes),
+          resizedQueue(config.queueBytes) {
+    unsigned int numReaders = config.readers > 0 ? config.readers : 2;
+    unsigned int numDecoders = config.decoders > 0 ? config.decoders : getDefaultStageThreads(2);
+    unsigned int numResizers = config.resizers > 0 ? config.resizers : getDefaultStageThreads(4);
+    unsigned int numEncoders = config.encoders > 0 ? config.encoders : getDefaultStageThreads(2);
+
+    // Counters are set before any thread starts, so the last thread of a stage can tell it's the last one
+    runningReaders = numReaders;
+    runningDecoders = numDecoders;
+    runningResizers = numResizers;
+
+    for (unsigned int i = 0; i < numReaders; ++i) {
+        threads.emplace_back(&Pipeline::readerLoop, this);
+    }
+    for (unsigned int i = 0; i < numDecoders; ++i) {
+        threads.emplace_back(&Pipeline::decoderLoop, this);
+    }
+    for (unsigned int i = 0; i < numResizers; ++i) {
+        threads.emplace_back(&Pipeline::resizerLoop, this);
+    }
+    for (unsigned int i = 0; i < numEncoders; ++i) {
+        threads.emplace_back(&Pipeline::encoderLoop, this);
+    }
+}
+
+
+Pipeline::~Pipeline() {
+    finish();
+}
+
+
+void Pipeline::submit(const std::string& imagePath) {
+    pathQueue.push(imagePath, 1);
+}
+
+
+void Pipeline::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    // Closing the first queue ripples through the stages: the last thread of every stage closes the next queue
+    pathQueue.close();
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+
+void Pipeline::readerLoop() {
+    while (std::optional<std::string> imagePath = pathQueue.pop()) {
+        StatsClock::time_point startTime = StatsClock::now();
+        // The path is moved into the queue, the error handling needs its own copy
+        std::string path = imagePath.value();
+        try {
+            if (isImageUpToDate(path, startTime) || shouldSkipImage(path)) {
+                continue;
+            }
+            std::vector<uchar> fileBytes = takeFileBuffer();
+            if (!readFileInto(path, fileBytes)) {
+                recycleFileBuffer(std::move(fileBytes));
+                recordImage(ImageOutcome::Failed, startTime);
+                continue;
+            }
+            size_t weight = fileBytes.size();
+            rawQueue.push(RawImage{std::move(imagePath.value()), std::move(fileBytes), startTime}, weight);
+        } catch (const std::exception& e) {
+            recordImage(ImageOutcome::Failed, startTime);
+            cerrPlus("Failed to read the image: " + path + " (" + e.what() + ")");
+        }
+    }
+
+    if (--runningReaders == 0) {
+        rawQueue.close();
+    }
+}
+
+
+// A decoder is done with the bytes on another thread than the reader that read them, so instead of a thread_local
+// buffer the readers share the ones the decoders hand back
+std::vector<uchar> Pipeline::takeFileBuffer() {
+    std::lock_guard<std::mutex> lock(fileBuffersMtx);
+    if (fileBuffers.empty()) {
+        return {};
+    }
+    std::vector<uchar> buffer = std::move(fileBuffers.back());
+    fileBuffers.pop_back();
+    return buffer;
+}
+
+
+void Pipeline::recycleFileBuffer(std::vector<uchar>&& buffer) {
+    trimFileBuffer(buffer);
+    if (buffer.capacity() == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(fileBuffersMtx);
+    if (fileBuffers.size() < maxFreeFileBuffers) {
+        fileBuffers.push_back(std::move(buffer));
+    }
+}
+
+
+void Pipeline::decoderLoop() {
+    while (std::optional<RawImage> rawImage = rawQueue.pop()) {
+        // rawImage is freed halfway through, the error handling can't rely on it
+        std::string path = rawImage->path;
+        StatsClock::time_point startTime = rawImage->startTime;
+        int oldFileSize = (int) rawImage->bytes.size();
+        try {
+            std::optional<LoadedImage> loadedImage = decodeImage(rawImage->bytes, path);
+            // The encoded bytes aren't needed anymore, their buffer goes back to the readers before waiting on the
+            // next queue
+            recycleFileBuffer(std::move(rawImage->bytes));
+            rawImage.reset();
+            if (!loadedImage.has_value()) {
+                recordImage(ImageOutcome::Failed, startTime);
+                continue;
+            }
+
+            DecodedImage decodedImage;
+            decodedImage.path = path;
+            decodedImage.startTime = startTime;
+            decodedImage.oldFileSize = oldFileSize;
+            decodedImage.loadedImage = std::move(loadedImage.value());
+
+            size_t weight = getPixelBytes(decodedImage.loadedImage.image) + decodedImage.loadedImage.metadata.size();
+            decodedQueue.push(std::move(decodedImage), weight);
+        } catch (const std::exception& e) {
+            recordImage(ImageOutcome::Failed, startTime);
+            cerrPlus("Failed to decode the image: " + path + " (" + e.what() + ")");
+        }
+    }
+
+    if (--runningDecoders == 0) {
+        decodedQueue.close();
+    }
+}
+
+
+void Pipeline::resizerLoop() {
+    while (std::optional<DecodedImage> decodedImage = decodedQueue.pop()) {
+        try {
+            auto resizeResult = resizeImage(decodedImage->loadedImage);
+            if (get<0>(resizeResult).has_value()) {
+                decodedImage->loadedImage.image = get<0>(resizeResult).value();
+            }
+            decodedImage->oldWidth = get<1>(resizeResult);
+            decodedImage->oldHeight = get<2>(resizeResult);
+            decodedImage->newWidth = get<3>(resizeResult);
+            decodedImage->newHeight = get<4>(resizeResult);
+
+            size_t weight = getPixelBytes(decodedImage->loadedImage.image) + decodedImage->loadedImage.metadata.size();
+            resizedQueue.push(std::move(decodedImage.value()), weight);
+        } catch (const std::exception& e) {
+            recordImage(ImageOutcome::Failed, decodedImage->startTime);
+            cerrPlus("Failed to resize the image: " + decodedImage->path + " (" + e.what() + ")");
+        }
+    }
+
+    if (--runningResizers == 0) {
+        resizedQueue.close();
+    }
+}
+
+
+void Pipeline::encoderLoop() {
+    while (std::optional<DecodedImage> resizedImage = resizedQueue.pop()) {
+        try {
+            bool wasResized = resizedImage->newWidth != -1;
+            std::optional<WrittenImage> writtenImage = writeImage(resizedImage->path, resizedImage->loadedImage.image,
+                                                                  wasResized, resizedImage->loadedImage.metadata,
+                                                                  resizedImage->oldFileSize);
+            bool written = writtenImage.has_value();
+            std::string outputPath = written ? writtenImage->path : resizedImage->path;
+            int newFileSize = written ? writtenImage->fileSize : resizedImage->oldFileSize;
+            recordImage(getImageOutcome(wasResized, written), resizedImage->startTime, resizedImage->oldFileSize, std::max(newFileSize, 0));
+            markImageUpToDate(outputPath, written ? std::optional(writtenImage->hash) : std::nullopt);
+
+            printDownscaledImageStats(outputPath, resizedImage->oldFileSize / 1024.0, newFileSize / 1024.0,
+                                      resizedImage->oldWidth, resizedImage->oldHeight, resizedImage->newWidth,
+                                      resizedImage->newHeight, !written);
+        } catch (const std::exception& e) {
+            recordImage(ImageOutcome::Failed, resizedImage->startTime);
+            cerrPlus("Failed to save the image: " + resizedImage->path + " (" + e.what() + ")");
+        }
+    }
+}
+
+
+size_t Pipeline::getPixelBytes(const cv::Mat& image) {
+    return image.total() * image.elemSize();
+}
@@ -0,0 +1,82 @@
+#ifndef IMAGE_DOWNSCALER_PIPELINE_H
+#define IMAGE_DOWNSCALER_PIPELINE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "bounded_queue.h"
+#include "downscaler.h"
+#include "stats.h"
+
+
+struct PipelineConfig {
+    unsigned int readers = 2;
+    unsigned int decoders = 0;  // 0 = pick from std::thread::hardware_concurrency()
+    unsigned int resizers = 0;
+    unsigned int encoders = 0;
+    size_t queueBytes = 256ull * 1024 * 1024;  // limit of every queue between two stages
+};
+
+
+// Runs every image through separate reader -> decoder -> resizer -> encoder/writer stages, each with its own threads.
+// The stages are joined by queues limited by the bytes they hold (raw file bytes between the reader and the decoder,
+// decoded pixels after that), so a slow stage stalls the ones before it instead of piling up full resolution Mats.
+class Pipeline {
+public:
+    explicit Pipeline(const PipelineConfig& config);
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Blocks while the reader stage is saturated.
+    void submit(const std::string& imagePath);
+    // Closes the input and waits for every submitted image to be written.
+    void finish();
+
+private:
+    struct RawImage {
+        std::string path;
+        std::vector<uchar> bytes;
+        StatsClock::time_point startTime;
+    };
+
+    struct DecodedImage {
+        std::string path;
+        LoadedImage loadedImage;
+        StatsClock::time_point startTime;
+        int oldFileSize = 0;
+        int oldWidth = 0;
+        int oldHeight = 0;
+        int newWidth = -1;
+        int newHeight = -1;
+    };
+
+    void readerLoop();
+    void decoderLoop();
+    void resizerLoop();
+    void encoderLoop();
+
+    std::vector<uchar> takeFileBuffer();
+    void recycleFileBuffer(std::vector<uchar>&& buffer);
+    static size_t getPixelBytes(const cv::Mat& image);
+
+    BoundedQueue<std::string> pathQueue;
+    BoundedQueue<RawImage> rawQueue;
+    BoundedQueue<DecodedImage> decodedQueue;
+    BoundedQueue<DecodedImage> resizedQueue;
+
+    std::atomic<unsigned int> runningReaders = 0;
+    std::atomic<unsigned int> runningDecoders = 0;
+    std::atomic<unsigned int> runningResizers = 0;
+    std::mutex fileBuffersMtx;
+    std::vector<std::vector<uchar>> fileBuffers;  // read buffers the decoders are done with, capacity kept
+    std::vector<std::thread> threads;
+    bool finished = false;
+};
+
+
+#endif //IMAGE_DOWNSCALER_PIPELINE_H
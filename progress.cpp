@@ -0,0 +1,69 @@
+#include "progress.h"
+#include <chrono>
+#include <format>
+#include "downscaler.h"
+#include "stats.h"
+
+
+namespace {
+    // Weight of the last interval in the smoothed rate
+    const double rateSmoothing = 0.3;
+
+
+    string formatDuration(double seconds) {
+        auto totalSeconds = (uint64_t) seconds;
+        if (totalSeconds >= 3600) {
+            return std::format("{}:{:02}:{:02}", totalSeconds / 3600, totalSeconds / 60 % 60, totalSeconds % 60);
+        }
+        return std::format("{}:{:02}", totalSeconds / 60, totalSeconds % 60);
+    }
+}
+
+
+ProgressReporter::ProgressReporter(double intervalSeconds)
+        : intervalSeconds(intervalSeconds), startCount(getFinishedImageCount()), thread([this] { run(); }) {}
+
+
+ProgressReporter::~ProgressReporter() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        isStopping = true;
+    }
+    cvStop.notify_all();
+    thread.join();
+}
+
+
+void ProgressReporter::setTotal(uint64_t numImages) {
+    std::lock_guard<std::mutex> lock(mtx);
+    total = numImages;
+}
+
+
+void ProgressReporter::run() {
+    auto interval = std::chrono::duration_cast<StatsClock::duration>(std::chrono::duration<double>(intervalSeconds));
+    StatsClock::time_point lastTime = StatsClock::now();
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!cvStop.wait_for(lock, interval, [this] { return isStopping; })) {
+        StatsClock::time_point now = StatsClock::now();
+        printProgress(std::chrono::duration<double>(now - lastTime).count());
+        lastTime = now;
+    }
+}
+
+
+// Called with mtx held
+void ProgressReporter::printProgress(double elapsedSeconds) {
+    uint64_t done = getFinishedImageCount() - startCount;
+    double lastRate = elapsedSeconds > 0 ? (double) (done - lastCount) / elapsedSeconds : 0.0;
+    rate = rate < 0 ? lastRate : rateSmoothing * lastRate + (1 - rateSmoothing) * rate;
+    lastCount = done;
+
+    string text = total > 0 ? std::format("Progress: {}/{} images ({:.1f}%)", done, total, 100.0 * done / total)
+                            : std::format("Progress: {} images", done);
+    text += std::format(", {:.1f} images/s", rate);
+    if (total > 0 && done < total && rate > 0) {
+        text += ", ETA " + formatDuration((double) (total - done) / rate);
+    }
+    coutPlus(text, "yellow");
+}
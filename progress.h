@@ -0,0 +1,40 @@
+#ifndef IMAGE_DOWNSCALER_PROGRESS_H
+#define IMAGE_DOWNSCALER_PROGRESS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+
+// Prints how many images are done, the current rate and the time left every few seconds, on its own thread, from
+// construction to destruction. Counts every image recorded with recordImage() after it was created. The rate is
+// smoothed over the last few intervals, so it follows a change of pace (e.g. from cached to new images) without
+// jumping around. Until setTotal() it only prints the count and the rate.
+class ProgressReporter {
+public:
+    explicit ProgressReporter(double intervalSeconds);
+    ~ProgressReporter();
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    void setTotal(uint64_t numImages);
+
+private:
+    void run();
+    void printProgress(double elapsedSeconds);
+
+    const double intervalSeconds;
+    const uint64_t startCount;
+    uint64_t total = 0;  // 0 = not known yet
+    uint64_t lastCount = 0;
+    double rate = -1;  // images/s, -1 = no interval finished yet
+    bool isStopping = false;
+    std::mutex mtx;
+    std::condition_variable cvStop;
+    std::thread thread;
+};
+
+
+#endif //IMAGE_DOWNSCALER_PROGRESS_H
@@ -0,0 +1,173 @@
+#include "quality_search.h"
+#include <format>
+#include "downscaler.h"
+#include "image_quality.h"
+
+
+namespace {
+    // Index of the quality value in the (flag, value) pairs, -1 if the format has none
+    int findQualityIndex(const vector<int>& compressionParams) {
+        for (size_t i = 0; i + 1 < compressionParams.size(); i += 2) {
+            if (compressionParams[i] == cv::IMWRITE_JPEG_QUALITY || compressionParams[i] == cv::IMWRITE_WEBP_QUALITY) {
+                // Above 100 is lossless WebP, there's no quality to lower or raise
+                return compressionParams[i + 1] > 100 ? -1 : (int) i + 1;
+            }
+        }
+        return -1;
+    }
+
+
+    // Only the luma is compared, which a JPEG decoder can hand over without the chroma and the color conversion.
+    // The encoded image has no metadata yet, so no EXIF orientation is applied either.
+    Mat decodeLuma(const vector<uchar>& encodedImage) {
+        return cv::imdecode(encodedImage, cv::IMREAD_GRAYSCALE);
+    }
+
+
+    double measureSsim(const SsimReference& reference, const vector<uchar>& encodedImage) {
+        // Counted as part of encoding, it's what picking the quality costs
+        StageTimer timer(Stage::Encode);
+        Mat decoded = decodeLuma(encodedImage);
+        return decoded.empty() ? 0 : computeSsim(reference, decoded);
+    }
+
+
+    bool meetsGuard(const QualityScores& scores, const QualityGuard& guard) {
+        return scores.ssim >= guard.minSsim && scores.psnr >= guard.minPsnr;
+    }
+}
+
+
+std::optional<int> encodeWithQualitySearch(const string& fileExtension, const Mat& image, const vector<int>& compressionParams,
+                                           const QualitySearch& search, vector<uchar>& encodedImage) {
+    vector<int> params = compressionParams;
+    int qualityIndex = findQualityIndex(params);
+    if (qualityIndex == -1 || !search.isEnabled()) {
+        if (!encodeImage(fileExtension, image, encodedImage, params)) {
+            return std::nullopt;
+        }
+        return qualityIndex == -1 ? -1 : params[qualityIndex];
+    }
+
+    int maxQuality = params[qualityIndex];
+    int minQuality = std::min(search.minQuality, maxQuality);
+    // Attempts go here, and swap places with encodedImage when they're the best so far, so nothing is copied
+    thread_local vector<uchar> attempt;
+    auto encodeAt = [&](int quality, vector<uchar>& out) {
+        params[qualityIndex] = quality;
+        return encodeImage(fileExtension, image, out, params);
+    };
+
+    int chosenQuality = -1;  // quality of what's in encodedImage
+    if (search.maxBytes > 0) {
+        if (!encodeAt(maxQuality, encodedImage)) {
+            return std::nullopt;
+        }
+        chosenQuality = maxQuality;
+        if (encodedImage.size() > search.maxBytes) {
+            // The highest quality that fits, or the smallest file if none does
+            bool fits = false;
+            int low = minQuality, high = maxQuality - 1;
+            while (low <= high) {
+                int quality = (low + high + 1) / 2;
+                if (!encodeAt(quality, attempt)) {
+                    return std::nullopt;
+                }
+                bool attemptFits = attempt.size() <= search.maxBytes;
+                if (attemptFits || (!fits && attempt.size() < encodedImage.size())) {
+                    std::swap(encodedImage, attempt);
+                    chosenQuality = quality;
+                    fits = attemptFits;
+                }
+                if (attemptFits) {
+                    low = quality + 1;
+                } else {
+                    high = quality - 1;
+                }
+            }
+        }
+    }
+
+    if (search.minSsim > 0) {
+        SsimReference reference(image);
+        int low = minQuality;
+        if (chosenQuality != -1) {
+            if (measureSsim(reference, encodedImage) >= search.minSsim) {
+                return chosenQuality;
+            }
+            low = chosenQuality + 1;
+        }
+        // The lowest quality that meets the floor, or the highest quality if none does
+        bool meetsFloor = false;
+        int high = maxQuality;
+        while (low <= high) {
+            int quality = (low + high) / 2;
+            if (!encodeAt(quality, attempt)) {
+                return std::nullopt;
+            }
+            if (measureSsim(reference, attempt) >= search.minSsim) {
+                std::swap(encodedImage, attempt);
+                chosenQuality = quality;
+                meetsFloor = true;
+                high = quality - 1;
+            } else {
+                low = quality + 1;
+            }
+        }
+        if (!meetsFloor && chosenQuality != maxQuality) {
+            if (!encodeAt(maxQuality, encodedImage)) {
+                return std::nullopt;
+            }
+            chosenQuality = maxQuality;
+        }
+    }
+    return chosenQuality;
+}
+
+
+bool verifyEncodedImage(const string& fileExtension, const Mat& image, const vector<int>& compressionParams, int quality,
+                        const QualityGuard& guard, vector<uchar>& encodedImage) {
+    vector<int> params = compressionParams;
+    int qualityIndex = findQualityIndex(params);
+    if (qualityIndex == -1) {
+        return true;
+    }
+
+    // Timed on its own, re-encoding counts as encoding
+    std::optional<SsimReference> reference;
+    auto measure = [&image, &reference](const vector<uchar>& encoded) -> std::optional<QualityScores> {
+        StageTimer timer(Stage::Verify, image.total() * image.elemSize());
+        if (!reference.has_value()) {
+            reference.emplace(image);
+        }
+        Mat decoded = decodeLuma(encoded);
+        if (decoded.empty()) {
+            return std::nullopt;
+        }
+        return measureQuality(reference.value(), decoded);
+    };
+
+    std::optional<QualityScores> scores = measure(encodedImage);
+    bool wasReencoded = false;
+    while (scores.has_value() && !meetsGuard(scores.value(), guard) && quality < 100) {
+        quality = std::min(quality + 10, 100);
+        params[qualityIndex] = quality;
+        if (!encodeImage(fileExtension, image, encodedImage, params)) {
+            return false;
+        }
+        wasReencoded = true;
+        scores = measure(encodedImage);
+    }
+    if (!scores.has_value()) {
+        cerrPlus("Failed to decode the encoded image to verify it");
+        return false;
+    }
+
+    bool isAccepted = meetsGuard(scores.value(), guard);
+    recordQuality(scores->ssim, scores->psnr, wasReencoded, !isAccepted);
+    if (!isAccepted) {
+        cerrPlus(std::format("Below the quality floor even at quality 100 (SSIM {:.4f}, PSNR {:.1f} dB), not writing it",
+                             scores->ssim, scores->psnr));
+    }
+    return isAccepted;
+}
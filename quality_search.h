@@ -0,0 +1,42 @@
+#ifndef IMAGE_DOWNSCALER_QUALITY_SEARCH_H
+#define IMAGE_DOWNSCALER_QUALITY_SEARCH_H
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+struct QualitySearch {
+    size_t maxBytes = 0;  // the largest file that's acceptable, 0 = no byte budget
+    double minSsim = 0;  // the lowest SSIM against the (downscaled) image that's acceptable, 0 = no floor
+    int minQuality = 40;  // never search below this quality
+
+    bool isEnabled() const { return maxBytes > 0 || minSsim > 0; }
+};
+
+
+struct QualityGuard {
+    bool enabled = false;  // measure every JPEG/WebP output against the image it was encoded from
+    double minSsim = 0;  // encode again at a higher quality below this, 0 = no floor
+    double minPsnr = 0;  // in dB, 0 = no floor
+};
+
+
+// Binary-searches the JPEG/WebP quality between search.minQuality and the quality in compressionParams (the upper
+// bound) for the highest quality that fits the byte budget, raised if needed to the lowest quality that meets the SSIM
+// floor - the floor wins if both can't be met. Every attempt encodes the same image, nothing is decoded or resized
+// again. Lossless formats (PNG, WebP above quality 100) are encoded once.
+// The result is left in encodedImage, returns the chosen quality (-1 if lossless), or nullopt if encoding failed.
+std::optional<int> encodeWithQualitySearch(const std::string& fileExtension, const cv::Mat& image,
+                                           const std::vector<int>& compressionParams, const QualitySearch& search,
+                                           std::vector<uchar>& encodedImage);
+// Decodes the JPEG/WebP in encodedImage and measures its SSIM and PSNR against the image it was encoded (at quality)
+// from. Below a floor of the guard it's encoded again, 10 quality points higher every time up to 100, until it meets
+// them. Returns false if even that doesn't (or encoding failed), the output should be rejected then. The final scores
+// go to the run statistics. Lossless outputs pass unmeasured.
+bool verifyEncodedImage(const std::string& fileExtension, const cv::Mat& image, const std::vector<int>& compressionParams,
+                        int quality, const QualityGuard& guard, std::vector<uchar>& encodedImage);
+
+
+#endif //IMAGE_DOWNSCALER_QUALITY_SEARCH_H
@@ -0,0 +1,298 @@
+#include "renditions.h"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+#include "downscaler.h"
+#include "thread_pool.h"
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    std::optional<int> parseNumber(const string& text, int minValue, int maxValue) {
+        int value = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc() || end != text.data() + text.size() || value < minValue || value > maxValue) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+
+    vector<string> splitString(const string& text, char separator) {
+        vector<string> parts;
+        std::stringstream stream(text);
+        string part;
+        while (std::getline(stream, part, separator)) {
+            parts.push_back(part);
+        }
+        return parts;
+    }
+
+
+    string replaceAll(string text, const string& from, const string& to) {
+        for (size_t position = text.find(from); position != string::npos; position = text.find(from, position + to.size())) {
+            text.replace(position, from.size(), to);
+        }
+        return text;
+    }
+
+
+    const char renditionListName[] = ".image-downscaler-renditions";
+
+
+    struct RenditionList {
+        fs::path root;  // lexically normal
+        std::ofstream file;  // opened when the first rendition is written into the root
+    };
+
+
+    std::mutex renditionPathsMtx;
+    std::unordered_set<string> renditionPaths;  // lexically normal, generic form
+    std::vector<RenditionList> renditionLists;
+
+
+    string getRenditionKey(const fs::path& path) {
+        return path.lexically_normal().generic_string();
+    }
+
+
+    // Resized from the previous rendition, or taken over as it is if the image isn't larger than this size
+    Mat makeRendition(const Mat& previous, cv::Size size, bool isFirst) {
+        if (size.width >= previous.cols && size.height >= previous.rows) {
+            return previous;
+        }
+        // Only the first step (from the decoded image) uses the configured filter, every later step shrinks an
+        // already smooth image by 2-4x, where averaging the covered pixels is both the fastest and the cleanest
+        Mat rendition;
+        resizeTo(previous, rendition, size, isFirst ? resampleFilter : ResampleFilter::Area);
+        return rendition;
+    }
+
+
+    std::optional<int> writeRendition(const string& imagePath, const Mat& image, const Rendition& rendition,
+                                      const ImageMetadata& metadata) {
+        string outputPath = getRenditionPath(imagePath, rendition, renditionNamePattern);
+        // Only a rendition written before may be replaced, a file that's merely named like one belongs to the user
+        if (fs::exists(outputPath) && !isRenditionPath(outputPath)) {
+            cerrPlus("Not writing the rendition, " + outputPath + " already exists: " + imagePath);
+            return std::nullopt;
+        }
+        string fileExtension = getRenditionExtension(imagePath, rendition);
+        vector<int> compressionParams = getCompressionParamsForImage(fileExtension);
+        if (rendition.quality != -1) {
+            setCompressionParam(compressionParams, cv::IMWRITE_JPEG_QUALITY, rendition.quality);
+            setCompressionParam(compressionParams, cv::IMWRITE_WEBP_QUALITY, rendition.quality);
+        }
+
+        vector<uchar>& encodedImage = getEncodeBuffer();
+        if (!encodeOutputImage(fileExtension, image, compressionParams, metadata, encodedImage)) {
+            cerrPlus("Failed to encode the image: " + outputPath);
+            return std::nullopt;
+        }
+        std::error_code error;
+        fs::create_directories(fs::path(outputPath).parent_path(), error);
+        recordRenditionPath(outputPath);
+        if (!saveEncodedImage(outputPath, encodedImage, imagePath)) {
+            return std::nullopt;
+        }
+        return (int) encodedImage.size();
+    }
+}
+
+
+std::optional<vector<Rendition>> parseRenditions(const string& spec) {
+    vector<Rendition> renditions;
+    for (const string& item : splitString(spec, ',')) {
+        vector<string> fields = splitString(item, ':');
+        if (fields.empty() || fields.size() > 3) {
+            return std::nullopt;
+        }
+
+        Rendition rendition;
+        std::optional<int> maxLength = parseNumber(fields[0], 1, 65535);
+        if (!maxLength.has_value()) {
+            return std::nullopt;
+        }
+        rendition.maxLength = maxLength.value();
+        if (fields.size() >= 2) {
+            string format = toLowerCase(fields[1]);
+            if (format == "jpg" || format == "jpeg") {
+                rendition.format = ".jpg";
+            } else if (format == "png" || format == "webp") {
+                rendition.format = "." + format;
+            } else if (format != "keep" && !format.empty()) {
+                return std::nullopt;
+            }
+        }
+        if (fields.size() == 3) {
+            std::optional<int> quality = parseNumber(fields[2], 1, 100);
+            if (!quality.has_value()) {
+                return std::nullopt;
+            }
+            rendition.quality = quality.value();
+        }
+        renditions.push_back(rendition);
+    }
+    if (renditions.empty()) {
+        return std::nullopt;
+    }
+
+    std::stable_sort(renditions.begin(), renditions.end(), [](const Rendition& a, const Rendition& b) {
+        return a.maxLength > b.maxLength;
+    });
+    return renditions;
+}
+
+
+string getRenditionsName(const vector<Rendition>& renditions) {
+    string name;
+    for (const Rendition& rendition : renditions) {
+        if (!name.empty()) {
+            name += ",";
+        }
+        name += std::to_string(rendition.maxLength) + ":" + (rendition.format.empty() ? "keep" : rendition.format.substr(1));
+        if (rendition.quality != -1) {
+            name += ":" + std::to_string(rendition.quality);
+        }
+    }
+    return name;
+}
+
+
+string getRenditionExtension(const string& imagePath, const Rendition& rendition) {
+    if (!rendition.format.empty()) {
+        return rendition.format;
+    }
+    if (!outputFormat.empty()) {
+        return outputFormat;
+    }
+    return toLowerCase(getFileExtension(imagePath));
+}
+
+
+string getRenditionPath(const string& imagePath, const Rendition& rendition, const string& namePattern) {
+    fs::path path(imagePath);
+    string fileName = replaceAll(namePattern, "{name}", path.stem().string());
+    fileName = replaceAll(fileName, "{size}", std::to_string(rendition.maxLength));
+    fileName = replaceAll(fileName, "{ext}", getRenditionExtension(imagePath, rendition));
+    return (path.parent_path() / fileName).string();
+}
+
+
+void loadRenditionList(const string& root) {
+    fs::path normalRoot = fs::path(root).lexically_normal();
+    std::lock_guard<std::mutex> lock(renditionPathsMtx);
+    for (const RenditionList& list : renditionLists) {
+        if (list.root == normalRoot) {
+            return;
+        }
+    }
+    renditionLists.push_back({normalRoot, {}});
+
+    std::ifstream file(normalRoot / renditionListName);
+    string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) {
+            renditionPaths.insert(getRenditionKey(normalRoot / fs::path(line)));
+        }
+    }
+}
+
+
+bool isRenditionPath(const string& path) {
+    string key = getRenditionKey(path);
+    std::lock_guard<std::mutex> lock(renditionPathsMtx);
+    return renditionPaths.contains(key);
+}
+
+
+void recordRenditionPath(const string& path) {
+    fs::path normalPath = fs::path(path).lexically_normal();
+    std::lock_guard<std::mutex> lock(renditionPathsMtx);
+    if (!renditionPaths.insert(normalPath.generic_string()).second) {
+        return;
+    }
+    // Renditions outside every root (a name pattern with "..") are only known to this run
+    for (RenditionList& list : renditionLists) {
+        fs::path relativePath = normalPath.lexically_relative(list.root);
+        if (relativePath.empty() || *relativePath.begin() == "..") {
+            continue;
+        }
+        if (!list.file.is_open()) {
+            list.file.open(list.root / renditionListName, std::ios::app);
+        }
+        list.file << relativePath.generic_string() << '\n' << std::flush;
+        break;
+    }
+}
+
+
+void processRenditionsTask(const string& imagePath, ThreadPool& pool, bool isKnownOutdated) {
+    StatsClock::time_point startTime = StatsClock::now();
+    if (isImageUpToDate(imagePath, startTime, isKnownOutdated)) {
+        return;
+    }
+    if (dryRun) {
+        previewImage(imagePath, startTime);
+        return;
+    }
+
+    // maxImageLength is the largest rendition, so a reduced or streamed decode already stops at that size
+    vector<uchar>& fileBytes = getFileBuffer();
+    std::optional<LoadedImage> loadedImage;
+    if (readFileInto(imagePath, fileBytes)) {
+        loadedImage = decodeImage(fileBytes, imagePath);
+    }
+    int oldFileSize = (int) fileBytes.size();
+    trimFileBuffer(fileBytes);
+    if (!loadedImage.has_value()) {
+        recordImage(ImageOutcome::Failed, startTime);
+        return;
+    }
+
+    // Largest first, every size is made from the one before it, so no step reads many more pixels than it writes.
+    // The sizes come from the original dimensions, rounding errors don't add up along the cascade.
+    vector<Mat> images;
+    {
+        StageTimer timer(Stage::Resize, loadedImage->image.total() * loadedImage->image.elemSize());
+        for (const Rendition& rendition : renditions) {
+            cv::Size size = getDownscaledSize(loadedImage->originalWidth, loadedImage->originalHeight, rendition.maxLength)
+                    .value_or(cv::Size(loadedImage->originalWidth, loadedImage->originalHeight));
+            images.push_back(makeRendition(images.empty() ? loadedImage->image : images.back(), size, images.empty()));
+        }
+    }
+
+    vector<std::optional<int>> writtenSizes(renditions.size());
+    vector<std::function<void()>> encodeTasks;
+    for (size_t i = 0; i < renditions.size(); ++i) {
+        encodeTasks.push_back([&, i] {
+            writtenSizes[i] = writeRendition(imagePath, images[i], renditions[i], loadedImage->metadata);
+        });
+    }
+    pool.runAll(std::move(encodeTasks));
+
+    int newFileSize = 0;
+    bool allWritten = true;
+    for (size_t i = 0; i < renditions.size(); ++i) {
+        allWritten = allWritten && writtenSizes[i].has_value();
+        newFileSize += writtenSizes[i].value_or(0);
+        if (writtenSizes[i].has_value()) {
+            printDownscaledImageStats(getRenditionPath(imagePath, renditions[i], renditionNamePattern),
+                                      oldFileSize / 1024.0, writtenSizes[i].value() / 1024.0,
+                                      loadedImage->originalWidth, loadedImage->originalHeight, images[i].cols, images[i].rows);
+        }
+    }
+    if (!allWritten) {
+        recordImage(ImageOutcome::Failed, startTime);
+        return;
+    }
+    recordImage(ImageOutcome::Resized, startTime, oldFileSize, newFileSize);
+    markImageUpToDate(imagePath);
+}
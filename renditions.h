@@ -0,0 +1,44 @@
+#ifndef IMAGE_DOWNSCALER_RENDITIONS_H
+#define IMAGE_DOWNSCALER_RENDITIONS_H
+
+#include <optional>
+#include <string>
+#include <vector>
+
+
+class ThreadPool;
+
+
+// One of the sizes every image is written in, next to the original, when renditions are configured
+struct Rendition {
+    int maxLength = 0;  // longer side in pixels, smaller images aren't upscaled
+    std::string format;  // ".jpg", ".png" or ".webp", empty = outputFormat, or the format of the original
+    int quality = -1;  // JPEG and WebP quality, -1 = the one of every other output
+};
+
+
+// "2560,1280,640:webp,256:jpg:60" - sizes, each with an optional format (keep, jpg, png or webp) and quality.
+// Sorted largest first, std::nullopt if the spec is invalid.
+std::optional<std::vector<Rendition>> parseRenditions(const std::string& spec);
+// The canonical spec of the renditions, for the settings key
+std::string getRenditionsName(const std::vector<Rendition>& renditions);
+// Where the rendition of the image goes: namePattern, relative to the image's directory, with {name} (the file name
+// without extension), {size} (maxLength) and {ext} (the extension of the format, with the dot) replaced
+std::string getRenditionPath(const std::string& imagePath, const Rendition& rendition, const std::string& namePattern);
+std::string getRenditionExtension(const std::string& imagePath, const Rendition& rendition);
+
+// The renditions written so far, so they aren't taken for originals. Every root keeps the ones written into it in a
+// list (".image-downscaler-renditions", paths relative to the root), which loadRenditionList() reads for the renditions
+// of earlier runs. Only files that really were written are skipped, an image that just happens to be named like one
+// is still processed.
+void loadRenditionList(const std::string& root);
+bool isRenditionPath(const std::string& path);
+// Called before the rendition is written, so its file event in watch mode is already known
+void recordRenditionPath(const std::string& path);
+
+// Decodes the image once and writes all renditions: every size is reduced from the previous (larger) one, and the
+// renditions are encoded in parallel on the pool. The original isn't changed.
+void processRenditionsTask(const std::string& imagePath, ThreadPool& pool, bool isKnownOutdated = false);
+
+
+#endif //IMAGE_DOWNSCALER_RENDITIONS_H
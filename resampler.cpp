@@ -0,0 +1,646 @@
+#include "resampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IMAGE_DOWNSCALER_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define IMAGE_DOWNSCALER_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2/SSE4.1 instructions in functions explicitly marked for them, MSVC always can
+#if defined(IMAGE_DOWNSCALER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+
+namespace {
+    const double PI = 3.14159265358979323846;
+    const float alphaScale = 1.0f / 255;
+    // Output pixels whose alpha rounds to 0 get no colour, dividing by an alpha that small only magnifies rounding errors
+    const float minVisibleAlpha = 0.5f;
+
+
+    double sinc(double x) {
+        if (x == 0.0) {
+            return 1.0;
+        }
+        x *= PI;
+        return std::sin(x) / x;
+    }
+
+
+    double filterSupport(ResampleFilter filter) {
+        switch (filter) {
+            case ResampleFilter::Area:
+                return 0.5;
+            case ResampleFilter::Bilinear:
+                return 1.0;
+            case ResampleFilter::Bicubic:
+                return 2.0;
+            case ResampleFilter::Lanczos3:
+                return 3.0;
+        }
+        return 1.0;
+    }
+
+
+    double filterValue(ResampleFilter filter, double x) {
+        switch (filter) {
+            case ResampleFilter::Area:
+                return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+            case ResampleFilter::Bilinear:
+                x = std::abs(x);
+                return x < 1.0 ? 1.0 - x : 0.0;
+            case ResampleFilter::Bicubic: {
+                // Keys cubic with a = -0.5
+                const double a = -0.5;
+                x = std::abs(x);
+                if (x < 1.0) {
+                    return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+                }
+                if (x < 2.0) {
+                    return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+                }
+                return 0.0;
+            }
+            case ResampleFilter::Lanczos3:
+                return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+        }
+        return 0.0;
+    }
+
+
+    uint32_t loadUInt32(const uchar* p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+
+    // ---- Scalar reference kernels ----
+    // The vertical pass runs first, straight on the 8-bit source rows, and produces one float row of source width per
+    // output row. The horizontal pass then only runs on output rows and rounds the result back to bytes.
+
+    void verticalPassScalar(const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length, int start = 0) {
+        for (int i = start; i < length; ++i) {
+            float sum = 0.0f;
+            for (int k = 0; k < taps; ++k) {
+                sum += rowWeights[k] * (float) rows[k][i];
+            }
+            dst[i] = sum;
+        }
+    }
+
+
+    // BGRA with straight alpha: the colour of every source pixel is weighted by its alpha as well, so transparent pixels
+    // (whose colour is usually left over from whatever was drawn there) don't bleed into their visible neighbours
+    void verticalPassPremultipliedScalar(const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length,
+                                         int start = 0) {
+        for (int i = start; i < length; i += 4) {
+            float sums[4] = {};
+            for (int k = 0; k < taps; ++k) {
+                const uchar* pixel = rows[k] + i;
+                float colorWeight = (float) pixel[3] * alphaScale * rowWeights[k];
+                for (int c = 0; c < 3; ++c) {
+                    sums[c] += (float) pixel[c] * colorWeight;
+                }
+                sums[3] += (float) pixel[3] * rowWeights[k];
+            }
+            std::memcpy(dst + i, sums, sizeof(sums));
+        }
+    }
+
+
+    // Back from the premultiplied sums of the vertical pass to straight alpha
+    void unpremultiplyScalar(float* pixel) {
+        float alpha = pixel[3];
+        float factor = alpha >= minVisibleAlpha ? 255.0f / alpha : 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            pixel[c] *= factor;
+        }
+    }
+
+
+    uchar roundToByte(float value) {
+        value = std::min(std::max(value, 0.0f), 255.0f);
+        return (uchar) std::lrint(value);
+    }
+
+
+    void horizontalPixelScalar(const float* src, uchar* dst, int x, int channels, const ResampleWeights& weights) {
+        const float* pixelWeights = &weights.weights[(size_t) x * weights.taps];
+        const float* srcPixel = src + (size_t) weights.starts[x] * channels;
+        float sums[4] = {};
+        for (int c = 0; c < channels; ++c) {
+            for (int k = 0; k < weights.taps; ++k) {
+                sums[c] += pixelWeights[k] * srcPixel[k * channels + c];
+            }
+        }
+        if (channels == 4) {
+            unpremultiplyScalar(sums);
+        }
+        for (int c = 0; c < channels; ++c) {
+            dst[x * channels + c] = roundToByte(sums[c]);
+        }
+    }
+
+
+    void horizontalPassScalar(const float* src, uchar* dst, int dstWidth, int channels, const ResampleWeights& weights, int start = 0) {
+        for (int x = start; x < dstWidth; ++x) {
+            horizontalPixelScalar(src, dst, x, channels, weights);
+        }
+    }
+
+
+#ifdef IMAGE_DOWNSCALER_X86
+    // ---- SSE4.1 ----
+    // The SIMD horizontal kernels handle 3 and 4 channel pixels with one 4 float vector per pixel. For BGR the 4th lane
+    // belongs to the next pixel; the loads may read into the padding after the float row and only 3 bytes get stored.
+    // BGRA pixels are premultiplied by the vertical pass and divided by their alpha again before they're stored.
+
+    TARGET_SSE41 void verticalPassSse41(const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length) {
+        int i = 0;
+        for (; i + 4 <= length; i += 4) {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; ++k) {
+                __m128i bytes = _mm_cvtsi32_si128((int) loadUInt32(rows[k] + i));
+                __m128 values = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes));
+                sum = _mm_add_ps(sum, _mm_mul_ps(values, _mm_set1_ps(rowWeights[k])));
+            }
+            _mm_storeu_ps(dst + i, sum);
+        }
+        verticalPassScalar(rows, rowWeights, taps, dst, length, i);
+    }
+
+
+    TARGET_SSE41 void verticalPassPremultipliedSse41(const uchar* const* rows, const float* rowWeights, int taps, float* dst,
+                                                     int length) {
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (int i = 0; i < length; i += 4) {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; ++k) {
+                __m128i bytes = _mm_cvtsi32_si128((int) loadUInt32(rows[k] + i));
+                __m128 values = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes));
+                // alpha / 255 for the colour lanes, 1 for the alpha lane
+                __m128 alpha = _mm_mul_ps(_mm_shuffle_ps(values, values, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_ps(alphaScale));
+                __m128 weight = _mm_mul_ps(_mm_blend_ps(alpha, one, 8), _mm_set1_ps(rowWeights[k]));
+                sum = _mm_add_ps(sum, _mm_mul_ps(values, weight));
+            }
+            _mm_storeu_ps(dst + i, sum);
+        }
+    }
+
+
+    TARGET_SSE41 __m128 unpremultiplySse41(__m128 sum) {
+        __m128 alpha = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(3, 3, 3, 3));
+        // 255 / 0 is infinite, the mask turns it into 0 along with every other alpha below minVisibleAlpha
+        __m128 factor = _mm_and_ps(_mm_div_ps(_mm_set1_ps(255.0f), alpha), _mm_cmpge_ps(alpha, _mm_set1_ps(minVisibleAlpha)));
+        return _mm_blend_ps(_mm_mul_ps(sum, factor), sum, 8);
+    }
+
+
+    TARGET_SSE41 void storePixelSse41(__m128 sum, uchar* dst, int channels) {
+        if (channels == 4) {
+            sum = unpremultiplySse41(sum);
+        }
+        // Round to nearest and saturate to 0-255 on the way down to bytes
+        __m128i values = _mm_cvtps_epi32(sum);
+        values = _mm_packs_epi32(values, values);
+        values = _mm_packus_epi16(values, values);
+        uint32_t packed = (uint32_t) _mm_cvtsi128_si32(values);
+        std::memcpy(dst, &packed, channels);
+    }
+
+
+    TARGET_SSE41 void horizontalPassSse41(const float* src, uchar* dst, int dstWidth, int channels, const ResampleWeights& weights) {
+        for (int x = 0; x < dstWidth; ++x) {
+            const float* broadcastWeights = &weights.broadcastWeights[(size_t) x * weights.taps * 4];
+            const float* srcPixel = src + (size_t) weights.starts[x] * channels;
+
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < weights.taps; ++k) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(srcPixel + k * channels), _mm_loadu_ps(broadcastWeights + k * 4)));
+            }
+            storePixelSse41(sum, dst + x * channels, channels);
+        }
+    }
+
+
+    // ---- AVX2 + FMA ----
+
+    TARGET_AVX2 void verticalPassAvx2(const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length) {
+        int i = 0;
+        for (; i + 16 <= length; i += 16) {
+            __m256 low = _mm256_setzero_ps();
+            __m256 high = _mm256_setzero_ps();
+            for (int k = 0; k < taps; ++k) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+                __m256 weight = _mm256_set1_ps(rowWeights[k]);
+                low = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), weight, low);
+                high = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8))), weight, high);
+            }
+            _mm256_storeu_ps(dst + i, low);
+            _mm256_storeu_ps(dst + i + 8, high);
+        }
+        for (; i + 8 <= length; i += 8) {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < taps; ++k) {
+                __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + i));
+                __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+                sum = _mm256_fmadd_ps(values, _mm256_set1_ps(rowWeights[k]), sum);
+            }
+            _mm256_storeu_ps(dst + i, sum);
+        }
+        verticalPassScalar(rows, rowWeights, taps, dst, length, i);
+    }
+
+
+    // Two BGRA pixels per vector
+    TARGET_AVX2 void verticalPassPremultipliedAvx2(const uchar* const* rows, const float* rowWeights, int taps, float* dst,
+                                                   int length) {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        int i = 0;
+        for (; i + 8 <= length; i += 8) {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < taps; ++k) {
+                __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + i));
+                __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+                __m256 alpha = _mm256_mul_ps(_mm256_shuffle_ps(values, values, _MM_SHUFFLE(3, 3, 3, 3)), _mm256_set1_ps(alphaScale));
+                __m256 weight = _mm256_mul_ps(_mm256_blend_ps(alpha, one, 0x88), _mm256_set1_ps(rowWeights[k]));
+                sum = _mm256_fmadd_ps(values, weight, sum);
+            }
+            _mm256_storeu_ps(dst + i, sum);
+        }
+        verticalPassPremultipliedScalar(rows, rowWeights, taps, dst, length, i);
+    }
+
+
+    TARGET_AVX2 __m128 horizontalPixelAvx2(const float* srcPixel, const float* broadcastWeights, int taps, int channels) {
+        // Two taps per iteration, one in each 128 bit lane
+        __m256 sum = _mm256_setzero_ps();
+        int k = 0;
+        for (; k + 2 <= taps; k += 2) {
+            __m256 pixels;
+            if (channels == 4) {
+                pixels = _mm256_loadu_ps(srcPixel + k * 4);
+            } else {
+                pixels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(srcPixel + k * channels)),
+                                              _mm_loadu_ps(srcPixel + (k + 1) * channels), 1);
+            }
+            sum = _mm256_fmadd_ps(pixels, _mm256_loadu_ps(broadcastWeights + k * 4), sum);
+        }
+        __m128 pixelSum = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        if (k < taps) {
+            pixelSum = _mm_fmadd_ps(_mm_loadu_ps(srcPixel + k * channels), _mm_loadu_ps(broadcastWeights + k * 4), pixelSum);
+        }
+        return pixelSum;
+    }
+
+
+    TARGET_AVX2 void horizontalPassAvx2(const float* src, uchar* dst, int dstWidth, int channels, const ResampleWeights& weights) {
+        size_t weightStride = (size_t) weights.taps * 4;
+        int x = 0;
+        // Two output pixels per iteration, their sums are independent so the FMA latency chains overlap
+        for (; x + 2 <= dstWidth; x += 2) {
+            const float* broadcastWeights = &weights.broadcastWeights[(size_t) x * weightStride];
+            __m128 first = horizontalPixelAvx2(src + (size_t) weights.starts[x] * channels, broadcastWeights, weights.taps, channels);
+            __m128 second = horizontalPixelAvx2(src + (size_t) weights.starts[x + 1] * channels, broadcastWeights + weightStride, weights.taps, channels);
+            storePixelSse41(first, dst + x * channels, channels);
+            storePixelSse41(second, dst + (x + 1) * channels, channels);
+        }
+        for (; x < dstWidth; ++x) {
+            const float* broadcastWeights = &weights.broadcastWeights[(size_t) x * weightStride];
+            __m128 sum = horizontalPixelAvx2(src + (size_t) weights.starts[x] * channels, broadcastWeights, weights.taps, channels);
+            storePixelSse41(sum, dst + x * channels, channels);
+        }
+    }
+#endif
+
+
+#ifdef IMAGE_DOWNSCALER_NEON
+    // ---- NEON ----
+
+    void verticalPassNeon(const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length) {
+        int i = 0;
+        for (; i + 8 <= length; i += 8) {
+            float32x4_t low = vdupq_n_f32(0.0f);
+            float32x4_t high = vdupq_n_f32(0.0f);
+            for (int k = 0; k < taps; ++k) {
+                uint16x8_t words = vmovl_u8(vld1_u8(rows[k] + i));
+                low = vmlaq_n_f32(low, vcvtq_f32_u32(vmovl_u16(vget_low_u16(words))), rowWeights[k]);
+                high = vmlaq_n_f32(high, vcvtq_f32_u32(vmovl_u16(vget_high_u16(words))), rowWeights[k]);
+            }
+            vst1q_f32(dst + i, low);
+            vst1q_f32(dst + i + 4, high);
+        }
+        verticalPassScalar(rows, rowWeights, taps, dst, length, i);
+    }
+
+
+    // Two BGRA pixels per iteration, one in each vector
+    void verticalPassPremultipliedNeon(const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length) {
+        int i = 0;
+        for (; i + 8 <= length; i += 8) {
+            float32x4_t first = vdupq_n_f32(0.0f);
+            float32x4_t second = vdupq_n_f32(0.0f);
+            for (int k = 0; k < taps; ++k) {
+                uint16x8_t words = vmovl_u8(vld1_u8(rows[k] + i));
+                float32x4_t firstValues = vcvtq_f32_u32(vmovl_u16(vget_low_u16(words)));
+                float32x4_t secondValues = vcvtq_f32_u32(vmovl_u16(vget_high_u16(words)));
+                // alpha / 255 for the colour lanes, 1 for the alpha lane
+                float32x4_t firstWeight = vsetq_lane_f32(1.0f, vmulq_n_f32(vdupq_laneq_f32(firstValues, 3), alphaScale), 3);
+                float32x4_t secondWeight = vsetq_lane_f32(1.0f, vmulq_n_f32(vdupq_laneq_f32(secondValues, 3), alphaScale), 3);
+                first = vmlaq_f32(first, firstValues, vmulq_n_f32(firstWeight, rowWeights[k]));
+                second = vmlaq_f32(second, secondValues, vmulq_n_f32(secondWeight, rowWeights[k]));
+            }
+            vst1q_f32(dst + i, first);
+            vst1q_f32(dst + i + 4, second);
+        }
+        verticalPassPremultipliedScalar(rows, rowWeights, taps, dst, length, i);
+    }
+
+
+    float32x4_t unpremultiplyNeon(float32x4_t sum) {
+        float32x4_t alpha = vdupq_laneq_f32(sum, 3);
+        uint32x4_t isVisible = vcgeq_f32(alpha, vdupq_n_f32(minVisibleAlpha));
+        uint32x4_t factor = vandq_u32(vreinterpretq_u32_f32(vdivq_f32(vdupq_n_f32(255.0f), alpha)), isVisible);
+        return vsetq_lane_f32(vgetq_lane_f32(sum, 3), vmulq_f32(sum, vreinterpretq_f32_u32(factor)), 3);
+    }
+
+
+    void horizontalPassNeon(const float* src, uchar* dst, int dstWidth, int channels, const ResampleWeights& weights) {
+        for (int x = 0; x < dstWidth; ++x) {
+            const float* broadcastWeights = &weights.broadcastWeights[(size_t) x * weights.taps * 4];
+            const float* srcPixel = src + (size_t) weights.starts[x] * channels;
+
+            float32x4_t sum = vdupq_n_f32(0.0f);
+            for (int k = 0; k < weights.taps; ++k) {
+                sum = vmlaq_f32(sum, vld1q_f32(srcPixel + k * channels), vld1q_f32(broadcastWeights + k * 4));
+            }
+            if (channels == 4) {
+                sum = unpremultiplyNeon(sum);
+            }
+            uint16x4_t words = vqmovun_s32(vcvtnq_s32_f32(sum));
+            uint8x8_t bytes = vqmovn_u16(vcombine_u16(words, words));
+            uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(bytes), 0);
+            std::memcpy(dst + x * channels, &packed, channels);
+        }
+    }
+#endif
+
+
+    void verticalPass(SimdLevel simdLevel, const uchar* const* rows, const float* rowWeights, int taps, float* dst, int length) {
+#ifdef IMAGE_DOWNSCALER_X86
+        if (simdLevel == SimdLevel::Avx2) {
+            verticalPassAvx2(rows, rowWeights, taps, dst, length);
+            return;
+        }
+        if (simdLevel == SimdLevel::Sse41) {
+            verticalPassSse41(rows, rowWeights, taps, dst, length);
+            return;
+        }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+        if (simdLevel == SimdLevel::Neon) {
+            verticalPassNeon(rows, rowWeights, taps, dst, length);
+            return;
+        }
+#endif
+        verticalPassScalar(rows, rowWeights, taps, dst, length);
+    }
+
+
+    void verticalPassPremultiplied(SimdLevel simdLevel, const uchar* const* rows, const float* rowWeights, int taps, float* dst,
+                                   int length) {
+#ifdef IMAGE_DOWNSCALER_X86
+        if (simdLevel == SimdLevel::Avx2) {
+            verticalPassPremultipliedAvx2(rows, rowWeights, taps, dst, length);
+            return;
+        }
+        if (simdLevel == SimdLevel::Sse41) {
+            verticalPassPremultipliedSse41(rows, rowWeights, taps, dst, length);
+            return;
+        }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+        if (simdLevel == SimdLevel::Neon) {
+            verticalPassPremultipliedNeon(rows, rowWeights, taps, dst, length);
+            return;
+        }
+#endif
+        verticalPassPremultipliedScalar(rows, rowWeights, taps, dst, length);
+    }
+
+
+    void horizontalPass(SimdLevel simdLevel, const float* src, uchar* dst, int dstWidth, int channels, const ResampleWeights& weights) {
+        if (channels == 3 || channels == 4) {
+#ifdef IMAGE_DOWNSCALER_X86
+            if (simdLevel == SimdLevel::Avx2) {
+                horizontalPassAvx2(src, dst, dstWidth, channels, weights);
+                return;
+            }
+            if (simdLevel == SimdLevel::Sse41) {
+                horizontalPassSse41(src, dst, dstWidth, channels, weights);
+                return;
+            }
+#endif
+#ifdef IMAGE_DOWNSCALER_NEON
+            if (simdLevel == SimdLevel::Neon) {
+                horizontalPassNeon(src, dst, dstWidth, channels, weights);
+                return;
+            }
+#endif
+        }
+        horizontalPassScalar(src, dst, dstWidth, channels, weights);
+    }
+}
+
+
+ResampleWeights computeResampleWeights(int srcSize, int dstSize, ResampleFilter filter) {
+    // When downscaling, the filter is stretched over scale source pixels so every source pixel contributes
+    double scale = (double) srcSize / dstSize;
+    double filterScale = std::max(scale, 1.0);
+    double support = filterSupport(filter) * filterScale;
+
+    std::vector<int> starts(dstSize);
+    std::vector<int> counts(dstSize);
+    std::vector<std::vector<double>> pixelWeights(dstSize);
+    int maxCount = 1;
+
+    for (int i = 0; i < dstSize; ++i) {
+        double center = (i + 0.5) * scale;
+        int first = std::max((int) (center - support + 0.5), 0);
+        int last = std::min((int) (center + support + 0.5), srcSize);
+
+        double total = 0.0;
+        for (int j = first; j < last; ++j) {
+            double weight = filterValue(filter, (j - center + 0.5) / filterScale);
+            pixelWeights[i].push_back(weight);
+            total += weight;
+        }
+        if (total != 0.0) {
+            for (double& weight : pixelWeights[i]) {
+                weight /= total;
+            }
+        }
+
+        starts[i] = first;
+        counts[i] = last - first;
+        maxCount = std::max(maxCount, counts[i]);
+    }
+
+    ResampleWeights weights;
+    weights.taps = std::min(maxCount, srcSize);
+    weights.starts.resize(dstSize);
+    weights.weights.assign((size_t) dstSize * weights.taps, 0.0f);
+
+    for (int i = 0; i < dstSize; ++i) {
+        // Windows near the end are moved left so they stay inside the source, the extra taps in front get weight 0
+        int start = std::min(starts[i], srcSize - weights.taps);
+        int offset = starts[i] - start;
+        weights.starts[i] = start;
+        for (int k = 0; k < counts[i]; ++k) {
+            weights.weights[(size_t) i * weights.taps + offset + k] = (float) pixelWeights[i][k];
+        }
+    }
+
+    weights.broadcastWeights.resize(weights.weights.size() * 4);
+    for (size_t i = 0; i < weights.weights.size(); ++i) {
+        std::fill_n(weights.broadcastWeights.begin() + (ptrdiff_t) (i * 4), 4, weights.weights[i]);
+    }
+    return weights;
+}
+
+
+Resampler::Resampler(int srcWidth, int srcHeight, int dstWidth, int dstHeight, int channels, ResampleFilter filter, SimdLevel simdLevel)
+        : srcWidth(srcWidth), srcHeight(srcHeight), dstWidth(dstWidth), dstHeight(dstHeight), channels(channels), simdLevel(simdLevel) {
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0 || channels <= 0) {
+        throw std::invalid_argument("Invalid resampler dimensions");
+    }
+
+    horizontalWeights = computeResampleWeights(srcWidth, dstWidth, filter);
+    verticalWeights = computeResampleWeights(srcHeight, dstHeight, filter);
+
+    ringRowStride = (size_t) srcWidth * channels;
+    ringBuffer.assign(ringRowStride * verticalWeights.taps, 0);
+    // 4 floats of padding let the SIMD kernels load a whole pixel vector for the last BGR pixel
+    columnSums.assign((size_t) srcWidth * channels + 4, 0.0f);
+    rowPointers.resize(verticalWeights.taps);
+}
+
+
+void Resampler::pushRow(const uchar* srcRow) {
+    if (srcRowsPushed >= srcHeight) {
+        return;
+    }
+    // Rows above the window of the next output row aren't needed by anything anymore
+    bool isNeeded = dstRowsWritten >= dstHeight || srcRowsPushed >= verticalWeights.starts[dstRowsWritten];
+    if (isNeeded) {
+        uchar* ringRow = ringBuffer.data() + (size_t) (srcRowsPushed % verticalWeights.taps) * ringRowStride;
+        std::memcpy(ringRow, srcRow, ringRowStride);
+    }
+    srcRowsPushed++;
+}
+
+
+bool Resampler::hasOutputRow() const {
+    return dstRowsWritten < dstHeight && srcRowsPushed >= verticalWeights.starts[dstRowsWritten] + verticalWeights.taps;
+}
+
+
+void Resampler::writeOutputRow(uchar* dstRow) {
+    int start = verticalWeights.starts[dstRowsWritten];
+    for (int k = 0; k < verticalWeights.taps; ++k) {
+        rowPointers[k] = ringBuffer.data() + (size_t) ((start + k) % verticalWeights.taps) * ringRowStride;
+    }
+    resampleRow(rowPointers.data(), dstRow);
+}
+
+
+void Resampler::resampleRow(const uchar* const* srcRows, uchar* dstRow) {
+    const float* rowWeights = &verticalWeights.weights[(size_t) dstRowsWritten * verticalWeights.taps];
+    if (channels == 4) {
+        verticalPassPremultiplied(simdLevel, srcRows, rowWeights, verticalWeights.taps, columnSums.data(), srcWidth * channels);
+    } else {
+        verticalPass(simdLevel, srcRows, rowWeights, verticalWeights.taps, columnSums.data(), srcWidth * channels);
+    }
+    horizontalPass(simdLevel, columnSums.data(), dstRow, dstWidth, channels, horizontalWeights);
+    dstRowsWritten++;
+}
+
+
+void Resampler::resampleImage(const cv::Mat& src, cv::Mat& dst) {
+    // The whole source is in memory already, so the rows are used in place instead of being copied into the ring
+    for (int y = 0; y < dstHeight; ++y) {
+        int start = verticalWeights.starts[y];
+        for (int k = 0; k < verticalWeights.taps; ++k) {
+            rowPointers[k] = src.ptr<uchar>(start + k);
+        }
+        resampleRow(rowPointers.data(), dst.ptr<uchar>(y));
+    }
+    srcRowsPushed = srcHeight;
+}
+
+
+int Resampler::getSrcRowsPushed() const {
+    return srcRowsPushed;
+}
+
+
+int Resampler::getDstRowsWritten() const {
+    return dstRowsWritten;
+}
+
+
+void resampleImage(const cv::Mat& src, cv::Mat& dst, cv::Size dstSize, ResampleFilter filter, SimdLevel simdLevel) {
+    if (src.depth() != CV_8U || (src.channels() != 1 && src.channels() != 3 && src.channels() != 4)) {
+        throw std::invalid_argument("resampleImage only supports 8-bit images with 1, 3 or 4 channels");
+    }
+
+    cv::Mat output(dstSize, src.type());
+    Resampler resampler(src.cols, src.rows, dstSize.width, dstSize.height, src.channels(), filter, simdLevel);
+    resampler.resampleImage(src, output);
+    dst = output;
+}
+
+
+std::optional<ResampleFilter> parseResampleFilter(const std::string& name) {
+    if (name == "area" || name == "box") {
+        return ResampleFilter::Area;
+    }
+    if (name == "bilinear" || name == "linear") {
+        return ResampleFilter::Bilinear;
+    }
+    if (name == "bicubic" || name == "cubic") {
+        return ResampleFilter::Bicubic;
+    }
+    if (name == "lanczos3" || name == "lanczos") {
+        return ResampleFilter::Lanczos3;
+    }
+    return std::nullopt;
+}
+
+
+std::string getResampleFilterName(ResampleFilter filter) {
+    switch (filter) {
+        case ResampleFilter::Area:
+            return "area";
+        case ResampleFilter::Bilinear:
+            return "bilinear";
+        case ResampleFilter::Bicubic:
+            return "bicubic";
+        case ResampleFilter::Lanczos3:
+            return "lanczos3";
+    }
+    return "area";
+}
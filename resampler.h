@@ -0,0 +1,80 @@
+#ifndef IMAGE_DOWNSCALER_RESAMPLER_H
+#define IMAGE_DOWNSCALER_RESAMPLER_H
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "cpu_features.h"
+
+
+enum class ResampleFilter {
+    Area,  // box filter, averages every source pixel covered by the output pixel
+    Bilinear,
+    Bicubic,
+    Lanczos3
+};
+
+
+// Filter weights for one dimension. Every output pixel uses exactly `taps` consecutive source pixels starting at
+// `starts[i]` (weights past the filter's real support are zero), so the SIMD kernels never need a tail loop and never
+// read past the end of a row.
+struct ResampleWeights {
+    int taps = 0;
+    std::vector<int> starts;
+    std::vector<float> weights;  // outputSize * taps
+    std::vector<float> broadcastWeights;  // every weight repeated 4 times, loaded directly into the SIMD pixel lanes
+};
+
+
+// Separable downscaler that can consume the source one row at a time. Source rows are kept in a ring of `taps` rows;
+// as soon as all rows of an output row's window are in the ring, the vertical pass combines them into one float row
+// and the horizontal pass turns that into the output row. Memory use doesn't depend on the source height.
+// 4 channel pixels are BGRA with straight alpha: they're resampled premultiplied, so the colour of transparent pixels
+// doesn't leak into visible ones, and output pixels that end up fully transparent are black.
+class Resampler {
+public:
+    Resampler(int srcWidth, int srcHeight, int dstWidth, int dstHeight, int channels, ResampleFilter filter,
+              SimdLevel simdLevel = detectSimdLevel());
+
+    // srcRow holds srcWidth * channels bytes.
+    void pushRow(const uchar* srcRow);
+    bool hasOutputRow() const;
+    // dstRow receives dstWidth * channels bytes.
+    void writeOutputRow(uchar* dstRow);
+
+    // Resamples a whole in-memory image; dst must already be allocated with the output size.
+    void resampleImage(const cv::Mat& src, cv::Mat& dst);
+
+    int getSrcRowsPushed() const;
+    int getDstRowsWritten() const;
+
+private:
+    void resampleRow(const uchar* const* srcRows, uchar* dstRow);
+
+    int srcWidth;
+    int srcHeight;
+    int dstWidth;
+    int dstHeight;
+    int channels;
+    SimdLevel simdLevel;
+    ResampleWeights horizontalWeights;
+    ResampleWeights verticalWeights;
+    std::vector<uchar> ringBuffer;
+    size_t ringRowStride;
+    std::vector<float> columnSums;
+    std::vector<const uchar*> rowPointers;
+    int srcRowsPushed = 0;
+    int dstRowsWritten = 0;
+};
+
+
+ResampleWeights computeResampleWeights(int srcSize, int dstSize, ResampleFilter filter);
+// Resizes an 8-bit image with 1, 3 or 4 channels.
+void resampleImage(const cv::Mat& src, cv::Mat& dst, cv::Size dstSize, ResampleFilter filter,
+                   SimdLevel simdLevel = detectSimdLevel());
+std::optional<ResampleFilter> parseResampleFilter(const std::string& name);
+std::string getResampleFilterName(ResampleFilter filter);
+
+
+#endif //IMAGE_DOWNSCALER_RESAMPLER_H
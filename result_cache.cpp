@@ -0,0 +1,443 @@
+#include "result_cache.h"
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <sys/stat.h>
+#include "downscaler.h"
+#include "image_quality.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    const string indexHeader = "image-downscaler-cache 1";
+    // Written to the journal once this many entries are waiting, or this long after the last write, whichever comes
+    // first: one write (and fsync) per batch instead of per image, and a kill loses at most one batch
+    const size_t journalBatchSize = 64;
+    const auto journalBatchInterval = std::chrono::seconds(2);
+
+    constexpr uint64_t prime1 = 11400714785074694791ull;
+    constexpr uint64_t prime2 = 14029467366897019727ull;
+    constexpr uint64_t prime3 = 1609587929392839161ull;
+    constexpr uint64_t prime4 = 9650029242287828579ull;
+    constexpr uint64_t prime5 = 2870177450012600261ull;
+
+
+    uint64_t readUInt64LE(const unsigned char* p) {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        if constexpr (std::endian::native == std::endian::big) {
+            value = std::byteswap(value);
+        }
+        return value;
+    }
+
+
+    uint32_t readUInt32LE(const unsigned char* p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        if constexpr (std::endian::native == std::endian::big) {
+            value = std::byteswap(value);
+        }
+        return value;
+    }
+
+
+    uint64_t xxHashRound(uint64_t accumulator, uint64_t input) {
+        accumulator += input * prime2;
+        accumulator = std::rotl(accumulator, 31);
+        return accumulator * prime1;
+    }
+
+
+    uint64_t xxHashMergeRound(uint64_t accumulator, uint64_t value) {
+        accumulator ^= xxHashRound(0, value);
+        return accumulator * prime1 + prime4;
+    }
+}
+
+
+ResultCache::ResultCache(const string& rootDirectory, const string& indexPath)
+        : rootDirectory(rootDirectory), indexPath(indexPath), settingsKey(getSettingsKey()), journalPath(indexPath + ".journal"),
+          lastJournalWrite(std::chrono::steady_clock::now()) {}
+
+
+ResultCache::~ResultCache() {
+    flushJournal();
+    if (journalFile != nullptr) {
+        std::fclose(journalFile);
+    }
+}
+
+
+bool ResultCache::load() {
+    bool isIndexRead = true;
+    {
+        std::ifstream file(indexPath);
+        if (file) {
+            isIndexRead = readEntries(file, false);
+        }
+    }
+    if (!isIndexRead) {
+        cerrPlus("Unknown cache index format, ignoring it: " + indexPath);
+    }
+
+    std::ifstream journal(journalPath);
+    if (!journal) {
+        return isIndexRead;
+    }
+    if (!readEntries(journal, true)) {
+        cerrPlus("Unknown cache journal format, ignoring it: " + journalPath);
+    }
+    journal.close();
+    // Merged into the index now, so the journal of this run starts empty and doesn't grow from run to run.
+    // A dry run doesn't write anything, it only uses the entries.
+    if (!dryRun) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            dirty = true;
+        }
+        save();
+    }
+    return isIndexRead;
+}
+
+
+// Index and journal have the same lines after the same header
+bool ResultCache::readEntries(std::istream& stream, bool isJournal) {
+    string line;
+    if (!std::getline(stream, line) || line != indexHeader) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    while (std::getline(stream, line)) {
+        // The last journal line may be cut off by a crash, the path in it could be a shorter, different one
+        if (isJournal && stream.eof()) {
+            break;
+        }
+        // hash, size, mtime, settings, path - the path is last, so it may contain anything but a newline
+        std::istringstream fields(line);
+        Entry entry;
+        string hash;
+        if (!(fields >> hash >> entry.stamp.size >> entry.stamp.mtimeNs >> entry.settingsKey)) {
+            continue;
+        }
+        auto [hashEnd, error] = std::from_chars(hash.data(), hash.data() + hash.size(), entry.hash, 16);
+        if (error != std::errc() || hashEnd != hash.data() + hash.size()) {
+            continue;
+        }
+        string path;
+        fields.get();
+        std::getline(fields, path);
+        if (path.empty()) {
+            continue;
+        }
+        if (entry.settingsKey == settingsKey) {
+            outputHashes.insert(entry.hash);
+            outputSizes.insert(entry.stamp.size);
+        }
+        entries[path] = std::move(entry);
+    }
+    return true;
+}
+
+
+bool ResultCache::save() {
+    // Same order as writeJournal(), the journal is closed below
+    std::lock_guard<std::mutex> journalLock(journalMtx);
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!dirty) {
+        return true;
+    }
+
+    string tempPath = indexPath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file << indexHeader << '\n';
+        for (const auto& [path, entry] : entries) {
+            file << std::format("{:016x} {} {} {} {}\n", entry.hash, entry.stamp.size, entry.stamp.mtimeNs, entry.settingsKey, path);
+        }
+        if (!file.flush()) {
+            cerrPlus("Failed to write the cache index: " + tempPath);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(tempPath, indexPath, error);
+    if (error) {
+        cerrPlus("Failed to replace the cache index: " + indexPath + " (" + error.message() + ")");
+        return false;
+    }
+    dirty = false;
+
+    // A crash before this point only means the journal is replayed again, its entries are the same as in the index
+    if (journalFile != nullptr) {
+        std::fclose(journalFile);
+        journalFile = nullptr;
+    }
+    journalRecords.clear();
+    numJournalRecords = 0;
+    fs::remove(journalPath, error);
+    return true;
+}
+
+
+void ResultCache::flushJournal() {
+    writeJournal();
+}
+
+
+bool ResultCache::isUpToDate(const string& imagePath) {
+    std::optional<FileStamp> stamp;
+    {
+        StageTimer timer(Stage::Stat);
+        stamp = getFileStamp(imagePath);
+    }
+    if (!stamp.has_value()) {
+        return false;
+    }
+
+    string key = getIndexKey(imagePath);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.settingsKey == settingsKey && it->second.stamp == stamp.value()) {
+            return true;
+        }
+        // No earlier output has this size, so none can have the same content either - no need to hash the file
+        if (!outputSizes.contains(stamp->size)) {
+            return false;
+        }
+    }
+
+    // Touched, copied or moved: only the content can tell whether it's an output of an earlier run
+    std::optional<uint64_t> hash = hashFile(imagePath);
+    if (!hash.has_value()) {
+        return false;
+    }
+
+    bool isJournalDue = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!outputHashes.contains(hash.value())) {
+            return false;
+        }
+        if (dryRun) {
+            return true;
+        }
+        entries[key] = Entry{stamp.value(), hash.value(), settingsKey};
+        isJournalDue = addToJournal(key, entries[key]);
+        dirty = true;
+    }
+    if (isJournalDue) {
+        writeJournal();
+    }
+    return true;
+}
+
+
+void ResultCache::update(const string& imagePath, std::optional<uint64_t> contentHash) {
+    // A dry run doesn't change anything, the cache included
+    if (dryRun) {
+        return;
+    }
+    std::optional<FileStamp> stamp = getFileStamp(imagePath);
+    std::optional<uint64_t> hash = contentHash.has_value() ? contentHash : hashFile(imagePath);
+    if (!stamp.has_value() || !hash.has_value()) {
+        return;
+    }
+
+    string key = getIndexKey(imagePath);
+    bool isJournalDue = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        entries[key] = Entry{stamp.value(), hash.value(), settingsKey};
+        outputHashes.insert(hash.value());
+        outputSizes.insert(stamp->size);
+        isJournalDue = addToJournal(key, entries[key]);
+        dirty = true;
+    }
+    if (isJournalDue) {
+        writeJournal();
+    }
+}
+
+
+size_t ResultCache::size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return entries.size();
+}
+
+
+// Called with mtx held. Only adds the entry to the batch, true if it's time to write the batch.
+bool ResultCache::addToJournal(const string& key, const Entry& entry) {
+    journalRecords += std::format("{:016x} {} {} {} {}\n", entry.hash, entry.stamp.size, entry.stamp.mtimeNs, entry.settingsKey, key);
+    numJournalRecords++;
+    return numJournalRecords >= journalBatchSize || std::chrono::steady_clock::now() - lastJournalWrite >= journalBatchInterval;
+}
+
+
+// Called without mtx. The batch is only swapped out under it, the write and the fsync hold journalMtx alone, so the
+// workers looking up or adding entries don't wait for the disk. Batches are taken in order under journalMtx, so they
+// reach the file in order too, and a later entry of an image always replays after an earlier one.
+void ResultCache::writeJournal() {
+    std::lock_guard<std::mutex> journalLock(journalMtx);
+    string records;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        records.swap(journalRecords);
+        numJournalRecords = 0;
+        lastJournalWrite = std::chrono::steady_clock::now();
+    }
+    if (records.empty()) {
+        return;
+    }
+    if (journalFile == nullptr) {
+        std::error_code error;
+        bool isNew = !fs::exists(journalPath, error) || fs::file_size(journalPath, error) == 0;
+        journalFile = std::fopen(journalPath.c_str(), "ab");
+        if (journalFile == nullptr) {
+            cerrPlus("Failed to open the cache journal: " + journalPath);
+            return;
+        }
+        if (isNew) {
+            records.insert(0, indexHeader + "\n");
+        }
+    }
+
+    bool written = std::fwrite(records.data(), 1, records.size(), journalFile) == records.size() &&
+                   std::fflush(journalFile) == 0;
+    if (written && fsyncPolicy != FsyncPolicy::None) {
+#ifdef _WIN32
+        _commit(_fileno(journalFile));
+#else
+        fsync(fileno(journalFile));
+#endif
+    }
+    if (!written) {
+        cerrPlus("Failed to write the cache journal: " + journalPath);
+    }
+}
+
+
+string ResultCache::getIndexKey(const string& imagePath) const {
+    // Relative to the root, so the index stays valid when the whole tree is moved
+    return fs::path(imagePath).lexically_relative(rootDirectory).generic_string();
+}
+
+
+std::optional<FileStamp> getFileStamp(const string& filePath) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(filePath.c_str(), &info) != 0) {
+        return std::nullopt;
+    }
+    return FileStamp{(uint64_t) info.st_size, (int64_t) info.st_mtime * 1000000000};
+#elif defined(__APPLE__)
+    struct stat info;
+    if (stat(filePath.c_str(), &info) != 0) {
+        return std::nullopt;
+    }
+    return FileStamp{(uint64_t) info.st_size, (int64_t) info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec};
+#else
+    struct stat info;
+    if (stat(filePath.c_str(), &info) != 0) {
+        return std::nullopt;
+    }
+    return FileStamp{(uint64_t) info.st_size, (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec};
+#endif
+}
+
+
+// XXH64, https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+uint64_t xxHash64(const void* data, size_t size, uint64_t seed) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxHashRound(v1, readUInt64LE(p));
+            v2 = xxHashRound(v2, readUInt64LE(p + 8));
+            v3 = xxHashRound(v3, readUInt64LE(p + 16));
+            v4 = xxHashRound(v4, readUInt64LE(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        hash = xxHashMergeRound(hash, v1);
+        hash = xxHashMergeRound(hash, v2);
+        hash = xxHashMergeRound(hash, v3);
+        hash = xxHashMergeRound(hash, v4);
+    } else {
+        hash = seed + prime5;
+    }
+
+    hash += size;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= xxHashRound(0, readUInt64LE(p));
+        hash = std::rotl(hash, 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        hash ^= readUInt32LE(p) * prime1;
+        hash = std::rotl(hash, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash ^= *p * prime5;
+        hash = std::rotl(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+
+std::optional<uint64_t> hashFile(const string& filePath) {
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return std::nullopt;
+    }
+    std::streamsize fileSize = file.tellg();
+    StageTimer timer(Stage::Read, fileSize);
+    vector<char> fileBytes(fileSize);
+    file.seekg(0);
+    if (!file.read(fileBytes.data(), fileSize)) {
+        return std::nullopt;
+    }
+    return xxHash64(fileBytes.data(), fileBytes.size());
+}
+
+
+string getSettingsKey() {
+    return std::format("{}:{}:{}:{}:{}:{}:{}:{}:{}:{}:{}:{:x}:{}:{}:{}:{}:{}:{}:{}", maxImageLength, imageCompression, imageQuality,
+                       autoOutputFormat ? "auto" : (outputFormat.empty() ? "keep" : outputFormat.substr(1)), getResampleFilterName(resampleFilter),
+                       (int) processingPolicy, qualitySearch.maxBytes, qualitySearch.minSsim, qualitySearch.minQuality,
+                       getEncoderBackendName(encoderBackend), progressiveJpeg ? 1 : 0, jpegSamplingFactor,
+                       getMetadataPolicyName(metadataPolicy), maxMetadataBytes,
+                       renditions.empty() ? "none" : getRenditionsName(renditions), renditionNamePattern,
+                       qualityGuard.minSsim, qualityGuard.minPsnr, qualityMetricVersion);
+}
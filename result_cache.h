@@ -0,0 +1,87 @@
+#ifndef IMAGE_DOWNSCALER_RESULT_CACHE_H
+#define IMAGE_DOWNSCALER_RESULT_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+
+    bool operator==(const FileStamp& other) const = default;
+};
+
+
+// Remembers every image that was already processed with the current settings, so re-runs over the same tree skip
+// it. Images are matched by path, size and mtime (one stat); when only the mtime changed, or the image is new, its
+// content hash is compared with the hashes of the outputs already in the index, so a touched or moved image that was
+// already processed isn't re-encoded (and doesn't lose quality) again.
+// Every new entry is also appended to a journal next to the index (in batches), and load() replays it, so a run that
+// is killed halfway through doesn't lose what it did: the next run skips those images instead of recompressing them.
+class ResultCache {
+public:
+    ResultCache(const std::string& rootDirectory, const std::string& indexPath);
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Returns false if the index exists but can't be read; a missing index is just empty. The journal of an interrupted
+    // run is merged into the index right away.
+    bool load();
+    // Writes to a temporary file and renames it over the index, so a crash never leaves a half written index. The
+    // journal is deleted afterwards, everything in it is in the index now.
+    bool save();
+    // Appends the entries that are still waiting for the next batch to the journal.
+    void flushJournal();
+    bool isUpToDate(const std::string& imagePath);
+    // Records the current state of the file as the output for the current settings. contentHash is the xxHash64 of the
+    // bytes just written to it, without it the file is read again to hash it.
+    void update(const std::string& imagePath, std::optional<uint64_t> contentHash = std::nullopt);
+    size_t size();
+
+private:
+    struct Entry {
+        FileStamp stamp;
+        uint64_t hash = 0;
+        std::string settingsKey;
+    };
+
+    std::string getIndexKey(const std::string& imagePath) const;
+    bool readEntries(std::istream& stream, bool isJournal);
+    bool addToJournal(const std::string& key, const Entry& entry);
+    void writeJournal();
+
+    std::string rootDirectory;
+    std::string indexPath;
+    std::string settingsKey;
+    std::mutex mtx;
+    std::mutex journalMtx;  // the journal file, taken before mtx when both are needed
+    std::unordered_map<std::string, Entry> entries;  // relative path -> entry
+    std::unordered_set<uint64_t> outputHashes;  // hashes of the entries made with the current settings
+    std::unordered_set<uint64_t> outputSizes;  // and their sizes, most files can be ruled out without hashing them
+    bool dirty = false;
+    std::string journalPath;
+    std::FILE* journalFile = nullptr;  // guarded by journalMtx, the rest by mtx
+    std::string journalRecords;  // not written yet
+    size_t numJournalRecords = 0;
+    std::chrono::steady_clock::time_point lastJournalWrite;
+};
+
+
+std::optional<FileStamp> getFileStamp(const std::string& filePath);
+uint64_t xxHash64(const void* data, size_t size, uint64_t seed = 0);
+std::optional<uint64_t> hashFile(const std::string& filePath);
+// Every setting that changes the output, entries made with different settings are processed again.
+std::string getSettingsKey();
+
+
+#endif //IMAGE_DOWNSCALER_RESULT_CACHE_H
@@ -0,0 +1,370 @@
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "downscaler.h"
+
+
+namespace {
+    std::mutex registryMtx;
+    std::vector<std::shared_ptr<RunStats>> registeredStats;  // owned here too, so stats outlive their thread
+    std::atomic<uint64_t> finishedImages = 0;  // whatever the outcome, read by the progress reporter while workers run
+
+
+    RunStats& getThreadStats() {
+        thread_local std::shared_ptr<RunStats> threadStats = [] {
+            auto stats = std::make_shared<RunStats>();
+            std::lock_guard<std::mutex> lock(registryMtx);
+            registeredStats.push_back(stats);
+            return stats;
+        }();
+        return *threadStats;
+    }
+
+
+    double toMs(uint64_t ns) {
+        return (double) ns / 1e6;
+    }
+
+
+    double toMB(uint64_t bytes) {
+        return (double) bytes / (1024.0 * 1024.0);
+    }
+
+
+    string formatMicroseconds(uint64_t us) {
+        if (us >= 1000000) {
+            return std::format("{}s", us / 1000000);
+        }
+        if (us >= 1000) {
+            return std::format("{}ms", us / 1000);
+        }
+        return std::format("{}us", us);
+    }
+
+
+    void printHistogram(const DurationStats& stats) {
+        size_t first = numHistogramBuckets;
+        size_t last = 0;
+        uint64_t highest = 0;
+        for (size_t i = 0; i < numHistogramBuckets; ++i) {
+            if (stats.histogram[i] > 0) {
+                first = std::min(first, i);
+                last = i;
+                highest = std::max(highest, stats.histogram[i]);
+            }
+        }
+        if (highest == 0) {
+            return;
+        }
+
+        const int barWidth = 40;
+        for (size_t i = first; i <= last; ++i) {
+            string range = std::format("{}-{}", formatMicroseconds(i == 0 ? 0 : 1ull << i), formatMicroseconds(1ull << (i + 1)));
+            int bar = (int) ((stats.histogram[i] * barWidth + highest - 1) / highest);
+            coutPlus(std::format("  {:>13} |{:<40} {}", range, string(bar, '#'), stats.histogram[i]));
+        }
+    }
+
+
+    void appendDurationJson(string& json, const DurationStats& stats) {
+        json += std::format(R"({{"count": {}, "total_ms": {:.3f}, "mean_ms": {:.3f}, "p50_ms": {:.3f}, "p99_ms": {:.3f}, "max_ms": {:.3f}, "bytes": {}, "histogram_us_log2": [)",
+                            stats.count, toMs(stats.totalNs), stats.count > 0 ? toMs(stats.totalNs) / stats.count : 0.0,
+                            stats.getPercentileMs(0.50), stats.getPercentileMs(0.99), toMs(stats.maxNs), stats.bytes);
+        for (size_t i = 0; i < numHistogramBuckets; ++i) {
+            json += std::format("{}{}", i > 0 ? ", " : "", stats.histogram[i]);
+        }
+        json += "]}";
+    }
+
+
+    void appendDurationCsv(string& csv, const string& prefix, const DurationStats& stats) {
+        csv += std::format("{}.count,{}\n", prefix, stats.count);
+        csv += std::format("{}.total_ms,{:.3f}\n", prefix, toMs(stats.totalNs));
+        csv += std::format("{}.mean_ms,{:.3f}\n", prefix, stats.count > 0 ? toMs(stats.totalNs) / stats.count : 0.0);
+        csv += std::format("{}.p50_ms,{:.3f}\n", prefix, stats.getPercentileMs(0.50));
+        csv += std::format("{}.p99_ms,{:.3f}\n", prefix, stats.getPercentileMs(0.99));
+        csv += std::format("{}.max_ms,{:.3f}\n", prefix, toMs(stats.maxNs));
+        csv += std::format("{}.bytes,{}\n", prefix, stats.bytes);
+    }
+}
+
+
+void DurationStats::add(uint64_t durationNs, uint64_t byteCount) {
+    ++count;
+    totalNs += durationNs;
+    maxNs = std::max(maxNs, durationNs);
+    bytes += byteCount;
+
+    uint64_t us = durationNs / 1000;
+    size_t bucket = us > 0 ? (size_t) std::bit_width(us) - 1 : 0;
+    ++histogram[std::min(bucket, numHistogramBuckets - 1)];
+}
+
+
+void DurationStats::merge(const DurationStats& other) {
+    count += other.count;
+    totalNs += other.totalNs;
+    maxNs = std::max(maxNs, other.maxNs);
+    bytes += other.bytes;
+    for (size_t i = 0; i < numHistogramBuckets; ++i) {
+        histogram[i] += other.histogram[i];
+    }
+}
+
+
+double DurationStats::getPercentileMs(double percentile) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, (uint64_t) (percentile * (double) count + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < numHistogramBuckets; ++i) {
+        seen += histogram[i];
+        if (seen >= target) {
+            double upperBoundMs = (double) (1ull << (i + 1)) / 1000.0;
+            return std::min(upperBoundMs, toMs(maxNs));
+        }
+    }
+    return toMs(maxNs);
+}
+
+
+void QualityStats::add(double ssim, double psnr, bool wasReencoded, bool wasRejected) {
+    minSsim = count == 0 ? ssim : std::min(minSsim, ssim);
+    minPsnr = count == 0 ? psnr : std::min(minPsnr, psnr);
+    ++count;
+    ssimSum += ssim;
+    psnrSum += psnr;
+    reencoded += wasReencoded ? 1 : 0;
+    rejected += wasRejected ? 1 : 0;
+}
+
+
+void QualityStats::merge(const QualityStats& other) {
+    if (other.count == 0) {
+        return;
+    }
+    minSsim = count == 0 ? other.minSsim : std::min(minSsim, other.minSsim);
+    minPsnr = count == 0 ? other.minPsnr : std::min(minPsnr, other.minPsnr);
+    count += other.count;
+    ssimSum += other.ssimSum;
+    psnrSum += other.psnrSum;
+    reencoded += other.reencoded;
+    rejected += other.rejected;
+}
+
+
+void RunStats::merge(const RunStats& other) {
+    for (size_t i = 0; i < numStages; ++i) {
+        stages[i].merge(other.stages[i]);
+    }
+    images.merge(other.images);
+    for (size_t i = 0; i < outcomes.size(); ++i) {
+        outcomes[i] += other.outcomes[i];
+    }
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    quality.merge(other.quality);
+}
+
+
+StageTimer::StageTimer(Stage stage, uint64_t bytes) : stage(stage), bytes(bytes), start(StatsClock::now()) {}
+
+
+StageTimer::~StageTimer() {
+    recordStage(stage, StatsClock::now() - start, bytes);
+}
+
+
+void StageTimer::setBytes(uint64_t byteCount) {
+    bytes = byteCount;
+}
+
+
+void recordStage(Stage stage, StatsClock::duration duration, uint64_t bytes) {
+    uint64_t durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    getThreadStats().stages[(size_t) stage].add(durationNs, bytes);
+}
+
+
+void recordImage(ImageOutcome outcome, StatsClock::time_point startTime, uint64_t bytesIn, uint64_t bytesOut) {
+    RunStats& stats = getThreadStats();
+    ++stats.outcomes[(size_t) outcome];
+    finishedImages.fetch_add(1, std::memory_order_relaxed);
+    if (outcome == ImageOutcome::Skipped || outcome == ImageOutcome::Cached || outcome == ImageOutcome::Failed) {
+        return;
+    }
+    uint64_t durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(StatsClock::now() - startTime).count();
+    stats.images.add(durationNs, bytesIn);
+    stats.bytesIn += bytesIn;
+    stats.bytesOut += bytesOut;
+}
+
+
+void recordQuality(double ssim, double psnr, bool wasReencoded, bool wasRejected) {
+    getThreadStats().quality.add(ssim, psnr, wasReencoded, wasRejected);
+}
+
+
+uint64_t getFinishedImageCount() {
+    return finishedImages.load(std::memory_order_relaxed);
+}
+
+
+RunStats collectRunStats() {
+    RunStats total;
+    std::lock_guard<std::mutex> lock(registryMtx);
+    for (const auto& stats : registeredStats) {
+        total.merge(*stats);
+    }
+    return total;
+}
+
+
+void printRunStats(const RunStats& stats, double wallSeconds) {
+    uint64_t processed = stats.images.count;
+    coutPlus(std::format("\nProcessed {} images in {:.2f}s ({:.2f} images/s, {:.2f} MB/s)", processed, wallSeconds,
+                         wallSeconds > 0 ? processed / wallSeconds : 0.0, wallSeconds > 0 ? toMB(stats.bytesIn) / wallSeconds : 0.0), "yellow");
+
+    string outcomes;
+    for (size_t i = 0; i < stats.outcomes.size(); ++i) {
+        outcomes += std::format("{}{}: {}", i > 0 ? ", " : "", getImageOutcomeName((ImageOutcome) i), stats.outcomes[i]);
+    }
+    coutPlus("  " + outcomes);
+
+    if (processed > 0 && !dryRun) {
+        double savedMB = toMB(stats.bytesIn) - toMB(stats.bytesOut);
+        double savedPercent = stats.bytesIn > 0 ? 100.0 * savedMB / toMB(stats.bytesIn) : 0.0;
+        coutPlus(std::format("  {:.2f} MB => {:.2f} MB, saved {:.2f} MB ({:.1f}%, {:.1f} kB per image)", toMB(stats.bytesIn),
+                             toMB(stats.bytesOut), savedMB, savedPercent, savedMB * 1024.0 / processed), savedMB >= 0 ? "green" : "red");
+    }
+    const QualityStats& quality = stats.quality;
+    if (quality.count > 0) {
+        coutPlus(std::format("  Verified {} outputs: SSIM mean {:.4f}, min {:.4f}; PSNR mean {:.1f} dB, min {:.1f} dB; {} re-encoded, {} rejected",
+                             quality.count, quality.ssimSum / quality.count, quality.minSsim, quality.psnrSum / quality.count,
+                             quality.minPsnr, quality.reencoded, quality.rejected), quality.rejected > 0 ? "red" : "green");
+    }
+
+    uint64_t stageTotalNs = 0;
+    for (const DurationStats& stage : stats.stages) {
+        stageTotalNs += stage.totalNs;
+    }
+    if (stageTotalNs == 0) {
+        return;
+    }
+
+    coutPlus(std::format("\n  {:<8}{:>8}{:>12}{:>11}{:>11}{:>11}{:>11}{:>8}{:>10}", "stage", "count", "total [s]", "mean [ms]",
+                         "p50 [ms]", "p99 [ms]", "max [ms]", "share", "MB/s"), "blue");
+    for (size_t i = 0; i < numStages; ++i) {
+        const DurationStats& stage = stats.stages[i];
+        double totalSeconds = stage.totalNs / 1e9;
+        coutPlus(std::format("  {:<8}{:>8}{:>12.2f}{:>11.2f}{:>11.2f}{:>11.2f}{:>11.2f}{:>7.1f}%{:>10.1f}", getStageName((Stage) i),
+                             stage.count, totalSeconds, stage.count > 0 ? toMs(stage.totalNs) / stage.count : 0.0,
+                             stage.getPercentileMs(0.50), stage.getPercentileMs(0.99), toMs(stage.maxNs),
+                             100.0 * stage.totalNs / stageTotalNs, totalSeconds > 0 ? toMB(stage.bytes) / totalSeconds : 0.0));
+    }
+
+    // Stage times are summed over all threads, so this says where the thread time went, not the wall time
+    uint64_t ioNs = stats.stages[(size_t) Stage::Stat].totalNs + stats.stages[(size_t) Stage::Read].totalNs +
+                    stats.stages[(size_t) Stage::Write].totalNs;
+    double ioPercent = 100.0 * ioNs / stageTotalNs;
+    coutPlus(std::format("  I/O (stat, read, write): {:.1f}%, CPU (decode, resize, encode, verify): {:.1f}%", ioPercent, 100.0 - ioPercent), "yellow");
+
+    if (processed > 0) {
+        coutPlus("\n  Time per image:", "blue");
+        printHistogram(stats.images);
+    }
+}
+
+
+bool writeRunStats(const string& filePath, const RunStats& stats, double wallSeconds) {
+    string content;
+    if (toLowerCase(getFileExtension(filePath)) == ".json") {
+        content = std::format(R"({{"wall_seconds": {:.3f}, "bytes_in": {}, "bytes_out": {}, "outcomes": {{)", wallSeconds, stats.bytesIn, stats.bytesOut);
+        for (size_t i = 0; i < stats.outcomes.size(); ++i) {
+            content += std::format(R"({}"{}": {})", i > 0 ? ", " : "", getImageOutcomeName((ImageOutcome) i), stats.outcomes[i]);
+        }
+        const QualityStats& quality = stats.quality;
+        content += std::format(R"(}}, "quality": {{"count": {}, "mean_ssim": {:.6f}, "min_ssim": {:.6f}, "mean_psnr": {:.3f}, "min_psnr": {:.3f}, "reencoded": {}, "rejected": {})",
+                               quality.count, quality.count > 0 ? quality.ssimSum / quality.count : 0.0, quality.minSsim,
+                               quality.count > 0 ? quality.psnrSum / quality.count : 0.0, quality.minPsnr, quality.reencoded, quality.rejected);
+        content += R"(}, "images": )";
+        appendDurationJson(content, stats.images);
+        content += R"(, "stages": {)";
+        for (size_t i = 0; i < numStages; ++i) {
+            content += std::format(R"({}"{}": )", i > 0 ? ", " : "", getStageName((Stage) i));
+            appendDurationJson(content, stats.stages[i]);
+        }
+        content += "}}\n";
+    } else {
+        content = "metric,value\n";
+        content += std::format("wall_seconds,{:.3f}\nbytes_in,{}\nbytes_out,{}\n", wallSeconds, stats.bytesIn, stats.bytesOut);
+        for (size_t i = 0; i < stats.outcomes.size(); ++i) {
+            content += std::format("outcome.{},{}\n", getImageOutcomeName((ImageOutcome) i), stats.outcomes[i]);
+        }
+        const QualityStats& quality = stats.quality;
+        content += std::format("quality.count,{}\nquality.mean_ssim,{:.6f}\nquality.min_ssim,{:.6f}\n", quality.count,
+                               quality.count > 0 ? quality.ssimSum / quality.count : 0.0, quality.minSsim);
+        content += std::format("quality.mean_psnr,{:.3f}\nquality.min_psnr,{:.3f}\nquality.reencoded,{}\nquality.rejected,{}\n",
+                               quality.count > 0 ? quality.psnrSum / quality.count : 0.0, quality.minPsnr, quality.reencoded, quality.rejected);
+        appendDurationCsv(content, "image", stats.images);
+        for (size_t i = 0; i < numStages; ++i) {
+            appendDurationCsv(content, "stage." + getStageName((Stage) i), stats.stages[i]);
+        }
+    }
+
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file.write(content.data(), (std::streamsize) content.size())) {
+        cerrPlus("Failed to write the statistics file: " + filePath);
+        return false;
+    }
+    return true;
+}
+
+
+string getStageName(Stage stage) {
+    switch (stage) {
+        case Stage::Stat:
+            return "stat";
+        case Stage::Read:
+            return "read";
+        case Stage::Decode:
+            return "decode";
+        case Stage::Resize:
+            return "resize";
+        case Stage::Encode:
+            return "encode";
+        case Stage::Verify:
+            return "verify";
+        case Stage::Write:
+            return "write";
+        default:
+            return "unknown";
+    }
+}
+
+
+string getImageOutcomeName(ImageOutcome outcome) {
+    switch (outcome) {
+        case ImageOutcome::Resized:
+            return "resized";
+        case ImageOutcome::Recompressed:
+            return "recompressed";
+        case ImageOutcome::KeptOriginal:
+            return "kept_original";
+        case ImageOutcome::Skipped:
+            return "skipped";
+        case ImageOutcome::Cached:
+            return "cached";
+        case ImageOutcome::Failed:
+            return "failed";
+        default:
+            return "unknown";
+    }
+}
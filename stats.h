@@ -0,0 +1,113 @@
+#ifndef IMAGE_DOWNSCALER_STATS_H
+#define IMAGE_DOWNSCALER_STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+
+using StatsClock = std::chrono::steady_clock;
+
+
+enum class Stage {
+    Stat,  // file sizes and header probes
+    Read,
+    Decode,
+    Resize,
+    Encode,
+    Verify,  // decoding the output again to measure its quality
+    Write,
+    Count
+};
+
+
+enum class ImageOutcome {
+    Resized,
+    Recompressed,  // not resized, but re-encoded
+    KeptOriginal,
+    Skipped,
+    Cached,  // already processed with the same settings by an earlier run
+    Failed
+};
+
+
+constexpr size_t numStages = (size_t) Stage::Count;
+constexpr size_t numHistogramBuckets = 24;  // bucket i counts durations in [2^i, 2^(i+1)) microseconds
+
+
+struct DurationStats {
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+    uint64_t bytes = 0;
+    std::array<uint64_t, numHistogramBuckets> histogram{};
+
+    void add(uint64_t durationNs, uint64_t byteCount);
+    void merge(const DurationStats& other);
+    // Upper bound of the histogram bucket that contains the given percentile, in milliseconds.
+    double getPercentileMs(double percentile) const;
+};
+
+
+// SSIM and PSNR of the verified outputs
+struct QualityStats {
+    uint64_t count = 0;
+    double ssimSum = 0;
+    double minSsim = 0;
+    double psnrSum = 0;
+    double minPsnr = 0;
+    uint64_t reencoded = 0;  // encoded again at a higher quality to meet the floor
+    uint64_t rejected = 0;  // didn't meet it at any quality, not written
+
+    void add(double ssim, double psnr, bool wasReencoded, bool wasRejected);
+    void merge(const QualityStats& other);
+};
+
+
+struct RunStats {
+    std::array<DurationStats, numStages> stages;
+    DurationStats images;  // whole image, from the first stat to the end of the write
+    std::array<uint64_t, (size_t) ImageOutcome::Failed + 1> outcomes{};
+    uint64_t bytesIn = 0;  // original size of every processed image
+    uint64_t bytesOut = 0;  // size of the same images afterwards
+    QualityStats quality;
+
+    void merge(const RunStats& other);
+};
+
+
+// Times one stage on the current thread, from construction to destruction.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage, uint64_t bytes = 0);
+    ~StageTimer();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void setBytes(uint64_t byteCount);
+
+private:
+    Stage stage;
+    uint64_t bytes;
+    StatsClock::time_point start;
+};
+
+
+// Every thread records into its own RunStats, so recording never takes a lock; collectRunStats() merges them, it
+// should only be called once the workers are idle.
+void recordStage(Stage stage, StatsClock::duration duration, uint64_t bytes = 0);
+void recordImage(ImageOutcome outcome, StatsClock::time_point startTime, uint64_t bytesIn = 0, uint64_t bytesOut = 0);
+void recordQuality(double ssim, double psnr, bool wasReencoded, bool wasRejected);
+// Images recorded so far by all threads, safe to call while they're running.
+uint64_t getFinishedImageCount();
+RunStats collectRunStats();
+void printRunStats(const RunStats& stats, double wallSeconds);
+// Writes JSON if the path ends with .json, CSV otherwise.
+bool writeRunStats(const std::string& filePath, const RunStats& stats, double wallSeconds);
+std::string getStageName(Stage stage);
+std::string getImageOutcomeName(ImageOutcome outcome);
+
+
+#endif //IMAGE_DOWNSCALER_STATS_H
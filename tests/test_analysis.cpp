@@ -0,0 +1,237 @@
+// What --format auto builds on: analyzeImage at every SIMD level against the scalar one and against what the pixels
+// really are, chooseOutputKind's decisions, findPalette's indices, and the palette PNGs the libpng encoder writes.
+#include <format>
+#include "image_analysis.h"
+#include "image_codec.h"
+#include "test_utils.h"
+
+
+namespace {
+    // Widths that leave every tail length after the 16 and 32 byte steps of the kernels, for 3 and 4 channels
+    const int testWidths[] = {1, 3, 4, 5, 8, 10, 11, 16, 17, 21, 31, 32, 33, 43, 67};
+
+
+    std::string describe(const ImageAnalysis& analysis) {
+        return std::format("alpha {} gray {} colours {} graphic {}", analysis.hasAlpha, analysis.isGrayscale,
+                           analysis.numColors, analysis.isGraphic);
+    }
+
+
+    bool isSameAnalysis(const ImageAnalysis& a, const ImageAnalysis& b) {
+        return a.hasAlpha == b.hasAlpha && a.isGrayscale == b.isGrayscale && a.numColors == b.numColors &&
+               a.isGraphic == b.isGraphic;
+    }
+
+
+    // Checks every SIMD level against the scalar one and returns the scalar analysis
+    ImageAnalysis analyzeAtEveryLevel(const cv::Mat& image, const std::string& name) {
+        ImageAnalysis reference = analyzeImage(image, SimdLevel::Scalar);
+        for (SimdLevel simdLevel : getTestedSimdLevels()) {
+            ImageAnalysis analysis = analyzeImage(image, simdLevel);
+            CHECK_MSG(isSameAnalysis(analysis, reference), std::format("{} {}: {} vs scalar {}", name, getSimdLevelName(simdLevel),
+                                                                       describe(analysis), describe(reference)));
+        }
+        return reference;
+    }
+
+
+    // B == G == R in every pixel, opaque if there's an alpha channel
+    cv::Mat makeGrayImage(int rows, int cols, int channels, uint32_t seed) {
+        cv::Mat gray = makeTestImage(rows, cols, 1, seed);
+        cv::Mat image(rows, cols, CV_8UC(channels));
+        for (int y = 0; y < rows; ++y) {
+            for (int x = 0; x < cols; ++x) {
+                uchar* pixel = image.ptr<uchar>(y) + x * channels;
+                for (int c = 0; c < channels; ++c) {
+                    pixel[c] = c < 3 ? gray.ptr<uchar>(y)[x] : 255;
+                }
+            }
+        }
+        return image;
+    }
+
+
+    // numColors colours (gray levels for 1 channel) in flat 8 pixel wide stripes, the first ones with alpha below 255 if there's an alpha channel
+    cv::Mat makeFlatImage(int rows, int cols, int channels, int numColors, int numTransparent = 0) {
+        cv::Mat image(rows, cols, CV_8UC(channels));
+        for (int y = 0; y < rows; ++y) {
+            for (int x = 0; x < cols; ++x) {
+                int color = (x / 8 + y / 4 * 3) % numColors;
+                uchar* pixel = image.ptr<uchar>(y) + x * channels;
+                pixel[0] = (uchar) (color * 37);
+                if (channels >= 3) {
+                    pixel[1] = (uchar) (color * 11 + 5);
+                    pixel[2] = (uchar) (color / 7 * 50);
+                }
+                if (channels == 4) {
+                    pixel[3] = color < numTransparent ? (uchar) (color * 20) : 255;
+                }
+            }
+        }
+        return image;
+    }
+
+
+    void testAnalysis() {
+        uint32_t seed = 1;
+        for (int channels : {1, 3, 4}) {
+            for (int width : testWidths) {
+                std::string name = std::format("{} channels {} wide", channels, width);
+
+                ImageAnalysis photo = analyzeAtEveryLevel(makeTestImage(23, width, channels, seed++, 64), name + " photo");
+                CHECK_MSG(!photo.isGraphic || width < 4, name + " photo");
+                CHECK_MSG(photo.isGrayscale == (channels == 1), name + " photo");
+
+                cv::Mat gray = makeGrayImage(23, width, channels, seed++);
+                ImageAnalysis grayAnalysis = analyzeAtEveryLevel(gray, name + " gray");
+                CHECK_MSG(grayAnalysis.isGrayscale && !grayAnalysis.hasAlpha, name + " gray");
+
+                cv::Mat flat = makeFlatImage(40, width, channels, 5);
+                ImageAnalysis flatAnalysis = analyzeAtEveryLevel(flat, name + " flat");
+                CHECK_MSG(flatAnalysis.numColors == 5, name + " flat " + describe(flatAnalysis));
+                CHECK_MSG(flatAnalysis.isGraphic || width < 4, name + " flat");
+                CHECK_MSG(!flatAnalysis.hasAlpha, name + " flat");
+
+                if (channels == 1) {
+                    continue;
+                }
+                // One pixel that isn't gray, or isn't opaque, at every position of the last row: the kernels must
+                // find it in their vectors as well as in their scalar tails
+                for (int x = 0; x < width; ++x) {
+                    std::string pixelName = std::format("{} pixel {}", name, x);
+                    cv::Mat colored = gray.clone();
+                    uchar* pixel = colored.ptr<uchar>(colored.rows - 1) + x * channels;
+                    pixel[1] = (uchar) (pixel[1] ^ (x % 2 == 0 ? 1 : 0x80));
+                    CHECK_MSG(!analyzeAtEveryLevel(colored, pixelName + " coloured").isGrayscale, pixelName + " coloured");
+                    if (channels == 4) {
+                        cv::Mat transparent = gray.clone();
+                        transparent.ptr<uchar>(transparent.rows - 1)[x * 4 + 3] = 254;
+                        ImageAnalysis analysis = analyzeAtEveryLevel(transparent, pixelName + " transparent");
+                        CHECK_MSG(analysis.hasAlpha && analysis.isGrayscale, pixelName + " transparent");
+                    }
+                }
+            }
+        }
+
+        // The colour count stops at the first colour too many
+        CHECK(analyzeImage(makeFlatImage(64, 2056, 3, maxPaletteColors)).numColors == maxPaletteColors);
+        CHECK(analyzeImage(makeFlatImage(64, 2056, 3, maxPaletteColors + 1)).numColors == 0);
+        cv::Mat grayLevels(8, 20, CV_8UC1);
+        for (int y = 0; y < grayLevels.rows; ++y) {
+            for (int x = 0; x < grayLevels.cols; ++x) {
+                grayLevels.ptr<uchar>(y)[x] = (uchar) (x % 10 * 7);
+            }
+        }
+        CHECK(analyzeImage(grayLevels).numColors == 10);
+        // Not 8-bit: nothing but the channels is known
+        ImageAnalysis deep = analyzeImage(cv::Mat(8, 8, CV_16UC3, cv::Scalar(0, 0, 0)));
+        CHECK(!deep.hasAlpha && !deep.isGrayscale && deep.numColors == 0 && !deep.isGraphic);
+    }
+
+
+    void testOutputKind() {
+        auto makeAnalysis = [](bool hasAlpha, bool isGrayscale, int numColors, bool isGraphic) {
+            ImageAnalysis analysis;
+            analysis.hasAlpha = hasAlpha;
+            analysis.isGrayscale = isGrayscale;
+            analysis.numColors = numColors;
+            analysis.isGraphic = isGraphic;
+            return analysis;
+        };
+
+        for (bool canWritePalettePng : {false, true}) {
+            // Photos
+            CHECK(chooseOutputKind(makeAnalysis(false, false, 0, false), canWritePalettePng) == OutputKind::Jpeg);
+            CHECK(chooseOutputKind(makeAnalysis(true, false, 0, false), canWritePalettePng) == OutputKind::WebpLossy);
+            CHECK(chooseOutputKind(makeAnalysis(false, true, 200, false), canWritePalettePng) == OutputKind::Jpeg);
+            CHECK(chooseOutputKind(makeAnalysis(true, true, 200, false), canWritePalettePng) == OutputKind::WebpLossy);
+            // Graphics with too many colours for a palette
+            CHECK(chooseOutputKind(makeAnalysis(false, false, 0, true), canWritePalettePng) == OutputKind::WebpLossless);
+            CHECK(chooseOutputKind(makeAnalysis(true, false, 0, true), canWritePalettePng) == OutputKind::WebpLossless);
+            // Gray PNGs don't need a palette, gray with alpha does
+            CHECK(chooseOutputKind(makeAnalysis(false, true, 30, true), canWritePalettePng) == OutputKind::Png);
+            OutputKind grayWithAlpha = canWritePalettePng ? OutputKind::Png : OutputKind::WebpLossless;
+            CHECK(chooseOutputKind(makeAnalysis(true, true, 30, true), canWritePalettePng) == grayWithAlpha);
+        }
+        // Few colours, flat or not
+        for (bool isGraphic : {false, true}) {
+            CHECK(chooseOutputKind(makeAnalysis(false, false, 12, isGraphic), true) == OutputKind::Png);
+            CHECK(chooseOutputKind(makeAnalysis(true, false, 12, isGraphic), true) == OutputKind::Png);
+            CHECK(chooseOutputKind(makeAnalysis(false, false, 12, isGraphic), false) == OutputKind::WebpLossless);
+        }
+
+        CHECK(getOutputKindExtension(OutputKind::Jpeg) == ".jpg");
+        CHECK(getOutputKindExtension(OutputKind::WebpLossy) == ".webp");
+        CHECK(getOutputKindExtension(OutputKind::WebpLossless) == ".webp");
+        CHECK(getOutputKindExtension(OutputKind::Png) == ".png");
+    }
+
+
+    void testPalette() {
+        for (int channels : {3, 4}) {
+            for (int numColors : {1, 2, 5, 16, 17, 255, 256}) {
+                std::string name = std::format("{} channels {} colours", channels, numColors);
+                cv::Mat image = makeFlatImage(200, 1030, channels, numColors, channels == 4 ? 3 : 0);
+                cv::Mat indices;
+                std::optional<std::vector<uint32_t>> palette = findPalette(image, maxPaletteColors, &indices);
+                CHECK_MSG(palette.has_value() && (int) palette->size() == numColors, name);
+                if (!palette.has_value()) {
+                    continue;
+                }
+                CHECK_MSG(findPalette(image, maxPaletteColors) == palette, name + " without indices");
+                CHECK_MSG(!findPalette(image, numColors - 1).has_value(), name + " too many colours");
+
+                // Every index points at the pixel's colour, and colours are listed in the order they first appear
+                bool isIndexed = indices.rows == image.rows && indices.cols == image.cols && indices.type() == CV_8U;
+                int nextNewIndex = 0;
+                for (int y = 0; y < image.rows && isIndexed; ++y) {
+                    for (int x = 0; x < image.cols; ++x) {
+                        const uchar* pixel = image.ptr<uchar>(y) + x * channels;
+                        uint32_t alpha = channels == 4 ? pixel[3] : 255;
+                        uint32_t color = alpha << 24 | (uint32_t) pixel[2] << 16 | (uint32_t) pixel[1] << 8 | pixel[0];
+                        int index = indices.ptr<uchar>(y)[x];
+                        isIndexed = isIndexed && index < numColors && (*palette)[index] == color && index <= nextNewIndex;
+                        nextNewIndex = std::max(nextNewIndex, index + 1);
+                    }
+                }
+                CHECK_MSG(isIndexed, name + " indices");
+            }
+        }
+
+        cv::Mat indices;
+        CHECK(!findPalette(makeTestImage(8, 8, 1, 1), maxPaletteColors).has_value());
+        CHECK(!findPalette(makeFlatImage(8, 8, 3, 2), 257, &indices).has_value());
+    }
+
+
+    // Every bit depth (1, 2, 4 and 8 bits per index), with and without transparent entries, odd widths for the packed
+    // rows' last byte
+    void testPalettePng() {
+        if (!canEncodePalettePng(EncoderBackend::Native)) {
+            std::fprintf(stderr, "No palette PNG encoder in this build, skipped\n");
+            return;
+        }
+        for (int channels : {3, 4}) {
+            for (int numColors : {2, 3, 4, 16, 17, 256}) {
+                std::string name = std::format("palette PNG {} channels {} colours", channels, numColors);
+                cv::Mat image = makeFlatImage(37, 101, channels, numColors, channels == 4 ? 2 : 0);
+                const ImageEncoder& encoder = selectImageEncoder(EncoderBackend::Native, ".png", image);
+                std::vector<uchar> encodedImage;
+                CHECK_MSG(encoder.encode(".png", image, {}, encodedImage), name);
+                // IHDR: colour type 3 (palette)
+                CHECK_MSG(encodedImage.size() > 25 && encodedImage[25] == 3, name);
+                cv::Mat decoded = cv::imdecode(encodedImage, cv::IMREAD_UNCHANGED);
+                CHECK_MSG(getMaxDifference(image, decoded) == 0, name);
+            }
+        }
+    }
+}
+
+
+int main() {
+    testAnalysis();
+    testOutputKind();
+    testPalette();
+    testPalettePng();
+    return finishTest();
+}
@@ -0,0 +1,130 @@
+// Every native encoder against OpenCV's for the same Mat and parameters: both outputs are decoded and have to match
+// the source (exactly for the lossless formats) and each other.
+#include <format>
+#include "image_codec.h"
+#include "test_utils.h"
+
+
+namespace {
+    struct EncoderCase {
+        std::string fileExtension;
+        std::vector<int> compressionParams;
+        bool isLossless;
+    };
+
+
+    // JPEG drops the alpha channel and WebP stores gray as colour, so the source is compared with as many channels
+    // as the decoded image has
+    cv::Mat convertToChannels(const cv::Mat& image, int channels) {
+        cv::Mat converted = image;
+        if (image.channels() == 1 && channels == 3) {
+            cv::cvtColor(image, converted, cv::COLOR_GRAY2BGR);
+        } else if (image.channels() == 1 && channels == 4) {
+            cv::cvtColor(image, converted, cv::COLOR_GRAY2BGRA);
+        } else if (image.channels() == 4 && channels == 3) {
+            cv::cvtColor(image, converted, cv::COLOR_BGRA2BGR);
+        } else if (image.channels() == 3 && channels == 4) {
+            cv::cvtColor(image, converted, cv::COLOR_BGR2BGRA);
+        }
+        return converted;
+    }
+
+
+    // Little noise, JPEG's chroma subsampling would otherwise be most of the difference. The alpha channel is never
+    // 0, libwebp may change the colour of fully transparent pixels.
+    cv::Mat makeEncoderTestImage(int rows, int cols, int channels, uint32_t seed) {
+        cv::Mat image = makeTestImage(rows, cols, channels, seed, 8);
+        if (channels == 4) {
+            for (int y = 0; y < rows; ++y) {
+                for (int x = 0; x < cols; ++x) {
+                    image.at<cv::Vec4b>(y, x)[3] = (uchar) (255 - (x + y) % 128);
+                }
+            }
+        }
+        return image;
+    }
+
+
+    // Few colours, so the libpng encoder writes a palette
+    cv::Mat makePaletteTestImage(int rows, int cols, int channels) {
+        cv::Mat image(rows, cols, CV_8UC(channels));
+        for (int y = 0; y < rows; ++y) {
+            uchar* row = image.ptr<uchar>(y);
+            for (int x = 0; x < cols * channels; ++x) {
+                row[x] = (uchar) (((x / channels / 8 + y / 8) % 4) * 60 + x % channels * 10);
+            }
+        }
+        return image;
+    }
+}
+
+
+int main() {
+    const std::vector<EncoderCase> cases = {
+        {".jpg", {cv::IMWRITE_JPEG_QUALITY, 90}, false},
+        {".png", {}, true},
+        {".png", {cv::IMWRITE_PNG_COMPRESSION, 6}, true},
+        {".webp", {cv::IMWRITE_WEBP_QUALITY, 90}, false},
+        {".webp", {cv::IMWRITE_WEBP_QUALITY, 101}, true},
+    };
+    const std::vector<const ImageEncoder*>& encoders = getImageEncoders();
+    const ImageEncoder& openCvEncoder = *encoders.front();
+
+    uint32_t seed = 1;
+    for (const EncoderCase& encoderCase : cases) {
+        for (int channels : {1, 3, 4}) {
+            std::vector<cv::Mat> images = {makeEncoderTestImage(67, 93, channels, seed++)};
+            if (encoderCase.fileExtension == ".png") {
+                images.push_back(makePaletteTestImage(40, 56, channels));
+            }
+            for (const cv::Mat& image : images) {
+                std::string name = std::format("{} {} channels {}x{}", encoderCase.fileExtension, channels, image.cols,
+                                               image.rows);
+                std::vector<uchar> openCvBytes;
+                CHECK_MSG(openCvEncoder.encode(encoderCase.fileExtension, image, encoderCase.compressionParams, openCvBytes),
+                          name);
+                cv::Mat openCvDecoded = cv::imdecode(openCvBytes, cv::IMREAD_UNCHANGED);
+                CHECK_MSG(!openCvDecoded.empty(), name);
+                if (openCvDecoded.empty()) {
+                    continue;
+                }
+
+                for (const ImageEncoder* encoder : encoders) {
+                    if (encoder == &openCvEncoder || !encoder->canEncode(encoderCase.fileExtension, image)) {
+                        continue;
+                    }
+                    std::string encoderName = name + " " + encoder->getName();
+                    // Encoded twice into the same buffer, the second time reuses what the first one left
+                    std::vector<uchar> nativeBytes;
+                    for (int i = 0; i < 2; ++i) {
+                        CHECK_MSG(encoder->encode(encoderCase.fileExtension, image, encoderCase.compressionParams, nativeBytes),
+                                  encoderName);
+                    }
+                    cv::Mat nativeDecoded = cv::imdecode(nativeBytes, cv::IMREAD_UNCHANGED);
+                    CHECK_MSG(!nativeDecoded.empty(), encoderName);
+                    if (nativeDecoded.empty()) {
+                        continue;
+                    }
+
+                    int comparedChannels = std::max(openCvDecoded.channels(), nativeDecoded.channels());
+                    cv::Mat source = convertToChannels(image, comparedChannels);
+                    cv::Mat openCvImage = convertToChannels(openCvDecoded, comparedChannels);
+                    cv::Mat nativeImage = convertToChannels(nativeDecoded, comparedChannels);
+                    if (encoderCase.isLossless) {
+                        CHECK_MSG(getMaxDifference(source, openCvImage) == 0, encoderName + " OpenCV lossless");
+                        CHECK_MSG(getMaxDifference(source, nativeImage) == 0, encoderName + " lossless");
+                    } else {
+                        // Same library underneath with the same settings, only its version or defaults may differ
+                        double openCvDifference = getMeanDifference(source, openCvImage);
+                        double nativeDifference = getMeanDifference(source, nativeImage);
+                        double backendDifference = getMeanDifference(openCvImage, nativeImage);
+                        CHECK_MSG(openCvDifference >= 0 && openCvDifference <= 6, encoderName + std::format(" OpenCV {:.2f}", openCvDifference));
+                        CHECK_MSG(nativeDifference >= 0 && nativeDifference <= 6, encoderName + std::format(" {:.2f}", nativeDifference));
+                        CHECK_MSG(backendDifference >= 0 && backendDifference <= 2, encoderName + std::format(" vs OpenCV {:.2f}", backendDifference));
+                    }
+                }
+            }
+        }
+    }
+    return finishTest();
+}
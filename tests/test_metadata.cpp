@@ -0,0 +1,230 @@
+// Reading and splicing metadata: a round trip per format, truncated files, segments claiming more bytes than there
+// are, and the EXIF orientation. The images are the smallest containers the parser accepts, no encoder is needed.
+#include <format>
+#include "image_metadata.h"
+#include "test_utils.h"
+
+
+namespace {
+    using Bytes = std::vector<unsigned char>;
+
+
+    void appendUInt16(Bytes& out, unsigned int value, bool bigEndian) {
+        out.push_back((unsigned char) (bigEndian ? value >> 8 : value));
+        out.push_back((unsigned char) (bigEndian ? value : value >> 8));
+    }
+
+
+    void appendUInt32(Bytes& out, unsigned int value, bool bigEndian) {
+        appendUInt16(out, bigEndian ? value >> 16 : value & 0xFFFF, bigEndian);
+        appendUInt16(out, bigEndian ? value & 0xFFFF : value >> 16, bigEndian);
+    }
+
+
+    void appendIfdEntry(Bytes& out, unsigned int tag, unsigned int type, unsigned int value, bool bigEndian) {
+        appendUInt16(out, tag, bigEndian);
+        appendUInt16(out, type, bigEndian);
+        appendUInt32(out, 1, bigEndian);
+        if (type == 3) {
+            appendUInt16(out, value, bigEndian);
+            appendUInt16(out, 0, bigEndian);
+        } else {
+            appendUInt32(out, value, bigEndian);
+        }
+    }
+
+
+    // TIFF header, IFD0 with the orientation and IFD1 with a thumbnail offset and length
+    Bytes makeExif(int orientation, bool bigEndian) {
+        Bytes exif = bigEndian ? Bytes{'M', 'M', 0, 42} : Bytes{'I', 'I', 42, 0};
+        appendUInt32(exif, 8, bigEndian);
+        appendUInt16(exif, 1, bigEndian);
+        appendIfdEntry(exif, 0x0112, 3, orientation, bigEndian);
+        appendUInt32(exif, 26, bigEndian);
+        appendUInt16(exif, 2, bigEndian);
+        appendIfdEntry(exif, 0x0201, 4, 56, bigEndian);
+        appendIfdEntry(exif, 0x0202, 4, 4, bigEndian);
+        appendUInt32(exif, 0, bigEndian);
+        exif.insert(exif.end(), {0xFF, 0xD8, 0xFF, 0xD9});
+        return exif;
+    }
+
+
+    Bytes makeBytes(size_t size, uint32_t seed) {
+        std::mt19937 random(seed);
+        Bytes bytes(size);
+        for (unsigned char& byte : bytes) {
+            byte = (unsigned char) random();
+        }
+        return bytes;
+    }
+
+
+    Bytes makeJpeg() {
+        Bytes jpeg = {0xFF, 0xD8, 0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+        jpeg.insert(jpeg.end(), {0xFF, 0xDA, 0, 2, 0x12, 0x34, 0xFF, 0xD9});
+        return jpeg;
+    }
+
+
+    Bytes makePng() {
+        Bytes png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n', 0, 0, 0, 13, 'I', 'H', 'D', 'R',
+                     0, 0, 0, 5, 0, 0, 0, 3, 8, 2, 0, 0, 0, 0, 0, 0, 0};
+        png.insert(png.end(), {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82});
+        return png;
+    }
+
+
+    // Lossless, 10x7 with alpha
+    Bytes makeWebp() {
+        Bytes webp = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'E', 'B', 'P', 'V', 'P', '8', 'L', 5, 0, 0, 0, 0x2F};
+        appendUInt32(webp, 9 | (6 << 14) | (1 << 28), false);
+        webp.push_back(0);
+        size_t riffSize = webp.size() - 8;
+        for (int i = 0; i < 4; ++i) {
+            webp[4 + i] = (unsigned char) (riffSize >> (8 * i));
+        }
+        return webp;
+    }
+
+
+    bool isSameMetadata(const ImageMetadata& a, const ImageMetadata& b) {
+        return a.exif == b.exif && a.icc == b.icc && a.xmp == b.xmp;
+    }
+
+
+    // A truncated file may lose a part, but what's read must never be cut short or made up. Large files are cut at
+    // every few bytes only.
+    void checkTruncated(const Bytes& file, const ImageMetadata& metadata, const std::string& name) {
+        size_t step = std::max<size_t>(1, file.size() / 4000);
+        for (size_t size = 0; size < file.size(); size += step) {
+            ImageMetadata read = readImageMetadata(file.data(), size);
+            bool isIntact = (read.exif.empty() || read.exif == metadata.exif) && (read.icc.empty() || read.icc == metadata.icc) &&
+                            (read.xmp.empty() || read.xmp == metadata.xmp);
+            CHECK_MSG(isIntact, std::format("{} truncated to {} bytes", name, size));
+        }
+    }
+
+
+    void testRoundTrip() {
+        const std::pair<std::string, Bytes> images[] = {{"JPEG", makeJpeg()}, {"PNG", makePng()}, {"WebP", makeWebp()}};
+        // The ICC profile of the second case needs three JPEG segments
+        const size_t iccSizes[] = {3000, 150000};
+        for (const auto& [name, image] : images) {
+            for (size_t iccSize : iccSizes) {
+                ImageMetadata metadata;
+                metadata.exif = makeExif(6, name == "PNG");
+                metadata.icc = makeBytes(iccSize, (uint32_t) iccSize);
+                std::string xmp = "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"></x:xmpmeta>";
+                metadata.xmp.assign(xmp.begin(), xmp.end());
+                std::string caseName = std::format("{} with a {} byte profile", name, iccSize);
+
+                Bytes output;
+                CHECK_MSG(writeImageMetadata(image, metadata, output), caseName);
+                ImageMetadata read = readImageMetadata(output.data(), output.size());
+                CHECK_MSG(isSameMetadata(read, metadata), caseName);
+                checkTruncated(output, metadata, caseName);
+
+                // WebP's metadata chunks are replaced, JPEG segments and PNG chunks are only ever added and the
+                // first ones win
+                ImageMetadata other;
+                other.xmp = {'x'};
+                Bytes rewritten;
+                CHECK_MSG(writeImageMetadata(output, other, rewritten), caseName + " rewritten");
+                read = readImageMetadata(rewritten.data(), rewritten.size());
+                if (name == "WebP") {
+                    CHECK_MSG(isSameMetadata(read, other), caseName + " rewritten");
+                } else {
+                    CHECK_MSG(read.xmp == other.xmp && read.exif == metadata.exif && read.icc == metadata.icc,
+                              caseName + " rewritten");
+                }
+            }
+
+            // Without metadata the file comes out readable and empty
+            Bytes output;
+            CHECK_MSG(writeImageMetadata(image, ImageMetadata(), output), name + " without metadata");
+            CHECK_MSG(readImageMetadata(output.data(), output.size()).empty(), name + " without metadata");
+        }
+
+        // EXIF too large for a JPEG segment is dropped rather than split
+        ImageMetadata metadata;
+        metadata.exif = makeBytes(70000, 1);
+        Bytes output;
+        CHECK(writeImageMetadata(makeJpeg(), metadata, output));
+        CHECK(readImageMetadata(output.data(), output.size()).exif.empty());
+
+        CHECK(!writeImageMetadata({'G', 'I', 'F', '8', '9', 'a'}, metadata, output));
+    }
+
+
+    void testOversizedSegments() {
+        // Each declares more bytes than the file has, what comes before it is still read
+        ImageMetadata metadata;
+        metadata.xmp = {'x', 'm', 'p'};
+        for (const Bytes& image : {makeJpeg(), makePng(), makeWebp()}) {
+            Bytes output;
+            writeImageMetadata(image, metadata, output);
+            Bytes oversized = output;
+            if (oversized[0] == 0xFF) {
+                // An APP2 segment of 0xFFFF bytes, and one shorter than its own length field
+                oversized.insert(oversized.end() - 8, {0xFF, 0xE2, 0xFF, 0xFF, 'I', 'C', 'C'});
+                Bytes tooShort = output;
+                tooShort.insert(tooShort.begin() + 20, {0xFF, 0xE1, 0, 1});
+                CHECK(readImageMetadata(tooShort.data(), tooShort.size()).empty());
+            } else if (oversized[0] == 0x89) {
+                oversized.insert(oversized.end() - 12, {0xFF, 0xFF, 0xFF, 0xF0, 'i', 'C', 'C', 'P', 0, 0});
+            } else {
+                oversized.insert(oversized.end(), {'I', 'C', 'C', 'P', 0xF0, 0xFF, 0xFF, 0xFF, 0, 0});
+            }
+            ImageMetadata read = readImageMetadata(oversized.data(), oversized.size());
+            CHECK(read.xmp == metadata.xmp && read.icc.empty());
+        }
+
+        // A zlib stream that doesn't end isn't kept
+        Bytes png = makePng();
+        Bytes chunk = {0, 0, 0, 8, 'i', 'C', 'C', 'P', 'p', 0, 0, 0x78, 0x9C, 0x01, 0x02, 0x03};
+        chunk.insert(chunk.end(), {0, 0, 0, 0});
+        png.insert(png.begin() + 33, chunk.begin(), chunk.end());
+        CHECK(readImageMetadata(png.data(), png.size()).icc.empty());
+
+        ImageMetadata large;
+        large.exif = makeBytes(100, 1);
+        large.icc = makeBytes(200, 2);
+        large.xmp = makeBytes(300, 3);
+        limitImageMetadata(large, MetadataPolicy::Keep, 250);
+        CHECK(large.exif.size() == 100 && large.icc.size() == 200 && large.xmp.empty());
+        limitImageMetadata(large, MetadataPolicy::ColorProfile, 0);
+        CHECK(large.exif.empty() && large.icc.size() == 200);
+        limitImageMetadata(large, MetadataPolicy::Strip, 0);
+        CHECK(large.empty());
+    }
+
+
+    void testOrientation() {
+        for (bool bigEndian : {false, true}) {
+            Bytes exif = makeExif(6, bigEndian);
+            CHECK(getExifOrientation(exif) == 6);
+            setExifOrientation(exif, 1);
+            CHECK(getExifOrientation(exif) == 1);
+            // IFD0 no longer links to the thumbnail, which is still rotated
+            CHECK(exif[22] == 0 && exif[23] == 0 && exif[24] == 0 && exif[25] == 0);
+            CHECK(exif.size() == makeExif(6, bigEndian).size());
+        }
+
+        CHECK(getExifOrientation({}) == 1);
+        CHECK(getExifOrientation(makeExif(9, false)) == 1);
+        Bytes truncated = makeExif(3, false);
+        truncated.resize(12);
+        CHECK(getExifOrientation(truncated) == 1);
+        setExifOrientation(truncated, 1);
+        CHECK(truncated.size() == 12);
+    }
+}
+
+
+int main() {
+    testRoundTrip();
+    testOversizedSegments();
+    testOrientation();
+    return finishTest();
+}
@@ -0,0 +1,134 @@
+// measureQuality at every SIMD level against SSIM and PSNR computed straight from the pixels: the same 8x8 windows on a
+// 4 pixel grid, summed pixel by pixel in doubles rather than put together from 4x4 block sums.
+#include <cmath>
+#include <format>
+#include "image_quality.h"
+#include "test_utils.h"
+
+
+namespace {
+    const double C1 = 0.01 * 0.01 * 255 * 255 * 64;
+    const double C2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+
+
+    cv::Mat toGray(const cv::Mat& image) {
+        if (image.channels() == 1) {
+            return image;
+        }
+        cv::Mat gray;
+        cv::cvtColor(image, gray, image.channels() == 3 ? cv::COLOR_BGR2GRAY : cv::COLOR_BGRA2GRAY);
+        return gray;
+    }
+
+
+    QualityScores measureNaively(const cv::Mat& reference, const cv::Mat& image) {
+        cv::Mat a = toGray(reference);
+        cv::Mat b = toGray(image);
+        QualityScores scores;
+        int width = a.cols / 4 * 4;
+        int height = a.rows / 4 * 4;
+        if (width < 8 || height < 8) {
+            return scores;
+        }
+
+        double ssimSum = 0;
+        int numWindows = 0;
+        for (int top = 0; top + 8 <= height; top += 4) {
+            for (int left = 0; left + 8 <= width; left += 4) {
+                double sumA = 0, sumB = 0, sumSquares = 0, sumProducts = 0;
+                for (int y = top; y < top + 8; ++y) {
+                    for (int x = left; x < left + 8; ++x) {
+                        double pixelA = a.at<uchar>(y, x);
+                        double pixelB = b.at<uchar>(y, x);
+                        sumA += pixelA;
+                        sumB += pixelB;
+                        sumSquares += pixelA * pixelA + pixelB * pixelB;
+                        sumProducts += pixelA * pixelB;
+                    }
+                }
+                double variances = sumSquares * 64 - sumA * sumA - sumB * sumB;
+                double covariance = sumProducts * 64 - sumA * sumB;
+                ssimSum += (2 * sumA * sumB + C1) * (2 * covariance + C2) / ((sumA * sumA + sumB * sumB + C1) * (variances + C2));
+                numWindows++;
+            }
+        }
+        scores.ssim = ssimSum / numWindows;
+
+        double squaredErrorSum = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                double difference = (double) a.at<uchar>(y, x) - b.at<uchar>(y, x);
+                squaredErrorSum += difference * difference;
+            }
+        }
+        if (squaredErrorSum > 0) {
+            scores.psnr = std::min(maxPsnr, 10 * std::log10(255.0 * 255.0 / (squaredErrorSum / ((double) width * height))));
+        }
+        return scores;
+    }
+
+
+    void checkQuality(const cv::Mat& reference, const cv::Mat& image, const std::string& name) {
+        QualityScores expected = measureNaively(reference, image);
+        SsimReference ssimReference(reference);
+        for (SimdLevel simdLevel : getTestedSimdLevels()) {
+            std::string caseName = std::format("{} {}", name, getSimdLevelName(simdLevel));
+            std::optional<QualityScores> scores = measureQuality(ssimReference, image, simdLevel);
+            CHECK_MSG(scores.has_value(), caseName);
+            if (!scores.has_value()) {
+                continue;
+            }
+            CHECK_MSG(std::abs(scores->ssim - expected.ssim) < 1e-9,
+                      caseName + std::format(" SSIM {} vs {}", scores->ssim, expected.ssim));
+            CHECK_MSG(std::abs(scores->psnr - expected.psnr) < 1e-9,
+                      caseName + std::format(" PSNR {} vs {}", scores->psnr, expected.psnr));
+        }
+    }
+
+
+    // The image with more noise on top, as a lossy encoder would leave it
+    cv::Mat distort(const cv::Mat& image, uint32_t seed, int noise) {
+        cv::Mat distorted = image.clone();
+        std::mt19937 random(seed);
+        for (int y = 0; y < distorted.rows; ++y) {
+            uchar* row = distorted.ptr<uchar>(y);
+            for (int x = 0; x < distorted.cols * distorted.channels(); ++x) {
+                row[x] = (uchar) std::clamp(row[x] + (int) (random() % noise) - noise / 2, 0, 255);
+            }
+        }
+        return distorted;
+    }
+}
+
+
+int main() {
+    // Widths that leave every possible remainder of blocks for the SIMD kernels, and columns and rows that don't fill
+    // a block
+    const cv::Size sizes[] = {{8, 8}, {9, 13}, {31, 17}, {97, 61}, {130, 40}, {641, 479}};
+    uint32_t seed = 1;
+    for (cv::Size size : sizes) {
+        for (int channels : {1, 3, 4}) {
+            std::string name = std::format("{}x{} {} channels", size.width, size.height, channels);
+            cv::Mat image = makeTestImage(size.height, size.width, channels, seed++);
+            checkQuality(image, image, name + " identical");
+            checkQuality(image, distort(image, seed++, 16), name + " slightly distorted");
+            checkQuality(image, distort(image, seed++, 200), name + " heavily distorted");
+        }
+    }
+
+    // The largest sums the 32-bit block sums have to hold
+    cv::Mat white(64, 64, CV_8UC1, cv::Scalar(255));
+    cv::Mat black(64, 64, CV_8UC1, cv::Scalar(0));
+    checkQuality(white, white, "white");
+    checkQuality(white, black, "white vs black");
+
+    cv::Mat image = makeTestImage(40, 40, 1, seed);
+    std::optional<QualityScores> identical = measureQuality(SsimReference(image), image);
+    CHECK(identical.has_value() && identical->ssim == 1 && identical->psnr == maxPsnr);
+    CHECK(!measureQuality(SsimReference(image), makeTestImage(40, 41, 1, seed)).has_value());
+    CHECK(computeSsim(SsimReference(image), makeTestImage(41, 40, 1, seed)) == 0);
+    // Too small for a single window
+    std::optional<QualityScores> tiny = measureQuality(SsimReference(makeTestImage(7, 40, 1, seed)), makeTestImage(7, 40, 1, seed + 1));
+    CHECK(tiny.has_value() && tiny->ssim == 1 && tiny->psnr == maxPsnr);
+    return finishTest();
+}
@@ -0,0 +1,66 @@
+// Renditions are written next to the original, but a file of the user's that's only named like one is never replaced:
+// the image then fails, and only renditions recorded in the root's list may be written over.
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include "downscaler.h"
+#include "thread_pool.h"
+#include "test_utils.h"
+
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    std::string readFile(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+
+    uint64_t getOutcomeCount(ImageOutcome outcome) {
+        return collectRunStats().outcomes[(size_t) outcome];
+    }
+}
+
+
+int main() {
+    fs::path root = fs::temp_directory_path() / "image-downscaler-test-renditions";
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    renditions = parseRenditions("256,128").value();
+    maxImageLength = renditions.front().maxLength;
+    quietOutput = true;
+    loadRenditionList(root.string());
+
+    string imagePath = (root / "x.jpg").string();
+    CHECK(cv::imwrite(imagePath, makeTestImage(600, 800, 3, 1)));
+    string original = readFile(imagePath);
+    fs::path userFile = root / "x-256.jpg";
+    const string userContents = "not a rendition, the user's own file";
+    std::ofstream(userFile, std::ios::binary) << userContents;
+
+    ThreadPool pool(2);
+    uint64_t failedBefore = getOutcomeCount(ImageOutcome::Failed);
+    processRenditionsTask(imagePath, pool);
+    CHECK(readFile(userFile) == userContents);
+    CHECK(getOutcomeCount(ImageOutcome::Failed) == failedBefore + 1);
+    CHECK(readFile(imagePath) == original);
+    // The sizes that weren't in the way are written all the same
+    CHECK(fs::exists(root / "x-128.jpg"));
+    CHECK(!isRenditionPath(userFile.string()));
+
+    // Out of the way, the rendition is written, and a later run may replace it as its own
+    fs::remove(userFile);
+    uint64_t resizedBefore = getOutcomeCount(ImageOutcome::Resized);
+    processRenditionsTask(imagePath, pool);
+    processRenditionsTask(imagePath, pool);
+    CHECK(getOutcomeCount(ImageOutcome::Resized) == resizedBefore + 2);
+    CHECK(fs::exists(userFile) && readFile(userFile) != userContents);
+    CHECK(isRenditionPath(userFile.string()));
+
+    pool.shutdown();
+    fs::remove_all(root);
+    return finishTest();
+}
@@ -0,0 +1,119 @@
+// The SIMD kernels of the resampler against its scalar reference, and the streaming interface against the whole-image one.
+#include <format>
+#include "resampler.h"
+#include "test_utils.h"
+
+
+namespace {
+    // Opaque white on the left, transparent pixels of other colours (red above, blue below) on the right: with
+    // premultiplied alpha every visible output pixel stays white, only its alpha fades at the edge, and what's
+    // transparent all around comes out transparent black
+    void checkTransparentEdges(ResampleFilter filter, SimdLevel simdLevel) {
+        cv::Mat src(64, 64, CV_8UC4);
+        for (int y = 0; y < src.rows; ++y) {
+            for (int x = 0; x < src.cols; ++x) {
+                uchar* pixel = src.ptr<uchar>(y) + x * 4;
+                bool isWhite = x < 30;
+                pixel[0] = isWhite || y >= 40 ? 255 : 0;
+                pixel[1] = isWhite ? 255 : 0;
+                pixel[2] = isWhite || y < 40 ? 255 : 0;
+                pixel[3] = isWhite ? 255 : 0;
+            }
+        }
+        cv::Mat output;
+        resampleImage(src, output, cv::Size(20, 20), filter, simdLevel);
+        std::string name = std::format("{} {} transparent edges", getResampleFilterName(filter), getSimdLevelName(simdLevel));
+
+        bool isWhite = true, isFaded = false;
+        for (int y = 0; y < output.rows; ++y) {
+            for (int x = 0; x < output.cols; ++x) {
+                const uchar* pixel = output.ptr<uchar>(y) + x * 4;
+                uchar minColor = pixel[3] > 0 ? 254 : 0;
+                uchar maxColor = pixel[3] > 0 ? 255 : 0;
+                for (int c = 0; c < 3; ++c) {
+                    isWhite = isWhite && pixel[c] >= minColor && pixel[c] <= maxColor;
+                }
+                isFaded = isFaded || (pixel[3] > 0 && pixel[3] < 255);
+            }
+        }
+        CHECK_MSG(isWhite, name);
+        CHECK_MSG(isFaded, name);
+        CHECK_MSG(output.ptr<uchar>(19)[19 * 4 + 3] == 0, name);
+
+        // Opaque pixels come out as they do without the alpha channel
+        cv::Mat opaque = makeTestImage(61, 97, 4, 1);
+        cv::Mat bgr(opaque.rows, opaque.cols, CV_8UC3);
+        for (int y = 0; y < opaque.rows; ++y) {
+            for (int x = 0; x < opaque.cols; ++x) {
+                uchar* pixel = opaque.ptr<uchar>(y) + x * 4;
+                pixel[3] = 255;
+                std::copy(pixel, pixel + 3, bgr.ptr<uchar>(y) + x * 3);
+            }
+        }
+        cv::Mat withAlpha, withoutAlpha;
+        resampleImage(opaque, withAlpha, cv::Size(33, 20), filter, simdLevel);
+        resampleImage(bgr, withoutAlpha, cv::Size(33, 20), filter, simdLevel);
+        bool isSame = true;
+        for (int y = 0; y < withAlpha.rows; ++y) {
+            for (int x = 0; x < withAlpha.cols; ++x) {
+                const uchar* pixel = withAlpha.ptr<uchar>(y) + x * 4;
+                const uchar* expected = withoutAlpha.ptr<uchar>(y) + x * 3;
+                for (int c = 0; c < 3; ++c) {
+                    isSame = isSame && std::abs(pixel[c] - expected[c]) <= 1;
+                }
+                isSame = isSame && pixel[3] == 255;
+            }
+        }
+        CHECK_MSG(isSame, name + " opaque");
+    }
+}
+
+
+int main() {
+    const ResampleFilter filters[] = {ResampleFilter::Area, ResampleFilter::Bilinear, ResampleFilter::Bicubic,
+                                      ResampleFilter::Lanczos3};
+    // Odd widths leave tails for every vector width, 1 pixel high or wide is the smallest the filters have to handle
+    const cv::Size sizes[][2] = {{{97, 61}, {33, 20}}, {{640, 480}, {201, 151}}, {{255, 17}, {1, 1}}, {{50, 50}, {50, 50}},
+                                 {{1, 300}, {1, 99}}};
+    std::vector<SimdLevel> simdLevels = getTestedSimdLevels();
+
+    uint32_t seed = 1;
+    for (ResampleFilter filter : filters) {
+        for (int channels : {1, 3, 4}) {
+            for (const auto& [srcSize, dstSize] : sizes) {
+                cv::Mat src = makeTestImage(srcSize.height, srcSize.width, channels, seed++);
+                cv::Mat reference;
+                resampleImage(src, reference, dstSize, filter, SimdLevel::Scalar);
+                std::string name = std::format("{} {} channels {}x{} -> {}x{}", getResampleFilterName(filter), channels,
+                                          srcSize.width, srcSize.height, dstSize.width, dstSize.height);
+                CHECK_MSG(reference.cols == dstSize.width && reference.rows == dstSize.height, name);
+
+                for (SimdLevel simdLevel : simdLevels) {
+                    // The kernels add up the same float products in another order, which may round differently
+                    cv::Mat output;
+                    resampleImage(src, output, dstSize, filter, simdLevel);
+                    int difference = getMaxDifference(reference, output);
+                    CHECK_MSG(difference >= 0 && difference <= 1, name + " " + getSimdLevelName(simdLevel));
+
+                    // Row by row has to give exactly what the whole image gives at the same level
+                    Resampler resampler(src.cols, src.rows, dstSize.width, dstSize.height, channels, filter, simdLevel);
+                    cv::Mat streamed(dstSize, src.type());
+                    for (int y = 0; y < src.rows; ++y) {
+                        resampler.pushRow(src.ptr<uchar>(y));
+                        while (resampler.hasOutputRow()) {
+                            resampler.writeOutputRow(streamed.ptr<uchar>(resampler.getDstRowsWritten()));
+                        }
+                    }
+                    CHECK_MSG(resampler.getDstRowsWritten() == dstSize.height, name + " streamed");
+                    CHECK_MSG(getMaxDifference(output, streamed) == 0, name + " streamed " + getSimdLevelName(simdLevel));
+                }
+            }
+        }
+    }
+    for (ResampleFilter filter : filters) {
+        for (SimdLevel simdLevel : simdLevels) {
+            checkTransparentEdges(filter, simdLevel);
+        }
+    }
+    return finishTest();
+}
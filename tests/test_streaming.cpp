@@ -0,0 +1,81 @@
+// Decoding row by row into the resampler has to give exactly what decoding the whole image and then resizing it gives,
+// for the same JPEG and PNG files. Both go through decodeImage and resizeImage, only streamAboveMegapixels differs.
+#include <format>
+#include "downscaler.h"
+#include "image_probe.h"
+#include "test_utils.h"
+
+
+namespace {
+    // 1.92 megapixels, and a multiple of 8 on both sides, so the JPEG decoded at 1/4 scales down to the same size
+    // as the file's dimensions
+    const int imageWidth = 1600;
+    const int imageHeight = 1200;
+
+
+    Mat makeImage16(int channels, uint32_t seed) {
+        std::mt19937 random(seed);
+        Mat image(imageHeight, imageWidth, CV_16UC(channels));
+        for (int y = 0; y < image.rows; ++y) {
+            uint16_t* row = image.ptr<uint16_t>(y);
+            for (int x = 0; x < image.cols * channels; ++x) {
+                row[x] = (uint16_t) ((x * 40 + y * 50 + random() % 2048) % 65536);
+            }
+        }
+        return image;
+    }
+
+
+    // The decoded and downscaled image, the way processTask gets it
+    Mat decodeAndResize(const vector<uchar>& fileBytes, const string& name) {
+        std::optional<LoadedImage> loadedImage = decodeImage(fileBytes, name);
+        if (!loadedImage.has_value()) {
+            return Mat();
+        }
+        auto resizeResult = resizeImage(loadedImage.value());
+        return get<0>(resizeResult).has_value() ? get<0>(resizeResult).value() : loadedImage->image;
+    }
+
+
+    void checkStreamedDecode(const Mat& image, const string& fileExtension, const vector<int>& params) {
+        string name = std::format("{} {} channels {}-bit", fileExtension, image.channels(), image.depth() == CV_16U ? 16 : 8);
+        vector<uchar> fileBytes;
+        CHECK_MSG(cv::imencode(fileExtension, image, fileBytes, params), name);
+        std::optional<ImageHeader> header = probeImageHeader(fileBytes.data(), fileBytes.size());
+        CHECK_MSG(header.has_value(), name);
+        if (!header.has_value() || !canDecodeRows(header->format)) {
+            std::fprintf(stderr, "%s: no row decoder in this build, skipped\n", name.c_str());
+            return;
+        }
+
+        streamAboveMegapixels = 0;
+        Mat whole = decodeAndResize(fileBytes, name);
+        streamAboveMegapixels = 1;
+        CHECK_MSG(shouldStreamImage(header.value()), name);
+        Mat streamed = decodeAndResize(fileBytes, name);
+
+        CHECK_MSG(!whole.empty() && whole.cols == maxImageLength, name);
+        CHECK_MSG(whole.type() == streamed.type(), name + std::format(" {} vs {} channels", whole.channels(), streamed.channels()));
+        CHECK_MSG(getMaxDifference(whole, streamed) == 0, name);
+    }
+}
+
+
+int main() {
+    maxImageLength = 300;
+    const ResampleFilter filters[] = {ResampleFilter::Area, ResampleFilter::Lanczos3};
+
+    uint32_t seed = 1;
+    for (ResampleFilter filter : filters) {
+        resampleFilter = filter;
+        for (int channels : {1, 3, 4}) {
+            Mat image = makeTestImage(imageHeight, imageWidth, channels, seed++);
+            checkStreamedDecode(image, ".png", {});
+            checkStreamedDecode(makeImage16(channels, seed++), ".png", {});
+            if (channels != 4) {
+                checkStreamedDecode(image, ".jpg", {cv::IMWRITE_JPEG_QUALITY, 90});
+            }
+        }
+    }
+    return finishTest();
+}
@@ -0,0 +1,105 @@
+#ifndef IMAGE_DOWNSCALER_TEST_UTILS_H
+#define IMAGE_DOWNSCALER_TEST_UTILS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "cpu_features.h"
+
+
+// No test framework, every test is a plain executable: CHECK prints the failed condition and the test's exit code
+// says whether any did (see finishTest).
+
+inline int numFailedChecks = 0;
+
+
+inline void checkCondition(bool condition, const char* expression, const char* file, int line, const std::string& context) {
+    if (!condition) {
+        numFailedChecks++;
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed%s%s\n", file, line, expression, context.empty() ? "" : ": ",
+                     context.c_str());
+    }
+}
+
+
+#define CHECK(condition) checkCondition((condition), #condition, __FILE__, __LINE__, "")
+#define CHECK_MSG(condition, context) checkCondition((condition), #condition, __FILE__, __LINE__, (context))
+
+
+inline int finishTest() {
+    if (numFailedChecks > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", numFailedChecks);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+// The scalar level and every SIMD level this CPU can run, the scalar one first
+inline std::vector<SimdLevel> getTestedSimdLevels() {
+    SimdLevel detected = detectSimdLevel();
+    std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+    if (detected == SimdLevel::Sse41 || detected == SimdLevel::Avx2) {
+        levels.push_back(SimdLevel::Sse41);
+    }
+    if (detected == SimdLevel::Avx2 || detected == SimdLevel::Neon) {
+        levels.push_back(detected);
+    }
+    return levels;
+}
+
+
+// Noise (of up to +-noise / 2) over smooth gradients, so both flat and busy areas are covered
+inline cv::Mat makeTestImage(int rows, int cols, int channels, uint32_t seed, int noise = 32) {
+    std::mt19937 random(seed);
+    cv::Mat image(rows, cols, CV_8UC(channels));
+    for (int y = 0; y < rows; ++y) {
+        uchar* row = image.ptr<uchar>(y);
+        for (int x = 0; x < cols * channels; ++x) {
+            int value = (x * 3 + y * 5) % 256 + (noise > 0 ? (int) (random() % noise) - noise / 2 : 0);
+            row[x] = (uchar) std::clamp(value, 0, 255);
+        }
+    }
+    return image;
+}
+
+
+// Largest difference of any byte, -1 if the images don't have the same size and type
+inline int getMaxDifference(const cv::Mat& a, const cv::Mat& b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type()) {
+        return -1;
+    }
+    int maxDifference = 0;
+    for (int y = 0; y < a.rows; ++y) {
+        const uchar* rowA = a.ptr<uchar>(y);
+        const uchar* rowB = b.ptr<uchar>(y);
+        for (size_t x = 0; x < a.cols * a.elemSize(); ++x) {
+            maxDifference = std::max(maxDifference, std::abs(rowA[x] - rowB[x]));
+        }
+    }
+    return maxDifference;
+}
+
+
+// Mean difference over all bytes, -1 if the images don't have the same size and type
+inline double getMeanDifference(const cv::Mat& a, const cv::Mat& b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type() || a.empty()) {
+        return -1;
+    }
+    double sum = 0;
+    for (int y = 0; y < a.rows; ++y) {
+        const uchar* rowA = a.ptr<uchar>(y);
+        const uchar* rowB = b.ptr<uchar>(y);
+        for (size_t x = 0; x < a.cols * a.elemSize(); ++x) {
+            sum += std::abs(rowA[x] - rowB[x]);
+        }
+    }
+    return sum / ((double) a.total() * (double) a.elemSize());
+}
+
+
+#endif //IMAGE_DOWNSCALER_TEST_UTILS_H
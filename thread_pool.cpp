@@ -0,0 +1,212 @@
+#include "thread_pool.h"
+#include <exception>
+
+
+namespace {
+    // Identifies the pool and worker the current thread belongs to, so submit() can push to the local deque.
+    thread_local const ThreadPool* currentPool = nullptr;
+    thread_local unsigned int currentWorkerIndex = 0;
+}
+
+
+ThreadPool::ThreadPool(unsigned int numThreads) {
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+
+    workers.reserve(numThreads);
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    threads.reserve(numThreads);
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned int workerIndex;
+    if (currentPool == this) {
+        workerIndex = currentWorkerIndex;
+    } else {
+        workerIndex = nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    }
+
+    pendingTasks.fetch_add(1);
+    {
+        // Counted under the deque's lock, like the pops: a thief can't take the task before it's counted and make the
+        // count wrap around
+        std::lock_guard<std::mutex> lock(workers[workerIndex]->mtx);
+        queuedTasks.fetch_add(1);
+        workers[workerIndex]->tasks.push_back(std::move(task));
+    }
+
+    {
+        // Taking the lock guarantees a worker can't miss the notification between checking and waiting
+        std::lock_guard<std::mutex> lock(stateMtx);
+    }
+    cvWork.notify_one();
+}
+
+
+void ThreadPool::runAll(std::vector<std::function<void()>> tasks) {
+    struct TaskGroup {
+        std::vector<std::function<void()>> tasks;
+        std::atomic<size_t> nextTask = 0;
+        size_t finishedTasks = 0;
+        std::exception_ptr error;
+        std::mutex mtx;
+        std::condition_variable cvFinished;
+    };
+    auto group = std::make_shared<TaskGroup>();
+    group->tasks = std::move(tasks);
+    size_t numTasks = group->tasks.size();
+
+    // Whoever gets there first runs the next task of the group, the pool tasks that find nothing left just return
+    auto runNextTask = [group] {
+        size_t index = group->nextTask++;
+        if (index >= group->tasks.size()) {
+            return false;
+        }
+        std::exception_ptr error;
+        try {
+            group->tasks[index]();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(group->mtx);
+            if (error && !group->error) {
+                group->error = error;
+            }
+            group->finishedTasks++;
+        }
+        group->cvFinished.notify_all();
+        return true;
+    };
+
+    for (size_t i = 1; i < numTasks; ++i) {
+        submit([runNextTask] { runNextTask(); });
+    }
+    while (runNextTask()) {
+    }
+
+    std::unique_lock<std::mutex> lock(group->mtx);
+    group->cvFinished.wait(lock, [&] { return group->finishedTasks == numTasks; });
+    if (group->error) {
+        std::rethrow_exception(group->error);
+    }
+}
+
+
+void ThreadPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(stateMtx);
+    cvIdle.wait(lock, [this] { return pendingTasks.load() == 0; });
+}
+
+
+void ThreadPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(stateMtx);
+        if (stopping) {
+            return;
+        }
+        stopping = true;
+    }
+    cvWork.notify_all();
+
+    for (std::thread& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+
+unsigned int ThreadPool::size() const {
+    return static_cast<unsigned int>(workers.size());
+}
+
+
+void ThreadPool::workerLoop(unsigned int workerIndex) {
+    currentPool = this;
+    currentWorkerIndex = workerIndex;
+
+    std::function<void()> task;
+    while (true) {
+        if (popLocalTask(workerIndex, task) || stealTask(workerIndex, task)) {
+            task();
+            task = nullptr;
+            finishTask();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(stateMtx);
+        cvWork.wait(lock, [this] { return queuedTasks.load() > 0 || stopping; });
+        if (stopping && queuedTasks.load() == 0) {
+            return;
+        }
+    }
+}
+
+
+bool ThreadPool::popLocalTask(unsigned int workerIndex, std::function<void()>& task) {
+    Worker& worker = *workers[workerIndex];
+    std::lock_guard<std::mutex> lock(worker.mtx);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    queuedTasks.fetch_sub(1);
+    return true;
+}
+
+
+bool ThreadPool::stealTask(unsigned int workerIndex, std::function<void()>& task) {
+    // Busy victims are skipped first, another one may have a task to spare right away. If one was skipped, the second
+    // pass waits for the locks: queuedTasks still counts its task, so waiting on cvWork instead would return at once
+    // and spin for as long as the victim holds its lock.
+    size_t numWorkers = workers.size();
+    for (bool isBlocking : {false, true}) {
+        bool skippedVictim = false;
+        for (size_t offset = 1; offset < numWorkers; ++offset) {
+            Worker& victim = *workers[(workerIndex + offset) % numWorkers];
+            std::unique_lock<std::mutex> lock(victim.mtx, std::defer_lock);
+            if (isBlocking) {
+                lock.lock();
+            } else if (!lock.try_lock()) {
+                skippedVictim = true;
+                continue;
+            }
+            if (victim.tasks.empty()) {
+                continue;
+            }
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queuedTasks.fetch_sub(1);
+            return true;
+        }
+        if (!skippedVictim) {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+void ThreadPool::finishTask() {
+    if (pendingTasks.fetch_sub(1) == 1) {
+        {
+            std::lock_guard<std::mutex> lock(stateMtx);
+        }
+        cvIdle.notify_all();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef IMAGE_DOWNSCALER_THREAD_POOL_H
+#define IMAGE_DOWNSCALER_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed-size pool of worker threads. Every worker owns a deque of tasks; it pops from the back of its own deque and,
+// when that runs dry, steals from the front of the other workers' deques. Tasks submitted from outside the pool are
+// spread round-robin over the workers, tasks submitted from inside a worker go to that worker's own deque.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // Runs the tasks on the pool and returns once all of them have finished, rethrowing the first exception one threw.
+    // The calling thread works through the tasks itself instead of only waiting, and never runs any other task, so a
+    // worker can call this for the parts of its own task; idle workers steal the rest.
+    void runAll(std::vector<std::function<void()>> tasks);
+    // Blocks until every submitted task has finished running.
+    void waitIdle();
+    // Finishes all queued tasks and joins the worker threads. Called by the destructor as well.
+    void shutdown();
+    unsigned int size() const;
+
+private:
+    struct Worker {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mtx;
+    };
+
+    void workerLoop(unsigned int workerIndex);
+    bool popLocalTask(unsigned int workerIndex, std::function<void()>& task);
+    bool stealTask(unsigned int workerIndex, std::function<void()>& task);
+    void finishTask();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextWorker = 0;
+    std::atomic<size_t> queuedTasks = 0;   // tasks sitting in a deque, changed under that deque's lock
+    std::atomic<size_t> pendingTasks = 0;  // queued + currently running tasks
+    std::mutex stateMtx;
+    std::condition_variable cvWork;
+    std::condition_variable cvIdle;
+    bool stopping = false;
+};
+
+
+#endif //IMAGE_DOWNSCALER_THREAD_POOL_H